@@ -1,24 +1,737 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <time.h>
 #include "bee.h"
+#include "bee_ratelimit.h"
+
+#define BEE_CONN_SLOT(h)        ((uint32_t)((h) & 0xffffffff))
+#define BEE_CONN_GEN(h)         ((uint32_t)((h) >> 32))
+
+#define BEE_OUTBUF_SIZE         (16 * 1024)     /* pooled output buffer, header included */
+#define BEE_OUTBUF_POOL_MAX     64              /* idle buffers kept per thread */
+#define BEE_DGRAM_QUEUE_MAX     (1024 * 1024)   /* bytes a udp server may queue */
+#define BEE_MCAST_ROUNDS        8               /* recvmmsg() calls per read event */
+#define BEE_UDP_ROUNDS          8               /* batches per read event of a session server */
+#define BEE_UDP_NONE            UINT32_MAX      /* no session, end of the idle list */
+
+#ifndef IOV_MAX
+#define IOV_MAX                 1024
+#endif
+
+/* older headers; the kernel tells at run time whether it has them */
+#ifndef SOL_UDP
+#define SOL_UDP                 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT             103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO                 104
+#endif
+
+/* A live slot holds the position of its connection in the dense
+ * server->conns array, a free slot the next entry of the free list.
+ */
+struct bee_conn_slot {
+    uint32_t                    gen;
+    uint32_t                    index;
+};
+
+
+/* Receive buffers of a multicast server with a batch callback */
+struct bee_mcast {
+    bee_mcast_cb                cb;
+    void                      * arg;
+    struct mmsghdr              hdrs[BEE_MCAST_BATCH];
+    struct iovec                iov[BEE_MCAST_BATCH];
+    struct sockaddr_in          src[BEE_MCAST_BATCH];
+    char                        ctrl[BEE_MCAST_BATCH][CMSG_SPACE(sizeof(struct in_pktinfo))];
+    bee_mcast_msg_t             msgs[BEE_MCAST_BATCH];
+    char                        buf[BEE_MCAST_BATCH][BEE_MCAST_DGRAM_SIZE];
+};
+
+/* The peers of a udp server in session mode. `buckets' is an open
+ * addressing table of session indexes (plus 1, 0 is empty) next to their
+ * hashes, so a lookup only touches the session it finds.
+ */
+struct bee_udp_bucket {
+    uint32_t                    hash;
+    uint32_t                    index;
+};
+
+struct bee_udp_sessions {
+    bee_udp_recv_cb             on_recv;
+    bee_udp_sess_cb             on_open;
+    bee_udp_sess_cb             on_close;
+    void                      * arg;
+    uint64_t                    idle_ms;
+    struct event              * expire_ev;
+    uint32_t                    max;
+    uint32_t                    count;
+    uint32_t                    free_head;      /* unused sessions, linked by `next' */
+    uint32_t                    idle_head;      /* least recently heard from */
+    uint32_t                    idle_tail;
+    uint32_t                    mask;           /* buckets - 1 */
+    struct bee_udp_bucket     * buckets;
+    bee_udp_session_t         * sess;
+    struct mmsghdr              rx[BEE_UDP_BATCH];
+    struct mmsghdr              tx[BEE_UDP_BATCH];
+    struct iovec                rx_iov[BEE_UDP_BATCH];
+    struct iovec                tx_iov[BEE_UDP_BATCH];
+    struct sockaddr_storage     src[BEE_UDP_BATCH];
+    char                        ctrl[BEE_UDP_BATCH][CMSG_SPACE(sizeof(int))];
+    char                      * rx_buf;         /* BEE_UDP_BATCH buffers of rx_size */
+    size_t                      rx_size;
+    char                        tx_buf[BEE_UDP_BATCH][BEE_UDP_DGRAM_SIZE];
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Connection table                                                          */
+/*---------------------------------------------------------------------------*/
+static int
+__conn_table_add(bee_server_t *server, bee_connection_t *conn)
+{
+    struct bee_conn_slot *slot;
+    uint32_t idx;
+
+    if (server->free_slot == server->nslots) {
+        uint32_t n = server->nslots ? server->nslots * 2 : 64;
+        struct bee_conn_slot *slots;
+        bee_connection_t **conns;
+
+        conns = realloc(server->conns, n * sizeof(*conns));
+        if (!conns)
+            return -1;
+        server->conns = conns;
+
+        slots = realloc(server->slots, n * sizeof(*slots));
+        if (!slots)
+            return -1;
+
+        for (idx = server->nslots; idx < n; idx++) {
+            slots[idx].gen = 1;
+            slots[idx].index = idx + 1;
+        }
+        server->slots = slots;
+        server->free_slot = server->nslots;
+        server->nslots = n;
+    }
+
+    idx = server->free_slot;
+    slot = &server->slots[idx];
+    server->free_slot = slot->index;
+    slot->index = server->nconns;
+    server->conns[server->nconns++] = conn;
+    conn->handle = ((bee_conn_handle_t)slot->gen << 32) | idx;
+
+    return 0;
+}
+
+static void
+__conn_table_remove(bee_server_t *server, bee_connection_t *conn)
+{
+    struct bee_conn_slot *slot = &server->slots[BEE_CONN_SLOT(conn->handle)];
+    bee_connection_t *last = server->conns[--server->nconns];
+
+    /* keep the live connections dense: move the last one into the hole */
+    server->conns[slot->index] = last;
+    server->slots[BEE_CONN_SLOT(last->handle)].index = slot->index;
+
+    if (++slot->gen == 0)
+        slot->gen = 1;
+    slot->index = server->free_slot;
+    server->free_slot = BEE_CONN_SLOT(conn->handle);
+    conn->handle = 0;
+}
+/*---------------------------------------------------------------------------*/
+
+static void __connection_destroy(bee_connection_t *conn);
+static void __tcp_conn_write_cb(evutil_socket_t sfd, short events, void *arg);
+static void __udp_sess_read(bee_server_t *server, evutil_socket_t sfd);
+static void __udp_sess_free(bee_server_t *server);
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Socket options                                                            */
+/*---------------------------------------------------------------------------*/
+static int
+__setsockopt_int(evutil_socket_t sfd, int level, int name, int value)
+{
+    return setsockopt(sfd, level, name, &value, sizeof(value));
+}
+
+/* The per-connection part of the server's profile, right after accept().
+ * The buffer sizes are inherited from the listener.
+ */
+static void
+__conn_apply_sockopts(bee_server_t *server, evutil_socket_t sfd)
+{
+    const bee_sockopts_t *opts = &server->sockopts;
+
+    if (opts->nodelay && __setsockopt_int(sfd, IPPROTO_TCP, TCP_NODELAY, 1) < 0)
+        perror("setsockopt(TCP_NODELAY)");
+    if (opts->quickack && __setsockopt_int(sfd, IPPROTO_TCP, TCP_QUICKACK, 1) < 0)
+        perror("setsockopt(TCP_QUICKACK)");
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Loop monitor                                                              */
+/*---------------------------------------------------------------------------*/
+struct bee_monitor {
+    struct event_base         * evbase;
+    struct event              * probe_ev;
+    struct event              * mark_ev;        /* ends the pass that activated it */
+    struct timeval              probe_tv;
+    uint64_t                    probe_due;      /* when probe_ev should run, ns */
+    uint64_t                    pass_hooks;     /* hooks of the current pass */
+    bee_loop_stats_t            stats;
+};
+
+static uint64_t
+__now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Puts `ev' in the priority class `prio', or the lowest there is. */
+static void
+__event_set_priority(struct event *ev, int prio)
+{
+    int n = event_base_get_npriorities(event_get_base(ev));
+
+    if (n > 1)
+        event_priority_set(ev, prio < n ? prio : n - 1);
+}
+
+/* Puts an event of `server' other than its listener in the server's class. */
+static void
+__server_event_priority(bee_server_t *server, struct event *ev)
+{
+    if (server->priority != BEE_PRIO_DEFAULT)
+        __event_set_priority(ev, server->priority);
+}
+
+static void
+__monitor_mark_cb(evutil_socket_t fd, short events, void *arg)
+{
+    bee_monitor_t *mon = arg;
+
+    ++mon->stats.passes;
+    if (mon->pass_hooks > mon->stats.hooks_max)
+        mon->stats.hooks_max = mon->pass_hooks;
+    mon->pass_hooks = 0;
+}
+
+/* Brackets a hook of `server'; returns its start time, 0 if unmonitored. */
+static uint64_t
+__monitor_begin(bee_server_t *server)
+{
+    bee_monitor_t *mon = server->monitor;
+    struct event *running;
+
+    if (mon == NULL)
+        return 0;
+
+    /* the marker queues up behind the ready events of the running class;
+     * a higher class would preempt them
+     */
+    if (mon->pass_hooks++ == 0) {
+        running = event_base_get_running_event(mon->evbase);
+        if (running != NULL)
+            event_priority_set(mon->mark_ev, event_get_priority(running));
+        event_active(mon->mark_ev, EV_TIMEOUT, 1);
+    }
+    return __now_ns();
+}
+
+static void
+__monitor_end(bee_server_t *server, uint64_t start)
+{
+    bee_monitor_t *mon = server->monitor;
+    uint64_t ns;
+
+    if (mon == NULL || start == 0)
+        return;
+
+    ns = __now_ns() - start;
+    ++mon->stats.hooks;
+    mon->stats.hook_ns += ns;
+    if (ns > mon->stats.hook_max_ns)
+        mon->stats.hook_max_ns = ns;
+}
+
+static void
+__monitor_probe_cb(evutil_socket_t fd, short events, void *arg)
+{
+    bee_monitor_t *mon = arg;
+    uint64_t now = __now_ns();
+    uint64_t lag = now > mon->probe_due ? (now - mon->probe_due) / 1000 : 0;
+
+    ++mon->stats.probes;
+    mon->stats.lag_us = lag;
+    mon->stats.lag_avg_us = mon->stats.probes == 1 ? lag : (mon->stats.lag_avg_us * 7 + lag) / 8;
+    if (lag > mon->stats.lag_max_us)
+        mon->stats.lag_max_us = lag;
+
+    mon->probe_due = now + (uint64_t)mon->probe_tv.tv_sec * 1000000000ull + mon->probe_tv.tv_usec * 1000ull;
+    event_add(mon->probe_ev, &mon->probe_tv);
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Graceful drain                                                            */
+/*---------------------------------------------------------------------------*/
+static void
+__drain_close_idle(bee_connection_t *conn, void *arg)
+{
+    int expired = *(int *)arg;
+
+    if (expired)
+        __connection_destroy(conn);
+    else if (!(conn->flags & (BEE_CONN_F_PAUSED | BEE_CONN_F_BUSY)))
+        bee_connection_close(conn);
+}
+
+/* Lets the protocol say goodbye, e.g. an HTTP/2 GOAWAY, before the idle
+ * connections are closed.
+ */
+static void
+__drain_shutdown(bee_connection_t *conn, void *arg)
+{
+    bee_server_t *server = conn->server;
+
+    if (conn->flags & BEE_CONN_F_CLOSING)
+        return;
+    if (server->on_shutdown(event_get_fd(conn->accept_ev), conn) != BEE_HOOK_OK)
+        bee_connection_close(conn);
+}
+
+static void
+__server_drain_cb(evutil_socket_t fd, short events, void *arg)
+{
+    bee_server_t *server = arg;
+    struct timeval left;
+    uint64_t now = 0;
+    int expired = 0;
+
+    if (server->drain_state != BEE_DRAIN_RUNNING)
+        return;
+
+    if (server->drain_deadline != 0) {
+        now = __now_ns();
+        expired = now >= server->drain_deadline;
+    }
+
+    bee_server_foreach_conn(server, __drain_close_idle, &expired);
+
+    if (server->nconns == 0) {
+        server->drain_state = BEE_DRAIN_DONE;
+        if (server->on_drained != NULL)
+            server->on_drained(server, server->drain_arg);
+        return;
+    }
+
+    /* the rest is busy; re-check when one of them finishes or at the deadline */
+    if (server->drain_deadline != 0) {
+        now = server->drain_deadline - now;
+        left.tv_sec = now / 1000000000ull;
+        left.tv_usec = now % 1000000000ull / 1000;
+        evtimer_add(server->drain_ev, &left);
+    }
+}
+
+static void
+__server_drain_kick(bee_server_t *server)
+{
+    if (server != NULL && server->drain_state == BEE_DRAIN_RUNNING)
+        event_active(server->drain_ev, EV_TIMEOUT, 1);
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Output queue                                                              */
+/*---------------------------------------------------------------------------*/
+/* Output the socket did not take yet, copied into buffers of
+ * BEE_OUTBUF_SIZE that are kept on a per-thread free list. A datagram
+ * bigger than that gets a buffer of its own.
+ */
+struct bee_outbuf {
+    struct bee_outbuf         * next;
+    size_t                      off;        /* first unsent byte */
+    size_t                      len;        /* end of data */
+    size_t                      cap;
+    struct sockaddr_storage     addr;       /* datagrams only */
+    socklen_t                   addrlen;
+    char                        data[];
+};
+
+static __thread struct bee_outbuf *outbuf_pool = NULL;
+static __thread int outbuf_pool_len = 0;
+static __thread int outbuf_used = 0;        /* holding queued output */
+
+static struct bee_outbuf *
+__outbuf_get(size_t need)
+{
+    struct bee_outbuf *buf;
+    size_t cap = BEE_OUTBUF_SIZE - sizeof(*buf);
+
+    if (need <= cap && outbuf_pool != NULL) {
+        buf = outbuf_pool;
+        outbuf_pool = buf->next;
+        --outbuf_pool_len;
+    } else {
+        if (need > cap)
+            cap = need;
+        buf = malloc(sizeof(*buf) + cap);
+        if (!buf)
+            return NULL;
+        buf->cap = cap;
+    }
+
+    buf->next = NULL;
+    buf->off = 0;
+    buf->len = 0;
+    ++outbuf_used;
+    return buf;
+}
+
+static void
+__outbuf_put(struct bee_outbuf *buf)
+{
+    --outbuf_used;
+    if (buf->cap != BEE_OUTBUF_SIZE - sizeof(*buf) || outbuf_pool_len >= BEE_OUTBUF_POOL_MAX) {
+        free(buf);
+        return;
+    }
+    buf->next = outbuf_pool;
+    outbuf_pool = buf;
+    ++outbuf_pool_len;
+}
+
+static void
+__outq_free(struct bee_outbuf **head, struct bee_outbuf **tail)
+{
+    struct bee_outbuf *buf;
+
+    while ((buf = *head) != NULL) {
+        *head = buf->next;
+        __outbuf_put(buf);
+    }
+    *tail = NULL;
+}
+
+/* Copies what follows the first `skip' bytes of `iov' to the end of the
+ * queue, filling up its last buffer first.
+ */
+static int
+__outq_append(bee_connection_t *conn, const struct iovec *iov, int iovcnt, size_t skip)
+{
+    struct bee_outbuf *buf = conn->outq_tail;
+    const char *p;
+    size_t left, take;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        p = (const char *)iov[i].iov_base + skip;
+        left = iov[i].iov_len - skip;
+        skip = 0;
+
+        while (left > 0) {
+            if (buf == NULL || buf->len == buf->cap) {
+                buf = __outbuf_get(0);
+                if (!buf)
+                    return -1;
+                if (conn->outq_tail != NULL)
+                    conn->outq_tail->next = buf;
+                else
+                    conn->outq = buf;
+                conn->outq_tail = buf;
+            }
+            take = buf->cap - buf->len;
+            if (take > left)
+                take = left;
+            memcpy(buf->data + buf->len, p, take);
+            buf->len += take;
+            conn->outq_len += take;
+            p += take;
+            left -= take;
+        }
+    }
+
+    return 0;
+}
+
+static ssize_t
+__sendv(evutil_socket_t sfd, const struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+
+    if (iovcnt == 1)
+        return send(sfd, iov[0].iov_base, iov[0].iov_len, MSG_NOSIGNAL);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+    return sendmsg(sfd, &msg, MSG_NOSIGNAL);
+}
+
+/* Sends as much of the queue as the socket takes; -1 if it failed. */
+static int
+__conn_flush(bee_connection_t *conn)
+{
+    struct iovec iov[64];
+    struct bee_outbuf *buf;
+    ssize_t nr;
+    int n;
+
+    while (conn->outq != NULL) {
+        for (n = 0, buf = conn->outq; buf != NULL && n < 64; buf = buf->next, n++) {
+            iov[n].iov_base = buf->data + buf->off;
+            iov[n].iov_len = buf->len - buf->off;
+        }
+
+        nr = __sendv(conn->sfd, iov, n);
+        if (nr < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+        conn->outq_len -= nr;
+        while (nr > 0) {
+            buf = conn->outq;
+            if ((size_t)nr < buf->len - buf->off) {
+                buf->off += nr;
+                break;
+            }
+            nr -= buf->len - buf->off;
+            conn->outq = buf->next;
+            if (conn->outq == NULL)
+                conn->outq_tail = NULL;
+            __outbuf_put(buf);
+        }
+    }
+
+    return 0;
+}
+
+/* Write readiness is only asked for while there is something to send, and
+ * not corked, or an on_drain to deliver.
+ */
+static int
+__conn_update_write(bee_connection_t *conn)
+{
+    int want = (conn->outq != NULL && !(conn->flags & BEE_CONN_F_CORKED)) ||
+               (conn->flags & BEE_CONN_F_WANT_DRAIN);
+
+    if (want && !(conn->flags & BEE_CONN_F_WRITING)) {
+        if (conn->write_ev == NULL) {
+            conn->write_ev = event_new(conn->server->evbase, conn->sfd, EV_WRITE|EV_PERSIST,
+                                       __tcp_conn_write_cb, conn);
+            if (!conn->write_ev)
+                return -1;
+            __server_event_priority(conn->server, conn->write_ev);
+        }
+        event_add(conn->write_ev, NULL);
+        conn->flags |= BEE_CONN_F_WRITING;
+    } else if (!want && (conn->flags & BEE_CONN_F_WRITING)) {
+        event_del(conn->write_ev);
+        conn->flags &= ~BEE_CONN_F_WRITING;
+    }
+
+    return 0;
+}
 
+static void
+__tcp_conn_write_cb(evutil_socket_t sfd, short events, void *arg)
+{
+    bee_connection_t *conn = arg;
+    bee_server_t *server = conn->server;
+    enum BEE_HOOK_RESULT status = BEE_HOOK_OK;
+    size_t before = conn->outq_len;
+    uint64_t start;
+
+    /* a cork never outlives the hook that set it */
+    conn->flags &= ~BEE_CONN_F_CORKED;
+    if (__conn_flush(conn) < 0) {
+        __connection_destroy(conn);
+        return;
+    }
+
+    if (conn->flags & BEE_CONN_F_CLOSING) {
+        if (conn->outq == NULL)
+            __connection_destroy(conn);
+        return;
+    }
+
+    if (conn->outq_len > conn->lowat ||
+        (before <= conn->lowat && !(conn->flags & BEE_CONN_F_WANT_DRAIN)))
+    {
+        __conn_update_write(conn);
+        return;
+    }
+
+    /* whatever on_drain writes arms the event again */
+    conn->flags &= ~BEE_CONN_F_WANT_DRAIN;
+    __conn_update_write(conn);
+
+    if (server->on_drain != NULL) {
+        start = __monitor_begin(server);
+        status = server->on_drain(sfd, conn);
+        __monitor_end(server, start);
+    }
+
+    if (status == BEE_HOOK_CLOSED ||
+        status == BEE_HOOK_PEER_CLOSED ||
+        status == BEE_HOOK_ERR)
+    {
+        bee_connection_close(conn);
+    }
+
+    if (status == BEE_HOOK_ERR)
+        event_base_loopexit(server->evbase, NULL);
+}
+
+static void
+__udp_write_cb(evutil_socket_t sfd, short events, void *arg)
+{
+    bee_server_t *server = arg;
+    enum BEE_HOOK_RESULT status = BEE_HOOK_OK;
+    struct bee_outbuf *buf;
+    uint64_t start;
+    ssize_t nr;
+
+    while ((buf = server->outq) != NULL) {
+        nr = sendto(sfd, buf->data, buf->len, 0, (struct sockaddr *)&buf->addr, buf->addrlen);
+        if (nr < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return;
+        if (nr < 0)
+            perror("sendto");   /* dropped, like any datagram */
+
+        server->outq = buf->next;
+        server->outq_len -= buf->len;
+        __outbuf_put(buf);
+    }
+    server->outq_tail = NULL;
+    event_del(server->write_ev);
+
+    if (server->on_drain != NULL) {
+        start = __monitor_begin(server);
+        status = server->on_drain(sfd, server);
+        __monitor_end(server, start);
+    }
+
+    if (status == BEE_HOOK_ERR)
+        event_base_loopexit(server->evbase, NULL);
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+/* Hands the datagrams to the batch callback, BEE_MCAST_BATCH at a time,
+ * until the socket is empty or BEE_MCAST_ROUNDS batches were delivered.
+ */
+static void
+__mcast_read(bee_server_t *server, evutil_socket_t sfd)
+{
+    struct bee_mcast *mc = server->mcast;
+    struct in_pktinfo pktinfo;
+    struct cmsghdr *cmsg;
+    struct msghdr *hdr;
+    bee_mcast_msg_t *msg;
+    int i, n, round;
+
+    for (round = 0; round < BEE_MCAST_ROUNDS; round++) {
+        for (i = 0; i < BEE_MCAST_BATCH; i++) {
+            mc->hdrs[i].msg_hdr.msg_namelen = sizeof(mc->src[i]);
+            mc->hdrs[i].msg_hdr.msg_controllen = sizeof(mc->ctrl[i]);
+            mc->hdrs[i].msg_hdr.msg_flags = 0;
+        }
+
+        n = recvmmsg(sfd, mc->hdrs, BEE_MCAST_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("recvmmsg");
+            return;
+        }
+
+        for (i = 0; i < n; i++) {
+            hdr = &mc->hdrs[i].msg_hdr;
+            msg = &mc->msgs[i];
+            msg->len = mc->hdrs[i].msg_len;
+            msg->truncated = (hdr->msg_flags & MSG_TRUNC) != 0;
+            msg->source = mc->src[i];
+            msg->group.s_addr = INADDR_ANY;
+            msg->ifindex = 0;
+
+            for (cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+                if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+                    memcpy(&pktinfo, CMSG_DATA(cmsg), sizeof(pktinfo));
+                    msg->group = pktinfo.ipi_addr;
+                    msg->ifindex = pktinfo.ipi_ifindex;
+                }
+            }
+        }
+
+        mc->cb(server, mc->msgs, n, mc->arg);
+        if (n < BEE_MCAST_BATCH)
+            return;
+    }
+}
 
 static void
 __udp_conn_read_cb(evutil_socket_t sfd, short events, void *arg)
 {
     bee_server_t *server = arg;
-    enum BEE_HOOK_RESULT status;
+    enum BEE_HOOK_RESULT status = BEE_HOOK_OK;
+    uint64_t start = __monitor_begin(server);
+
+    if (server->mcast != NULL && server->mcast->cb != NULL) {
+        __mcast_read(server, sfd);
+        __monitor_end(server, start);
+        return;
+    }
+
+    if (server->sessions != NULL) {
+        __udp_sess_read(server, sfd);
+        __monitor_end(server, start);
+        return;
+    }
 
     if (server->on_recv != NULL)
         status = server->on_recv(sfd, server);
+    __monitor_end(server, start);
 
     if (status == BEE_HOOK_ERR)
         event_base_loopexit(server->evbase, NULL);
@@ -32,19 +745,27 @@ __tcp_conn_read_cb(evutil_socket_t sfd, short events, void *arg)
 {
     bee_connection_t *conn = arg;
     bee_server_t *server = conn->server;
-    enum BEE_HOOK_RESULT status;
+    enum BEE_HOOK_RESULT status = BEE_HOOK_OK;
+    uint64_t start = __monitor_begin(server);
 
     if (server->on_recv != NULL)
         status = server->on_recv(sfd, conn);
+    __monitor_end(server, start);
 
     if (status == BEE_HOOK_CLOSED ||
         status == BEE_HOOK_PEER_CLOSED ||
         status == BEE_HOOK_ERR)
     {
-        conn->server = NULL;
-        event_free(conn->accept_ev);
-        free(conn);
-        close(sfd);
+        bee_connection_close(conn);
+    }
+    else {
+        if ((conn->flags & BEE_CONN_F_CORKED) && bee_conn_uncork(conn) < 0) {
+            bee_connection_close(conn);
+            return;
+        }
+        /* the kernel leaves quickack mode on its own; enter it again */
+        if (server->sockopts.quickack)
+            __setsockopt_int(sfd, IPPROTO_TCP, TCP_QUICKACK, 1);
     }
 
     if (status == BEE_HOOK_ERR)
@@ -58,10 +779,11 @@ static void
 __tcp_conn_accept_cb(evutil_socket_t sfd, short events, void *arg)
 {
     bee_server_t *server = arg;
-    bee_connection_t *conn;
+    bee_connection_t *conn = NULL;
     evutil_socket_t cli_sfd;
     struct sockaddr_in cli_sock;
     socklen_t cli_len = sizeof(cli_sock);
+    uint64_t start;
 
     cli_sfd = accept(sfd, (struct sockaddr *)&cli_sock, &cli_len);
     if (cli_sfd < 0) {
@@ -69,24 +791,40 @@ __tcp_conn_accept_cb(evutil_socket_t sfd, short events, void *arg)
         return;
     }
 
+    if (server->ratelimit != NULL && bee_ratelimit_take(server->ratelimit, (struct sockaddr *)&cli_sock) < 0) {
+        close(cli_sfd);
+        return;
+    }
+
     if (evutil_make_socket_nonblocking(cli_sfd) < 0)
         goto err;
+    __conn_apply_sockopts(server, cli_sfd);
 
     conn = calloc(1, sizeof(*conn));
     if (!conn)
         goto err;
 
     conn->server = server;
+    conn->sfd = cli_sfd;
     memcpy(&conn->saddr, &cli_sock, cli_len);
     conn->accept_ev = event_new(server->evbase, cli_sfd, EV_READ|EV_PERSIST, __tcp_conn_read_cb, conn);
     if (!conn->accept_ev)
         goto err;
+    __server_event_priority(server, conn->accept_ev);
+
+    if (__conn_table_add(server, conn) < 0) {
+        event_free(conn->accept_ev);
+        goto err;
+    }
 
     conn->pdata = NULL;
     event_add(conn->accept_ev, NULL);
 
-    if (server->on_accept != NULL)
+    if (server->on_accept != NULL) {
+        start = __monitor_begin(server);
         server->on_accept(cli_sfd, conn);
+        __monitor_end(server, start);
+    }
 
     return;
 
@@ -146,8 +884,13 @@ bee_server_tcp_new(struct event_base *evbase, const char *baddr, uint16_t port,
     server->listen_ev = event_new(server->evbase, sfd, EV_READ|EV_PERSIST, __tcp_conn_accept_cb, server);
     if (!server->listen_ev)
         goto err;
+    __event_set_priority(server->listen_ev, BEE_PRIO_HIGH);
+    server->priority = BEE_PRIO_DEFAULT;
     server->on_accept = NULL;
     server->on_recv = NULL;
+    server->on_close = NULL;
+    server->on_drain = NULL;
+    server->on_shutdown = NULL;
     server->pdata = NULL;
 
     event_add(server->listen_ev, NULL);
@@ -198,8 +941,12 @@ bee_server_udp_new(struct event_base *evbase, const char *baddr, uint16_t port)
     server->listen_ev = event_new(server->evbase, sfd, EV_READ|EV_PERSIST, __udp_conn_read_cb, server);
     if (!server->listen_ev)
         goto err;
+    server->priority = BEE_PRIO_DEFAULT;
     server->on_accept = NULL;
     server->on_recv = NULL;
+    server->on_close = NULL;
+    server->on_drain = NULL;
+    server->on_shutdown = NULL;
     server->pdata = NULL;
 
     event_add(server->listen_ev, NULL);
@@ -213,15 +960,20 @@ bee_server_udp_new(struct event_base *evbase, const char *baddr, uint16_t port)
 }
 
 
+/* A multicast server on `port' that is in no group yet; add them with
+ * bee_mcast_join(). Unlike a plain udp socket it only receives the groups
+ * joined on it, so servers on the same port can split a feed between them.
+ */
 bee_server_t *
-bee_server_mcast_new(struct event_base *evbase, const char *laddr, const char *gaddr, uint16_t port)
+bee_server_mcast_open(struct event_base *evbase, uint16_t port)
 {
     bee_server_t *server = NULL;
     evutil_socket_t sfd;
     struct sockaddr_in lsock;
-    char loopch = 1;
-    struct ip_mreq group;
-
+    int on = 1;
+#ifdef IP_MULTICAST_ALL
+    int off = 0;
+#endif
 
     if (!evbase)
         return NULL;
@@ -236,7 +988,14 @@ bee_server_mcast_new(struct event_base *evbase, const char *laddr, const char *g
     if (evutil_make_listen_socket_reuseable(sfd) < 0)
         goto err;
 
-    if (setsockopt(sfd, IPPROTO_IP, IP_MULTICAST_LOOP, (char *)&loopch, sizeof(loopch)) < 0)
+#ifdef IP_MULTICAST_ALL
+    /* by default Linux delivers every group joined by any socket on the port */
+    if (setsockopt(sfd, IPPROTO_IP, IP_MULTICAST_ALL, &off, sizeof(off)) < 0)
+        goto err;
+#endif
+
+    /* tells each datagram's group */
+    if (setsockopt(sfd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) < 0)
         goto err;
 
     memset(&lsock, 0, sizeof(lsock));
@@ -246,13 +1005,6 @@ bee_server_mcast_new(struct event_base *evbase, const char *laddr, const char *g
     if (bind(sfd, (struct sockaddr *)&lsock, sizeof(lsock)) < 0)
         goto err;
 
-    /* Join the multicast group 'gaddr' on the local 'laddr' interface. */
-    group.imr_multiaddr.s_addr = inet_addr(gaddr);
-    group.imr_interface.s_addr = inet_addr(laddr);
-    if (setsockopt(sfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&group, sizeof(group)) < 0)
-        goto err;
-
-
     server = calloc(1, sizeof(*server));
     if (!server)
         goto err;
@@ -262,8 +1014,12 @@ bee_server_mcast_new(struct event_base *evbase, const char *laddr, const char *g
     server->listen_ev = event_new(server->evbase, sfd, EV_READ|EV_PERSIST, __udp_conn_read_cb, server);
     if (!server->listen_ev)
         goto err;
+    server->priority = BEE_PRIO_DEFAULT;
     server->on_accept = NULL;
     server->on_recv = NULL;
+    server->on_close = NULL;
+    server->on_drain = NULL;
+    server->on_shutdown = NULL;
     server->pdata = NULL;
 
     event_add(server->listen_ev, NULL);
@@ -276,6 +1032,25 @@ bee_server_mcast_new(struct event_base *evbase, const char *laddr, const char *g
     return NULL;
 }
 
+/* Joins the multicast group 'gaddr' on the local 'laddr' interface, with
+ * IP_MULTICAST_LOOP on.
+ */
+bee_server_t *
+bee_server_mcast_new(struct event_base *evbase, const char *laddr, const char *gaddr, uint16_t port)
+{
+    bee_server_t *server = bee_server_mcast_open(evbase, port);
+
+    if (!server)
+        return NULL;
+
+    if (bee_mcast_set_loop(server, 1) < 0 || bee_mcast_join(server, gaddr, laddr, NULL) < 0) {
+        bee_server_free(server);
+        return NULL;
+    }
+
+    return server;
+}
+
 void
 bee_server_free(bee_server_t *server)
 {
@@ -284,9 +1059,1346 @@ bee_server_free(bee_server_t *server)
     if (!server)
         return;
 
+    /* nothing may refer to the server after this */
+    while (server->nconns > 0)
+        __connection_destroy(server->conns[server->nconns - 1]);
+
     sfd = event_get_fd(server->listen_ev);
     close(sfd);
     event_free(server->listen_ev);
+    if (server->drain_ev != NULL)
+        event_free(server->drain_ev);
+    if (server->write_ev != NULL)
+        event_free(server->write_ev);
+    __outq_free(&server->outq, &server->outq_tail);
+    free(server->mcast);
+    __udp_sess_free(server);
+    free(server->slots);
+    free(server->conns);
     free(server);
 }
 
+/* Sets the socket options of a tcp server: the listener's at once, the
+ * others on every connection accepted from now on. Buffer sizes are set on
+ * the listener too, so that the handshake already advertises them.
+ * Returns -1 if the listener refused one of them.
+ */
+int
+bee_server_set_sockopts(bee_server_t *server, const bee_sockopts_t *opts)
+{
+    evutil_socket_t sfd = event_get_fd(server->listen_ev);
+    int ret = 0;
+
+    if (server->type != BEE_SERVER_TCP) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    server->sockopts = *opts;
+    if (opts->sndbuf > 0 && __setsockopt_int(sfd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf) < 0)
+        ret = -1;
+    if (opts->rcvbuf > 0 && __setsockopt_int(sfd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf) < 0)
+        ret = -1;
+    if (opts->defer_accept > 0 &&
+        __setsockopt_int(sfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, opts->defer_accept) < 0)
+        ret = -1;
+    if (opts->fastopen > 0 && __setsockopt_int(sfd, IPPROTO_TCP, TCP_FASTOPEN, opts->fastopen) < 0)
+        ret = -1;
+
+    return ret;
+}
+
+/* Limits how fast each client address may open connections to a tcp
+ * server; one over the limit is closed right after accept(). `rl' stays
+ * the caller's, NULL lifts the limit.
+ */
+void
+bee_server_set_ratelimit(bee_server_t *server, struct bee_ratelimit *rl)
+{
+    server->ratelimit = rl;
+}
+
+/* Puts the events of `server', its listener and those of every connection,
+ * in the BEE_PRIORITY class `priority', so that a control plane server on a
+ * shared event_base runs before a bulk one. Has no effect on an event_base
+ * without priority classes; -1 if `priority' is not a class.
+ */
+int
+bee_server_set_priority(bee_server_t *server, int priority)
+{
+    int listener = priority;
+    uint32_t i;
+
+    if (priority < BEE_PRIO_DEFAULT || priority >= BEE_PRIORITIES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    server->priority = priority;
+    if (priority == BEE_PRIO_DEFAULT) {
+        listener = server->type == BEE_SERVER_TCP ? BEE_PRIO_HIGH : BEE_PRIO_NORMAL;
+        priority = BEE_PRIO_NORMAL;
+    }
+
+    __event_set_priority(server->listen_ev, listener);
+    if (server->write_ev != NULL)
+        __event_set_priority(server->write_ev, priority);
+    if (server->sessions != NULL)
+        __event_set_priority(server->sessions->expire_ev, priority);
+
+    for (i = 0; i < server->nconns; i++) {
+        __event_set_priority(server->conns[i]->accept_ev, priority);
+        if (server->conns[i]->write_ev != NULL)
+            __event_set_priority(server->conns[i]->write_ev, priority);
+    }
+
+    return 0;
+}
+
+/* Returns NULL if the connection behind `handle' has been closed. */
+bee_connection_t *
+bee_connection_lookup(bee_server_t *server, bee_conn_handle_t handle)
+{
+    struct bee_conn_slot *slot;
+    bee_connection_t *conn;
+
+    if (!server || BEE_CONN_SLOT(handle) >= server->nslots)
+        return NULL;
+
+    slot = &server->slots[BEE_CONN_SLOT(handle)];
+    if (slot->gen != BEE_CONN_GEN(handle) || slot->index >= server->nconns)
+        return NULL;
+
+    conn = server->conns[slot->index];
+    return conn->handle == handle ? conn : NULL;
+}
+
+uint32_t
+bee_server_conn_count(bee_server_t *server)
+{
+    return server->nconns;
+}
+
+/* Calls `fn' for every open connection of `server'. `fn' may close the
+ * connection it is given, but no other one.
+ */
+void
+bee_server_foreach_conn(bee_server_t *server, bee_conn_iter_fn fn, void *arg)
+{
+    uint32_t i;
+
+    for (i = server->nconns; i > 0; i--)
+        fn(server->conns[i - 1], arg);
+}
+
+
+
+static void
+__connection_destroy(bee_connection_t *conn)
+{
+    bee_server_t *server = conn->server;
+    evutil_socket_t sfd = event_get_fd(conn->accept_ev);
+
+    if (server != NULL && server->on_close != NULL)
+        server->on_close(sfd, conn);
+    if (server != NULL && conn->handle != 0)
+        __conn_table_remove(server, conn);
+    conn->server = NULL;
+    event_free(conn->accept_ev);
+    if (conn->write_ev != NULL)
+        event_free(conn->write_ev);
+    __outq_free(&conn->outq, &conn->outq_tail);
+    free(conn);
+    close(sfd);
+
+    if (server != NULL && server->nconns == 0)
+        __server_drain_kick(server);
+}
+
+/* Output still queued on `conn' is sent first, with nothing read from it
+ * meanwhile; on_close is called when it really closes.
+ */
+void
+bee_connection_close(bee_connection_t *conn)
+{
+    if (!conn)
+        return;
+
+    if (conn->outq == NULL || conn->server == NULL || bee_conn_uncork(conn) < 0) {
+        __connection_destroy(conn);
+        return;
+    }
+
+    if (!(conn->flags & BEE_CONN_F_CLOSING)) {
+        conn->flags |= BEE_CONN_F_CLOSING;
+        conn->flags &= ~BEE_CONN_F_WANT_DRAIN;
+        event_del(conn->accept_ev);
+    }
+    if (conn->outq == NULL || __conn_update_write(conn) < 0)
+        __connection_destroy(conn);
+}
+
+/* Marks `conn' as having work in flight that is not visible from here, so
+ * a drain keeps it open; reading goes on. A drain closes it once it is
+ * marked idle again, unless the protocol closed it already.
+ */
+void
+bee_conn_set_busy(bee_connection_t *conn, int busy)
+{
+    if (busy) {
+        conn->flags |= BEE_CONN_F_BUSY;
+        return;
+    }
+    conn->flags &= ~BEE_CONN_F_BUSY;
+    if (conn->server != NULL)
+        __server_drain_kick(conn->server);
+}
+
+/* Stop delivering on_recv for `conn' until bee_connection_resume(), e.g.
+ * while a response for it is produced outside the event loop.
+ */
+void
+bee_connection_pause(bee_connection_t *conn)
+{
+    conn->flags |= BEE_CONN_F_PAUSED;
+    event_del(conn->accept_ev);
+}
+
+/* While the server drains, a resumed connection is idle and gets closed. */
+void
+bee_connection_resume(bee_connection_t *conn)
+{
+    conn->flags &= ~BEE_CONN_F_PAUSED;
+    if (conn->flags & BEE_CONN_F_CLOSING)
+        return;
+    if (conn->server->drain_state == BEE_DRAIN_RUNNING) {
+        __server_drain_kick(conn->server);
+        return;
+    }
+    event_add(conn->accept_ev, NULL);
+}
+
+/* Sends `len' bytes on `conn', as much as the socket takes right away; the
+ * rest is queued and goes out in order as the socket becomes writable, so
+ * the data can be reused as soon as this returns. Returns 0, or -1 with
+ * errno set if the connection failed or is closing.
+ */
+int
+bee_conn_write(bee_connection_t *conn, const void *data, size_t len)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    return bee_conn_writev(conn, &iov, 1);
+}
+
+int
+bee_conn_writev(bee_connection_t *conn, const struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    ssize_t nr = 0;
+    int i;
+
+    if (conn->flags & BEE_CONN_F_CLOSING) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    for (i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+    if (total == 0)
+        return 0;
+
+    /* corked, small writes gather in the queue; a big one goes out as is */
+    if (conn->flags & BEE_CONN_F_CORKED) {
+        if (total < BEE_OUTBUF_SIZE)
+            return __outq_append(conn, iov, iovcnt, 0);
+        if (__conn_flush(conn) < 0)
+            return -1;
+    }
+
+    /* behind queued output, new data waits its turn */
+    if (conn->outq == NULL) {
+        nr = __sendv(conn->sfd, iov, iovcnt);
+        if (nr < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                return -1;
+            nr = 0;
+        }
+        if ((size_t)nr == total)
+            return 0;
+    }
+
+    if (__outq_append(conn, iov, iovcnt, nr) < 0 || __conn_update_write(conn) < 0)
+        return -1;
+    return 0;
+}
+
+/* Holds back small writes to `conn' until bee_conn_uncork(), so that a
+ * response written in pieces leaves in one go rather than in a segment
+ * per piece. A cork left on is pulled once the hook returns.
+ */
+void
+bee_conn_cork(bee_connection_t *conn)
+{
+    conn->flags |= BEE_CONN_F_CORKED;
+}
+
+/* Sends what was held back by bee_conn_cork(); -1 if the socket failed. */
+int
+bee_conn_uncork(bee_connection_t *conn)
+{
+    if (!(conn->flags & BEE_CONN_F_CORKED))
+        return 0;
+
+    conn->flags &= ~BEE_CONN_F_CORKED;
+    if (__conn_flush(conn) < 0)
+        return -1;
+    return __conn_update_write(conn);
+}
+
+/* The output buffers of the calling thread: those holding queued output,
+ * and those kept for reuse.
+ */
+void
+bee_outbuf_stats(int *used, int *pooled)
+{
+    *used = outbuf_used;
+    *pooled = outbuf_pool_len;
+}
+
+/* Bytes written to `conn' that the socket has not taken yet. */
+size_t
+bee_conn_pending(const bee_connection_t *conn)
+{
+    return conn->outq_len;
+}
+
+/* on_drain is called when the queued output of `conn' goes down to `lowat'
+ * bytes; by default once all of it is sent.
+ */
+void
+bee_conn_set_lowat(bee_connection_t *conn, size_t lowat)
+{
+    conn->lowat = lowat;
+}
+
+/* Asks for one on_drain as soon as `conn' is writable and no more than its
+ * low watermark is queued, e.g. to produce output piecewise.
+ */
+void
+bee_conn_want_drain(bee_connection_t *conn)
+{
+    if (conn->flags & BEE_CONN_F_CLOSING)
+        return;
+    conn->flags |= BEE_CONN_F_WANT_DRAIN;
+    __conn_update_write(conn);
+}
+
+/* The datagram counterpart of bee_conn_write() for udp and multicast
+ * servers: a datagram the socket has no room for is queued, up to
+ * BEE_DGRAM_QUEUE_MAX bytes, and on_drain is called once the queue is
+ * empty again.
+ */
+int
+bee_server_sendto(bee_server_t *server, const void *data, size_t len,
+                  const struct sockaddr *addr, socklen_t addrlen)
+{
+    evutil_socket_t sfd = event_get_fd(server->listen_ev);
+    struct bee_outbuf *buf;
+    ssize_t nr;
+
+    if (addrlen > sizeof(buf->addr)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (server->outq == NULL) {
+        nr = sendto(sfd, data, len, 0, addr, addrlen);
+        if (nr >= 0)
+            return 0;
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+    }
+
+    if (server->outq_len + len > BEE_DGRAM_QUEUE_MAX) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    if (server->write_ev == NULL) {
+        server->write_ev = event_new(server->evbase, sfd, EV_WRITE|EV_PERSIST, __udp_write_cb, server);
+        if (!server->write_ev)
+            return -1;
+        __server_event_priority(server, server->write_ev);
+    }
+
+    buf = __outbuf_get(len);
+    if (!buf)
+        return -1;
+    memcpy(buf->data, data, len);
+    buf->len = len;
+    memcpy(&buf->addr, addr, addrlen);
+    buf->addrlen = addrlen;
+
+    if (server->outq_tail != NULL)
+        server->outq_tail->next = buf;
+    else
+        server->outq = buf;
+    server->outq_tail = buf;
+    server->outq_len += len;
+
+    event_add(server->write_ev, NULL);
+    return 0;
+}
+
+
+/* Stop accepting, close idle connections at once and the busy (paused or
+ * bee_conn_set_busy()) ones as they finish, or all of them when `timeout'
+ * elapses. on_shutdown is called for each connection first. `cb' is called
+ * once no connection is left; the server may be freed from there.
+ */
+int
+bee_server_drain(bee_server_t *server, const struct timeval *timeout, bee_server_drain_cb cb, void *arg)
+{
+    if (!server || server->drain_state != BEE_DRAIN_NONE)
+        return -1;
+
+    server->drain_ev = evtimer_new(server->evbase, __server_drain_cb, server);
+    if (!server->drain_ev)
+        return -1;
+    __event_set_priority(server->drain_ev, BEE_PRIO_HIGH);
+
+    event_del(server->listen_ev);
+    server->on_drained = cb;
+    server->drain_arg = arg;
+    server->drain_deadline = 0;
+    if (timeout != NULL)
+        server->drain_deadline = __now_ns() + (uint64_t)timeout->tv_sec * 1000000000ull +
+                                 (uint64_t)timeout->tv_usec * 1000ull;
+
+    server->drain_state = BEE_DRAIN_RUNNING;
+    if (server->on_shutdown != NULL)
+        bee_server_foreach_conn(server, __drain_shutdown, NULL);
+    __server_drain_kick(server);
+    return 0;
+}
+
+int
+bee_server_is_draining(bee_server_t *server)
+{
+    return server->drain_state != BEE_DRAIN_NONE;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Listener handoff                                                          */
+/*---------------------------------------------------------------------------*/
+/* Passes the listening socket of `server' to the process waiting in
+ * bee_listener_recv() on the unix socket `path'. Both processes share the
+ * socket afterwards, so the caller usually drains `server' next.
+ */
+int
+bee_server_send_listener(bee_server_t *server, const char *path)
+{
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    char tag = 'B';
+    evutil_socket_t usfd;
+    int lsfd = event_get_fd(server->listen_ev);
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    usfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (usfd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(usfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto err;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base = &tag;
+    iov.iov_len = sizeof(tag);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &lsfd, sizeof(int));
+
+    if (sendmsg(usfd, &msg, 0) < 0)
+        goto err;
+
+    close(usfd);
+    return 0;
+
+  err:
+    close(usfd);
+    return -1;
+}
+
+/* Blocks until a bee_server_send_listener() peer connects to `path' and
+ * returns the listening socket it passed, ready for bee_server_tcp_adopt().
+ */
+evutil_socket_t
+bee_listener_recv(const char *path)
+{
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    char tag;
+    evutil_socket_t usfd, csfd = -1, lsfd = -1;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    usfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (usfd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(usfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(usfd, 1) < 0)
+        goto out;
+
+    csfd = accept(usfd, NULL, NULL);
+    if (csfd < 0)
+        goto out;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &tag;
+    iov.iov_len = sizeof(tag);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    if (recvmsg(csfd, &msg, 0) <= 0)
+        goto out;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&lsfd, CMSG_DATA(cmsg), sizeof(int));
+
+  out:
+    if (csfd >= 0)
+        close(csfd);
+    close(usfd);
+    unlink(path);
+    return lsfd;
+}
+
+/* Serves an already listening tcp socket, e.g. from bee_listener_recv(). */
+bee_server_t *
+bee_server_tcp_adopt(struct event_base *evbase, evutil_socket_t sfd)
+{
+    bee_server_t *server = NULL;
+
+    if (!evbase || sfd < 0)
+        return NULL;
+
+    if (evutil_make_socket_nonblocking(sfd) < 0)
+        return NULL;
+
+    server = calloc(1, sizeof(*server));
+    if (!server)
+        return NULL;
+    server->evbase = evbase;
+    server->type = BEE_SERVER_TCP;
+    server->listen_ev = event_new(server->evbase, sfd, EV_READ|EV_PERSIST, __tcp_conn_accept_cb, server);
+    if (!server->listen_ev) {
+        free(server);
+        return NULL;
+    }
+    __event_set_priority(server->listen_ev, BEE_PRIO_HIGH);
+    server->priority = BEE_PRIO_DEFAULT;
+    server->on_accept = NULL;
+    server->on_recv = NULL;
+    server->on_close = NULL;
+    server->on_drain = NULL;
+    server->on_shutdown = NULL;
+    server->pdata = NULL;
+
+    event_add(server->listen_ev, NULL);
+    return server;
+}
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Multicast groups                                                          */
+/*---------------------------------------------------------------------------*/
+static int
+__mcast_membership(bee_server_t *server, int join, const char *gaddr, const char *laddr, const char *saddr)
+{
+    evutil_socket_t sfd = event_get_fd(server->listen_ev);
+    struct ip_mreq_source mreq;
+    struct ip_mreq group;
+
+    memset(&mreq, 0, sizeof(mreq));
+    if (server->type != BEE_SERVER_MCAST_UDP ||
+        inet_pton(AF_INET, gaddr, &mreq.imr_multiaddr) != 1 ||
+        (laddr != NULL && inet_pton(AF_INET, laddr, &mreq.imr_interface) != 1) ||
+        (saddr != NULL && inet_pton(AF_INET, saddr, &mreq.imr_sourceaddr) != 1))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (saddr != NULL)
+        return setsockopt(sfd, IPPROTO_IP, join ? IP_ADD_SOURCE_MEMBERSHIP : IP_DROP_SOURCE_MEMBERSHIP,
+                          &mreq, sizeof(mreq));
+
+    group.imr_multiaddr = mreq.imr_multiaddr;
+    group.imr_interface = mreq.imr_interface;
+    return setsockopt(sfd, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP,
+                      &group, sizeof(group));
+}
+
+/* Joins the group `gaddr' on the interface with address `laddr', or the
+ * one the kernel picks if NULL. With a source `saddr' only its traffic to
+ * the group is received (source-specific multicast); joins of several
+ * sources of a group add up. Linux limits a socket to
+ * net.ipv4.igmp_max_memberships groups (20 by default): spread a bigger
+ * feed over several servers on the same port.
+ */
+int
+bee_mcast_join(bee_server_t *server, const char *gaddr, const char *laddr, const char *saddr)
+{
+    return __mcast_membership(server, 1, gaddr, laddr, saddr);
+}
+
+/* Undoes bee_mcast_join() with the same arguments. */
+int
+bee_mcast_leave(bee_server_t *server, const char *gaddr, const char *laddr, const char *saddr)
+{
+    return __mcast_membership(server, 0, gaddr, laddr, saddr);
+}
+
+/* Whether datagrams this host sends to a group are looped back to it. */
+int
+bee_mcast_set_loop(bee_server_t *server, int on)
+{
+    unsigned char loop = on ? 1 : 0;
+
+    return setsockopt(event_get_fd(server->listen_ev), IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+}
+
+/* Receives with recvmmsg() and passes the datagrams to `cb' in batches of
+ * up to BEE_MCAST_BATCH, together with the group each was sent to, instead
+ * of calling on_recv. A NULL `cb' goes back to on_recv.
+ */
+int
+bee_mcast_set_cb(bee_server_t *server, bee_mcast_cb cb, void *arg)
+{
+    struct bee_mcast *mc = server->mcast;
+    int i;
+
+    if (server->type != BEE_SERVER_MCAST_UDP) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (mc == NULL) {
+        mc = calloc(1, sizeof(*mc));
+        if (!mc)
+            return -1;
+
+        for (i = 0; i < BEE_MCAST_BATCH; i++) {
+            mc->iov[i].iov_base = mc->buf[i];
+            mc->iov[i].iov_len = sizeof(mc->buf[i]);
+            mc->hdrs[i].msg_hdr.msg_name = &mc->src[i];
+            mc->hdrs[i].msg_hdr.msg_iov = &mc->iov[i];
+            mc->hdrs[i].msg_hdr.msg_iovlen = 1;
+            mc->hdrs[i].msg_hdr.msg_control = mc->ctrl[i];
+            mc->msgs[i].data = mc->buf[i];
+        }
+        server->mcast = mc;
+    }
+
+    mc->cb = cb;
+    mc->arg = arg;
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* UDP sessions                                                              */
+/*---------------------------------------------------------------------------*/
+static uint32_t
+__sockaddr_hash(const struct sockaddr_storage *ss)
+{
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)ss;
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)ss;
+    const uint8_t *p;
+    uint32_t h = 2166136261u, i, n;
+
+    if (ss->ss_family == AF_INET6) {
+        p = sin6->sin6_addr.s6_addr;
+        n = sizeof(sin6->sin6_addr);
+        h = (h ^ sin6->sin6_port) * 16777619u;
+    }
+    else {
+        p = (const uint8_t *)&sin->sin_addr;
+        n = sizeof(sin->sin_addr);
+        h = (h ^ sin->sin_port) * 16777619u;
+    }
+
+    for (i = 0; i < n; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h ^ (h >> 16);
+}
+
+static int
+__sockaddr_equal(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+    const struct sockaddr_in *a4 = (const struct sockaddr_in *)a, *b4 = (const struct sockaddr_in *)b;
+    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a, *b6 = (const struct sockaddr_in6 *)b;
+
+    if (a->ss_family != b->ss_family)
+        return 0;
+    if (a->ss_family == AF_INET6)
+        return a6->sin6_port == b6->sin6_port &&
+               memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+    return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+}
+
+/* Monotonic, so a step of the wall clock can't make every peer look idle. */
+static uint64_t
+__udp_sess_now(void)
+{
+    return __now_ns() / 1000000;
+}
+
+static void
+__udp_idle_unlink(struct bee_udp_sessions *us, bee_udp_session_t *sess)
+{
+    if (sess->prev != BEE_UDP_NONE)
+        us->sess[sess->prev].next = sess->next;
+    else
+        us->idle_head = sess->next;
+    if (sess->next != BEE_UDP_NONE)
+        us->sess[sess->next].prev = sess->prev;
+    else
+        us->idle_tail = sess->prev;
+}
+
+static void
+__udp_idle_append(struct bee_udp_sessions *us, bee_udp_session_t *sess)
+{
+    uint32_t index = (uint32_t)(sess - us->sess);
+
+    sess->prev = us->idle_tail;
+    sess->next = BEE_UDP_NONE;
+    if (us->idle_tail != BEE_UDP_NONE)
+        us->sess[us->idle_tail].next = index;
+    else
+        us->idle_head = index;
+    us->idle_tail = index;
+}
+
+/* The session of `peer', a new one if `create' and there is room. */
+static bee_udp_session_t *
+__udp_sess_find(bee_server_t *server, const struct sockaddr_storage *peer, socklen_t peerlen, int create)
+{
+    struct bee_udp_sessions *us = server->sessions;
+    struct bee_udp_bucket *b;
+    bee_udp_session_t *sess;
+    uint32_t hash = __sockaddr_hash(peer);
+    uint32_t i = hash & us->mask;
+    uint32_t index;
+
+    for (b = &us->buckets[i]; b->index != 0; b = &us->buckets[i]) {
+        if (b->hash == hash && __sockaddr_equal(&us->sess[b->index - 1].peer, peer))
+            return &us->sess[b->index - 1];
+        i = (i + 1) & us->mask;
+    }
+
+    if (!create || us->free_head == BEE_UDP_NONE)
+        return NULL;
+
+    index = us->free_head;
+    sess = &us->sess[index];
+    us->free_head = sess->next;
+
+    memset(sess, 0, sizeof(*sess));
+    sess->server = server;
+    memcpy(&sess->peer, peer, peerlen);
+    sess->peerlen = peerlen;
+    sess->hash = hash;
+    sess->last_ms = __udp_sess_now();
+
+    if (us->on_open != NULL && us->on_open(sess, us->arg) < 0) {
+        sess->next = us->free_head;
+        us->free_head = index;
+        return NULL;
+    }
+
+    b->hash = hash;
+    b->index = index + 1;
+    __udp_idle_append(us, sess);
+    ++us->count;
+    return sess;
+}
+
+/* Takes `sess' out of the table, shifting back the entries after it that
+ * would no longer be found past the hole.
+ */
+static void
+__udp_sess_remove(struct bee_udp_sessions *us, bee_udp_session_t *sess)
+{
+    uint32_t index = (uint32_t)(sess - us->sess) + 1;
+    uint32_t i = sess->hash & us->mask;
+    uint32_t j, home;
+
+    while (us->buckets[i].index != index)
+        i = (i + 1) & us->mask;
+
+    for (j = (i + 1) & us->mask; us->buckets[j].index != 0; j = (j + 1) & us->mask) {
+        home = us->buckets[j].hash & us->mask;
+        if (((j - home) & us->mask) >= ((j - i) & us->mask)) {
+            us->buckets[i] = us->buckets[j];
+            i = j;
+        }
+    }
+    us->buckets[i].index = 0;
+
+    __udp_idle_unlink(us, sess);
+    sess->server = NULL;
+    sess->next = us->free_head;
+    us->free_head = index - 1;
+    --us->count;
+}
+
+static void
+__udp_sess_expire_cb(evutil_socket_t fd, short events, void *arg)
+{
+    bee_server_t *server = arg;
+    struct bee_udp_sessions *us = server->sessions;
+    uint64_t now = __udp_sess_now();
+    bee_udp_session_t *sess;
+
+    while (us->idle_head != BEE_UDP_NONE) {
+        sess = &us->sess[us->idle_head];
+        if (now - sess->last_ms < us->idle_ms)
+            break;
+        bee_udp_session_close(sess);
+    }
+}
+
+/* Sends the replies of a batch with as few sendmmsg() calls as the socket
+ * allows; what it does not take goes through the server's output queue.
+ */
+static void
+__udp_sess_send(bee_server_t *server, evutil_socket_t sfd, int count)
+{
+    struct bee_udp_sessions *us = server->sessions;
+    struct msghdr *hdr;
+    int i = 0, n;
+
+    while (i < count && server->outq == NULL) {
+        n = sendmmsg(sfd, &us->tx[i], count - i, 0);
+        if (n > 0) {
+            i += n;
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            break;
+        perror("sendmmsg");
+        i++;    /* dropped, like any datagram */
+    }
+
+    for (; i < count; i++) {
+        hdr = &us->tx[i].msg_hdr;
+        if (bee_server_sendto(server, hdr->msg_iov->iov_base, hdr->msg_iov->iov_len,
+                              hdr->msg_name, hdr->msg_namelen) < 0)
+            perror("bee_server_sendto");
+    }
+}
+
+/* The segment size of a datagram coalesced by UDP_GRO, 0 if it is not. */
+static size_t
+__udp_gro_size(struct msghdr *hdr)
+{
+    struct cmsghdr *cmsg;
+    int size;
+
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            return size > 0 ? (size_t)size : 0;
+        }
+    }
+    return 0;
+}
+
+static void
+__udp_sess_read(bee_server_t *server, evutil_socket_t sfd)
+{
+    struct bee_udp_sessions *us = server->sessions;
+    enum BEE_HOOK_RESULT status;
+    bee_udp_session_t *sess;
+    struct msghdr *hdr;
+    size_t off, len, seg, reply_len;
+    uint64_t now;
+    int i, n, ntx, round;
+
+    for (round = 0; round < BEE_UDP_ROUNDS; round++) {
+        for (i = 0; i < BEE_UDP_BATCH; i++) {
+            us->rx[i].msg_hdr.msg_namelen = sizeof(us->src[i]);
+            us->rx[i].msg_hdr.msg_controllen = sizeof(us->ctrl[i]);
+        }
+
+        n = recvmmsg(sfd, us->rx, BEE_UDP_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("recvmmsg");
+            return;
+        }
+
+        now = __udp_sess_now();
+        for (i = 0, ntx = 0; i < n; i++) {
+            hdr = &us->rx[i].msg_hdr;
+            len = us->rx[i].msg_len;
+            seg = __udp_gro_size(hdr);
+            if (seg == 0)
+                seg = len;
+            sess = NULL;
+
+            /* one datagram per segment of a coalesced one */
+            for (off = 0; off < len || off == 0; off += seg) {
+                if (sess == NULL || sess->server == NULL) {
+                    sess = __udp_sess_find(server, &us->src[i], hdr->msg_namelen, 1);
+                    if (sess == NULL)
+                        break;
+                    sess->last_ms = now;
+                    __udp_idle_unlink(us, sess);
+                    __udp_idle_append(us, sess);
+                }
+
+                if (ntx == BEE_UDP_BATCH) {
+                    __udp_sess_send(server, sfd, ntx);
+                    ntx = 0;
+                }
+
+                reply_len = 0;
+                status = us->on_recv(sess, us->rx_buf + i * us->rx_size + off, len - off < seg ? len - off : seg,
+                                     us->tx_buf[ntx], &reply_len, us->arg);
+                if (reply_len > 0) {
+                    us->tx_iov[ntx].iov_len = reply_len < BEE_UDP_DGRAM_SIZE ? reply_len : BEE_UDP_DGRAM_SIZE;
+                    us->tx[ntx].msg_hdr.msg_name = &us->src[i];
+                    us->tx[ntx].msg_hdr.msg_namelen = hdr->msg_namelen;
+                    ntx++;
+                }
+
+                if (status == BEE_HOOK_CLOSED && sess->server != NULL)
+                    bee_udp_session_close(sess);
+                else if (status == BEE_HOOK_ERR) {
+                    __udp_sess_send(server, sfd, ntx);
+                    event_base_loopexit(server->evbase, NULL);
+                    return;
+                }
+                if (len == 0)
+                    break;
+            }
+        }
+
+        __udp_sess_send(server, sfd, ntx);
+        if (n < BEE_UDP_BATCH)
+            return;
+    }
+}
+
+/* Receive buffers fit a datagram coalesced by UDP_GRO once it is on. */
+static int
+__udp_sess_rx_setup(bee_server_t *server)
+{
+    struct bee_udp_sessions *us = server->sessions;
+    size_t size = (server->udp_flags & BEE_UDP_F_GRO) ? BEE_UDP_GRO_SIZE : BEE_UDP_DGRAM_SIZE;
+    char *buf;
+    int i;
+
+    if (us == NULL || us->rx_size == size)
+        return 0;
+
+    buf = malloc(BEE_UDP_BATCH * size);
+    if (!buf)
+        return -1;
+    free(us->rx_buf);
+    us->rx_buf = buf;
+    us->rx_size = size;
+
+    for (i = 0; i < BEE_UDP_BATCH; i++) {
+        us->rx_iov[i].iov_base = us->rx_buf + i * size;
+        us->rx_iov[i].iov_len = size;
+    }
+    return 0;
+}
+
+static void
+__udp_sess_free(bee_server_t *server)
+{
+    struct bee_udp_sessions *us = server->sessions;
+
+    if (us == NULL)
+        return;
+
+    while (us->idle_head != BEE_UDP_NONE)
+        bee_udp_session_close(&us->sess[us->idle_head]);
+    if (us->expire_ev != NULL)
+        event_free(us->expire_ev);
+    free(us->buckets);
+    free(us->sess);
+    free(us->rx_buf);
+    free(us);
+    server->sessions = NULL;
+}
+
+/* Turns a udp server into session mode: datagrams are received and replies
+ * sent in batches of BEE_UDP_BATCH, and each goes to `on_recv' with the
+ * session of its peer instead of on_recv of the server. Up to
+ * `max_sessions' peers are tracked, new ones are dropped while the table is
+ * full; a peer not heard from for `idle_ms' is closed.
+ */
+int
+bee_udp_set_sessions(bee_server_t *server, uint32_t max_sessions, int idle_ms, bee_udp_recv_cb on_recv,
+                     bee_udp_sess_cb on_open, bee_udp_sess_cb on_close, void *arg)
+{
+    struct bee_udp_sessions *us;
+    struct timeval tv;
+    uint32_t i, nbuckets;
+
+    if (server->type != BEE_SERVER_UDP || server->sessions != NULL || on_recv == NULL ||
+        max_sessions == 0 || max_sessions > (UINT32_MAX >> 2) || idle_ms <= 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    us = calloc(1, sizeof(*us));
+    if (!us)
+        return -1;
+
+    /* at most half full, so probes stay short */
+    for (nbuckets = 4; nbuckets < 2 * max_sessions; nbuckets *= 2)
+        ;
+    us->buckets = calloc(nbuckets, sizeof(*us->buckets));
+    us->sess = calloc(max_sessions, sizeof(*us->sess));
+    us->expire_ev = event_new(server->evbase, -1, EV_PERSIST, __udp_sess_expire_cb, server);
+    if (!us->buckets || !us->sess || !us->expire_ev) {
+        if (us->expire_ev != NULL)
+            event_free(us->expire_ev);
+        free(us->buckets);
+        free(us->sess);
+        free(us);
+        return -1;
+    }
+    __server_event_priority(server, us->expire_ev);
+
+    us->on_recv = on_recv;
+    us->on_open = on_open;
+    us->on_close = on_close;
+    us->arg = arg;
+    us->idle_ms = (uint64_t)idle_ms;
+    us->max = max_sessions;
+    us->mask = nbuckets - 1;
+    us->idle_head = BEE_UDP_NONE;
+    us->idle_tail = BEE_UDP_NONE;
+    for (i = 0; i < max_sessions; i++)
+        us->sess[i].next = i + 1 < max_sessions ? i + 1 : BEE_UDP_NONE;
+    us->free_head = 0;
+
+    for (i = 0; i < BEE_UDP_BATCH; i++) {
+        us->rx[i].msg_hdr.msg_name = &us->src[i];
+        us->rx[i].msg_hdr.msg_iov = &us->rx_iov[i];
+        us->rx[i].msg_hdr.msg_iovlen = 1;
+        us->rx[i].msg_hdr.msg_control = us->ctrl[i];
+        us->tx_iov[i].iov_base = us->tx_buf[i];
+        us->tx[i].msg_hdr.msg_iov = &us->tx_iov[i];
+        us->tx[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    server->sessions = us;
+    if (__udp_sess_rx_setup(server) < 0) {
+        __udp_sess_free(server);
+        return -1;
+    }
+
+    /* idle peers are looked for four times per `idle_ms' */
+    tv.tv_sec = idle_ms / 4000;
+    tv.tv_usec = (idle_ms % 4000) * 250;
+    if (tv.tv_sec == 0 && tv.tv_usec < 1000)
+        tv.tv_usec = 1000;
+    event_add(us->expire_ev, &tv);
+    return 0;
+}
+
+/* Ends `sess' with on_close, e.g. when the protocol says goodbye; its next
+ * datagram opens a new one.
+ */
+void
+bee_udp_session_close(bee_udp_session_t *sess)
+{
+    bee_server_t *server = sess->server;
+    struct bee_udp_sessions *us;
+
+    if (server == NULL)
+        return;
+
+    us = server->sessions;
+    if (us->on_close != NULL)
+        us->on_close(sess, us->arg);
+    __udp_sess_remove(us, sess);
+}
+
+uint32_t
+bee_udp_session_count(bee_server_t *server)
+{
+    return server->sessions != NULL ? server->sessions->count : 0;
+}
+
+/* Lets the kernel coalesce the datagrams of a flow (UDP_GRO). In session
+ * mode they are split again before on_recv; an on_recv of its own finds
+ * the segment size in a UDP_GRO control message. -1 with ENOPROTOOPT if
+ * the kernel cannot, nothing changes then.
+ */
+int
+bee_udp_set_gro(bee_server_t *server, int on)
+{
+    unsigned int flags = server->udp_flags;
+
+    if (server->type != BEE_SERVER_UDP) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (__setsockopt_int(event_get_fd(server->listen_ev), SOL_UDP, UDP_GRO, on ? 1 : 0) < 0)
+        return -1;
+
+    if (on)
+        server->udp_flags |= BEE_UDP_F_GRO;
+    else
+        server->udp_flags &= ~BEE_UDP_F_GRO;
+
+    if (__udp_sess_rx_setup(server) < 0) {
+        server->udp_flags = flags;
+        __setsockopt_int(event_get_fd(server->listen_ev), SOL_UDP, UDP_GRO, (flags & BEE_UDP_F_GRO) ? 1 : 0);
+        return -1;
+    }
+    return 0;
+}
+
+static ssize_t
+__sendto_gso(evutil_socket_t sfd, const void *data, size_t len, size_t segsize,
+             const struct sockaddr *addr, socklen_t addrlen)
+{
+    char ctrl[CMSG_SPACE(sizeof(uint16_t))];
+    struct iovec iov = { (void *)data, len };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    uint16_t size = (uint16_t)segsize;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(ctrl, 0, sizeof(ctrl));
+    msg.msg_name = (void *)addr;
+    msg.msg_namelen = addrlen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(size));
+    memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+
+    return sendmsg(sfd, &msg, 0);
+}
+
+/* Sends `data' as datagrams of `segsize' bytes (the last may be shorter),
+ * up to BEE_UDP_GSO_SEGS of them per call, segmented by the kernel or the
+ * NIC (UDP_SEGMENT). Where that is not supported it falls back for good to
+ * one bee_server_sendto() per datagram, which also queues what the socket
+ * has no room for.
+ */
+int
+bee_server_sendto_gso(bee_server_t *server, const void *data, size_t len, size_t segsize,
+                      const struct sockaddr *addr, socklen_t addrlen)
+{
+    evutil_socket_t sfd = event_get_fd(server->listen_ev);
+    const char *p = data;
+    size_t segs, chunk, off, n, s;
+
+    if (segsize == 0 || segsize > BEE_UDP_GSO_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    segs = BEE_UDP_GSO_MAX / segsize;
+    if (segs > BEE_UDP_GSO_SEGS)
+        segs = BEE_UDP_GSO_SEGS;
+    chunk = segs * segsize;
+
+    for (off = 0; off < len; off += n) {
+        n = len - off < chunk ? len - off : chunk;
+
+        if (n > segsize && server->outq == NULL && !(server->udp_flags & BEE_UDP_F_NO_GSO)) {
+            if (__sendto_gso(sfd, p + off, n, segsize, addr, addrlen) >= 0)
+                continue;
+            if (errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP || errno == EINVAL)
+                server->udp_flags |= BEE_UDP_F_NO_GSO;
+            else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                return -1;
+        }
+
+        for (s = off; s < off + n; s += segsize) {
+            if (bee_server_sendto(server, p + s, off + n - s < segsize ? off + n - s : segsize, addr, addrlen) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Event loop policy                                                         */
+/*---------------------------------------------------------------------------*/
+/* An event_base with BEE_PRIORITIES priority classes that checks for new
+ * events after `max_callbacks' callbacks or `max_interval_ms' of them, so
+ * that a burst of ready connections cannot hold back the listeners. Either
+ * may be 0 for no limit; the limits apply below BEE_PRIO_HIGH only.
+ */
+struct event_base *
+bee_event_base_new(int max_callbacks, int max_interval_ms)
+{
+    struct event_config *cfg;
+    struct event_base *evbase;
+    struct timeval tv;
+
+    cfg = event_config_new();
+    if (!cfg)
+        return NULL;
+
+    tv.tv_sec = max_interval_ms / 1000;
+    tv.tv_usec = (max_interval_ms % 1000) * 1000;
+    if (event_config_set_max_dispatch_interval(cfg, max_interval_ms > 0 ? &tv : NULL,
+                                               max_callbacks > 0 ? max_callbacks : -1,
+                                               BEE_PRIO_NORMAL) < 0)
+    {
+        event_config_free(cfg);
+        return NULL;
+    }
+
+    evbase = event_base_new_with_config(cfg);
+    event_config_free(cfg);
+    if (!evbase)
+        return NULL;
+
+    if (event_base_priority_init(evbase, BEE_PRIORITIES) < 0) {
+        event_base_free(evbase);
+        return NULL;
+    }
+
+    return evbase;
+}
+
+/* Probes the loop lag of `evbase' every `probe_ms'. The probe runs in the
+ * BEE_PRIO_NORMAL class, so it waits as long as a connection would; the
+ * lag includes the slack of libevent timers, up to a millisecond.
+ */
+bee_monitor_t *
+bee_monitor_new(struct event_base *evbase, int probe_ms)
+{
+    bee_monitor_t *mon;
+
+    if (probe_ms <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mon = calloc(1, sizeof(*mon));
+    if (!mon)
+        return NULL;
+
+    mon->evbase = evbase;
+    mon->probe_ev = evtimer_new(evbase, __monitor_probe_cb, mon);
+    mon->mark_ev = evtimer_new(evbase, __monitor_mark_cb, mon);
+    if (!mon->probe_ev || !mon->mark_ev) {
+        if (mon->probe_ev)
+            event_free(mon->probe_ev);
+        if (mon->mark_ev)
+            event_free(mon->mark_ev);
+        free(mon);
+        return NULL;
+    }
+    __event_set_priority(mon->probe_ev, BEE_PRIO_NORMAL);
+
+    mon->probe_tv.tv_sec = probe_ms / 1000;
+    mon->probe_tv.tv_usec = (probe_ms % 1000) * 1000;
+    mon->probe_due = __now_ns() + (uint64_t)probe_ms * 1000000ull;
+    event_add(mon->probe_ev, &mon->probe_tv);
+    return mon;
+}
+
+/* The servers attached to `mon' must be detached or freed first. */
+void
+bee_monitor_free(bee_monitor_t *mon)
+{
+    if (!mon)
+        return;
+
+    event_free(mon->probe_ev);
+    event_free(mon->mark_ev);
+    free(mon);
+}
+
+void
+bee_monitor_get_stats(const bee_monitor_t *mon, bee_loop_stats_t *stats)
+{
+    *stats = mon->stats;
+
+    /* the pass in progress counts too */
+    if (mon->pass_hooks > 0) {
+        ++stats->passes;
+        if (mon->pass_hooks > stats->hooks_max)
+            stats->hooks_max = mon->pass_hooks;
+    }
+}
+
+void
+bee_monitor_reset(bee_monitor_t *mon)
+{
+    memset(&mon->stats, 0, sizeof(mon->stats));
+}
+
+/* Times the hooks of `server' on `mon', which several servers may share;
+ * NULL detaches it.
+ */
+void
+bee_server_set_monitor(bee_server_t *server, bee_monitor_t *mon)
+{
+    server->monitor = mon;
+}
+/*---------------------------------------------------------------------------*/
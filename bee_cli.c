@@ -38,6 +38,9 @@
 
 static char telnet_prompt[128] = "bee> ";
 
+/* The connection whose hook is running, for the functions given an sfd */
+static __thread bee_connection_t *cli_current = NULL;
+
 typedef struct {
     char    buf[BUF_SIZE];
     int     bufptr;
@@ -137,24 +140,32 @@ get_char(telnet_state_t *s, uint8_t c)
         ++s->bufptr;
 }
 
+/* Output goes through the connection's queue when bee called us for it. */
 static void
-sendopt(int sfd, uint8_t option, uint8_t value)
+cli_write(int sfd, const char *buf, size_t len)
 {
     ssize_t nr;
-    char *linebuf;
- 
-    linebuf = calloc(sizeof(char), BUF_SIZE);
-    assert(linebuf != NULL);
- 
-    linebuf[0] = TELNET_IAC;
-    linebuf[1] = option;
-    linebuf[2] = value;
-    linebuf[3] = 0;
-    nr = send(sfd, linebuf, BUF_SIZE, 0);
+
+    if (cli_current != NULL && cli_current->sfd == sfd) {
+        if (bee_conn_write(cli_current, buf, len) < 0)
+            perror("bee_conn_write");
+        return;
+    }
+
+    nr = send(sfd, buf, len, MSG_NOSIGNAL);
     if (nr < 0)
         perror("send");
+}
 
-    free(linebuf);
+static void
+sendopt(int sfd, uint8_t option, uint8_t value)
+{
+    char opt[3];
+
+    opt[0] = TELNET_IAC;
+    opt[1] = option;
+    opt[2] = value;
+    cli_write(sfd, opt, sizeof(opt));
 }
 
 
@@ -162,7 +173,8 @@ sendopt(int sfd, uint8_t option, uint8_t value)
 /*---------------------------------------------------------------------------*/
 /* Bee server callbacks                                                      */
 /*---------------------------------------------------------------------------*/
-enum BEE_HOOK_RESULT telnet_recv(int sfd, void *arg)
+static enum BEE_HOOK_RESULT
+__telnet_recv(int sfd, void *arg)
 {
     bee_connection_t *conn = arg;
     bcli_server_t *cli = conn->server->pdata;
@@ -281,12 +293,27 @@ enum BEE_HOOK_RESULT telnet_recv(int sfd, void *arg)
     return BEE_HOOK_OK;
 }
 
+enum BEE_HOOK_RESULT telnet_recv(int sfd, void *arg)
+{
+    enum BEE_HOOK_RESULT status;
+
+    /* a command's lines and the next prompt go out together */
+    cli_current = arg;
+    bee_conn_cork(cli_current);
+    status = __telnet_recv(sfd, arg);
+    bee_conn_uncork(cli_current);
+    cli_current = NULL;
+    return status;
+}
+
 enum BEE_HOOK_RESULT telnet_accept(int sfd, void *arg)
 {
     bee_connection_t *conn = arg;
     telnet_state_t *s = telnet_state_new();
     conn->pdata = s;
+    cli_current = conn;
     bcli_prompt(sfd);
+    cli_current = NULL;
     return BEE_HOOK_OK;
 }
 
@@ -370,7 +397,6 @@ bcli_get_prompt(void)
 void
 bcli_println(int sfd, const char *fmt, ...)
 {
-    ssize_t nr;
     char *linebuf;
     int len;
     va_list arg;
@@ -387,10 +413,9 @@ bcli_println(int sfd, const char *fmt, ...)
         linebuf[len] = ISO_cr;
         linebuf[len+1] = ISO_nl;
         linebuf[len+2] = 0;
+        len += 2;
     }
-    nr = send(sfd, linebuf, BUF_SIZE, 0);
-    if (nr < 0)
-        perror("send");
+    cli_write(sfd, linebuf, len);
  
     free(linebuf);
 }
@@ -398,15 +423,12 @@ bcli_println(int sfd, const char *fmt, ...)
 void
 bcli_prompt(int sfd)
 {
-    ssize_t nr;
     char *linebuf;
  
     linebuf = calloc(sizeof(char), BUF_SIZE);
     assert(linebuf != NULL);
-    strncpy(linebuf, telnet_prompt, BUF_SIZE);
-    nr = send(sfd, linebuf, BUF_SIZE, 0);
-    if (nr < 0)
-        perror("write");
+    strncpy(linebuf, telnet_prompt, BUF_SIZE - 1);
+    cli_write(sfd, linebuf, strlen(linebuf));
  
     free(linebuf);
 }
@@ -0,0 +1,722 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "bee_hpack.h"
+
+
+/* HPACK (RFC 7541) header compression for the HTTP/2 support of
+ * bee_http.c. Decoding handles every representation and Huffman coded
+ * strings; encoding sends strings as they are and relies on the static
+ * and dynamic tables for the savings.
+ */
+
+#define STATIC_TABLE_SIZE       61
+#define ENTRY_OVERHEAD          32          /* per entry, counted in the table size */
+#define MAX_INT                 (1 << 28)   /* larger prefixed integers are malformed */
+#define STATIC_HASH_SIZE        128
+
+struct hpack_entry {
+    size_t                  name_len;
+    size_t                  value_len;
+    char                    data[];         /* name, then value */
+};
+
+struct bee_hpack {
+    struct hpack_entry   ** ring;           /* newest entry at `head' */
+    unsigned int            cap;
+    unsigned int            head;
+    unsigned int            count;
+    size_t                  size;           /* sum of the entry sizes */
+    size_t                  max_size;
+    size_t                  limit;          /* max_size may never exceed this */
+    int                     update;         /* encoder: size change not announced yet */
+    size_t                  update_min;
+    char                  * scratch[2];     /* Huffman decoded name and value */
+    size_t                  scratch_cap[2];
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Tables                                                                    */
+/*---------------------------------------------------------------------------*/
+static const struct hpack_static {
+    const char        * name;
+    const char        * value;
+    uint8_t             name_len;
+    uint8_t             value_len;
+} static_table[STATIC_TABLE_SIZE + 1] = {
+    { NULL, NULL, 0, 0 },
+    /*  1 */ { ":authority",                  "",                10,  0 },
+    /*  2 */ { ":method",                     "GET",              7,  3 },
+    /*  3 */ { ":method",                     "POST",             7,  4 },
+    /*  4 */ { ":path",                       "/",                5,  1 },
+    /*  5 */ { ":path",                       "/index.html",      5, 11 },
+    /*  6 */ { ":scheme",                     "http",             7,  4 },
+    /*  7 */ { ":scheme",                     "https",            7,  5 },
+    /*  8 */ { ":status",                     "200",              7,  3 },
+    /*  9 */ { ":status",                     "204",              7,  3 },
+    /* 10 */ { ":status",                     "206",              7,  3 },
+    /* 11 */ { ":status",                     "304",              7,  3 },
+    /* 12 */ { ":status",                     "400",              7,  3 },
+    /* 13 */ { ":status",                     "404",              7,  3 },
+    /* 14 */ { ":status",                     "500",              7,  3 },
+    /* 15 */ { "accept-charset",              "",                14,  0 },
+    /* 16 */ { "accept-encoding",             "gzip, deflate",   15, 13 },
+    /* 17 */ { "accept-language",             "",                15,  0 },
+    /* 18 */ { "accept-ranges",               "",                13,  0 },
+    /* 19 */ { "accept",                      "",                 6,  0 },
+    /* 20 */ { "access-control-allow-origin", "",                27,  0 },
+    /* 21 */ { "age",                         "",                 3,  0 },
+    /* 22 */ { "allow",                       "",                 5,  0 },
+    /* 23 */ { "authorization",               "",                13,  0 },
+    /* 24 */ { "cache-control",               "",                13,  0 },
+    /* 25 */ { "content-disposition",         "",                19,  0 },
+    /* 26 */ { "content-encoding",            "",                16,  0 },
+    /* 27 */ { "content-language",            "",                16,  0 },
+    /* 28 */ { "content-length",              "",                14,  0 },
+    /* 29 */ { "content-location",            "",                16,  0 },
+    /* 30 */ { "content-range",               "",                13,  0 },
+    /* 31 */ { "content-type",                "",                12,  0 },
+    /* 32 */ { "cookie",                      "",                 6,  0 },
+    /* 33 */ { "date",                        "",                 4,  0 },
+    /* 34 */ { "etag",                        "",                 4,  0 },
+    /* 35 */ { "expect",                      "",                 6,  0 },
+    /* 36 */ { "expires",                     "",                 7,  0 },
+    /* 37 */ { "from",                        "",                 4,  0 },
+    /* 38 */ { "host",                        "",                 4,  0 },
+    /* 39 */ { "if-match",                    "",                 8,  0 },
+    /* 40 */ { "if-modified-since",           "",                17,  0 },
+    /* 41 */ { "if-none-match",               "",                13,  0 },
+    /* 42 */ { "if-range",                    "",                 8,  0 },
+    /* 43 */ { "if-unmodified-since",         "",                19,  0 },
+    /* 44 */ { "last-modified",               "",                13,  0 },
+    /* 45 */ { "link",                        "",                 4,  0 },
+    /* 46 */ { "location",                    "",                 8,  0 },
+    /* 47 */ { "max-forwards",                "",                12,  0 },
+    /* 48 */ { "proxy-authenticate",          "",                18,  0 },
+    /* 49 */ { "proxy-authorization",         "",                19,  0 },
+    /* 50 */ { "range",                       "",                 5,  0 },
+    /* 51 */ { "referer",                     "",                 7,  0 },
+    /* 52 */ { "refresh",                     "",                 7,  0 },
+    /* 53 */ { "retry-after",                 "",                11,  0 },
+    /* 54 */ { "server",                      "",                 6,  0 },
+    /* 55 */ { "set-cookie",                  "",                10,  0 },
+    /* 56 */ { "strict-transport-security",   "",                25,  0 },
+    /* 57 */ { "transfer-encoding",           "",                17,  0 },
+    /* 58 */ { "user-agent",                  "",                10,  0 },
+    /* 59 */ { "vary",                        "",                 4,  0 },
+    /* 60 */ { "via",                         "",                 3,  0 },
+    /* 61 */ { "www-authenticate",            "",                16,  0 },
+};
+
+static const uint32_t huffman_codes[257] = {
+    0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5,
+    0x0fffffe6, 0x0fffffe7, 0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9,
+    0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec, 0x0fffffed, 0x0fffffee,
+    0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+    0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9,
+    0x0ffffffa, 0x0ffffffb, 0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa,
+    0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa, 0x000003fa, 0x000003fb,
+    0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+    0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b,
+    0x0000001c, 0x0000001d, 0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb,
+    0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc, 0x00001ffa, 0x00000021,
+    0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+    0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068,
+    0x00000069, 0x0000006a, 0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e,
+    0x0000006f, 0x00000070, 0x00000071, 0x00000072, 0x000000fc, 0x00000073,
+    0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+    0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005,
+    0x00000025, 0x00000026, 0x00000027, 0x00000006, 0x00000074, 0x00000075,
+    0x00000028, 0x00000029, 0x0000002a, 0x00000007, 0x0000002b, 0x00000076,
+    0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+    0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd,
+    0x00001ffd, 0x0ffffffc, 0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8,
+    0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9, 0x003fffd6, 0x007fffda,
+    0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+    0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1,
+    0x007fffe2, 0x007fffe3, 0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5,
+    0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef, 0x003fffda, 0x001fffdd,
+    0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+    0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf,
+    0x007fffeb, 0x007fffec, 0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2,
+    0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef, 0x000fffea, 0x003fffe2,
+    0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+    0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2,
+    0x003fffe8, 0x01ffffec, 0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde,
+    0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed, 0x0007fff2, 0x001fffe3,
+    0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+    0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3,
+    0x07ffffe4, 0x07ffffe5, 0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6,
+    0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3, 0x003fffea, 0x003fffeb,
+    0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+    0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8,
+    0x07ffffe9, 0x07ffffea, 0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed,
+    0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee, 0x3fffffff,
+};
+
+static const uint8_t huffman_bits[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+     6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+     5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+    13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+     7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+    15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+     6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+
+/* Huffman decoding walks the code tree four bits at a time: a state is an
+ * internal node, and no code is shorter than five bits, so one nibble
+ * emits at most one symbol.
+ */
+#define HUFFMAN_EMIT            0x01
+#define HUFFMAN_FAIL            0x02
+
+static struct {
+    uint8_t                 state;
+    uint8_t                 flags;
+    uint8_t                 sym;
+} huffman_decode[256][16];
+
+/* states that may end a string: reached by fewer than eight 1 bits */
+static uint8_t huffman_accept[256];
+
+/* first static entry of every name, open addressing on __name_hash() */
+static uint8_t static_by_name[STATIC_HASH_SIZE];
+
+
+static unsigned int
+__name_hash(const char *name, size_t len)
+{
+    unsigned int h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    return h;
+}
+
+__attribute__((constructor))
+static void
+bee_hpack_init(void)
+{
+    static int16_t tree[256][2];    /* > 0 internal node, < 0 -(symbol + 1) */
+    int nodes = 1, sym, bit, node, n, x, b, c;
+    unsigned int h;
+
+    for (sym = 0; sym < 257; sym++) {
+        node = 0;
+        for (bit = huffman_bits[sym] - 1; bit > 0; bit--) {
+            b = (huffman_codes[sym] >> bit) & 1;
+            if (tree[node][b] == 0)
+                tree[node][b] = nodes++;
+            node = tree[node][b];
+        }
+        tree[node][huffman_codes[sym] & 1] = -(sym + 1);
+    }
+
+    /* the all-ones path of up to seven bits is valid padding */
+    for (node = 0, n = 0; n < 8 && node >= 0; n++) {
+        huffman_accept[node] = 1;
+        node = tree[node][1];
+    }
+
+    for (node = 0; node < 256; node++) {
+        for (x = 0; x < 16; x++) {
+            n = node;
+            huffman_decode[node][x].flags = 0;
+            for (b = 3; b >= 0; b--) {
+                c = tree[n][(x >> b) & 1];
+                if (c < 0) {
+                    if (c == -257) {
+                        huffman_decode[node][x].flags = HUFFMAN_FAIL;
+                        break;
+                    }
+                    huffman_decode[node][x].flags = HUFFMAN_EMIT;
+                    huffman_decode[node][x].sym = -c - 1;
+                    n = 0;
+                }
+                else
+                    n = c;
+            }
+            huffman_decode[node][x].state = n;
+        }
+    }
+
+    for (n = STATIC_TABLE_SIZE; n >= 1; n--) {
+        /* walking backwards leaves the first entry of each name */
+        h = __name_hash(static_table[n].name, static_table[n].name_len) & (STATIC_HASH_SIZE - 1);
+        while (static_by_name[h] != 0 &&
+               strcmp(static_table[static_by_name[h]].name, static_table[n].name) != 0)
+            h = (h + 1) & (STATIC_HASH_SIZE - 1);
+        static_by_name[h] = n;
+    }
+}
+
+/* Index of the first static entry named `name', or 0. */
+static int
+__static_find(const char *name, size_t len)
+{
+    unsigned int h = __name_hash(name, len) & (STATIC_HASH_SIZE - 1);
+    int i;
+
+    while ((i = static_by_name[h]) != 0) {
+        if (static_table[i].name_len == len && memcmp(static_table[i].name, name, len) == 0)
+            return i;
+        h = (h + 1) & (STATIC_HASH_SIZE - 1);
+    }
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Dynamic table                                                             */
+/*---------------------------------------------------------------------------*/
+static size_t
+__entry_size(const struct hpack_entry *entry)
+{
+    return entry->name_len + entry->value_len + ENTRY_OVERHEAD;
+}
+
+/* Dynamic entry `i', 1 being the newest. */
+static struct hpack_entry *
+__table_get(bee_hpack_t *hpack, unsigned int i)
+{
+    return hpack->ring[(hpack->head + hpack->cap - (i - 1)) % hpack->cap];
+}
+
+static void
+__table_evict(bee_hpack_t *hpack, size_t room)
+{
+    struct hpack_entry *oldest;
+
+    while (hpack->count > 0 && hpack->size + room > hpack->max_size) {
+        oldest = __table_get(hpack, hpack->count);
+        hpack->size -= __entry_size(oldest);
+        --hpack->count;
+        free(oldest);
+    }
+}
+
+/* Adds a field, which may itself come from the table: it is copied
+ * before anything is evicted.
+ */
+static int
+__table_add(bee_hpack_t *hpack, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    struct hpack_entry *entry;
+    size_t size = name_len + value_len + ENTRY_OVERHEAD;
+
+    if (size > hpack->max_size) {
+        /* not an error: the table just ends up empty */
+        __table_evict(hpack, hpack->max_size + 1);
+        return 0;
+    }
+
+    entry = malloc(sizeof(*entry) + name_len + value_len);
+    if (!entry)
+        return -1;
+    entry->name_len = name_len;
+    entry->value_len = value_len;
+    memcpy(entry->data, name, name_len);
+    memcpy(entry->data + name_len, value, value_len);
+
+    __table_evict(hpack, size);
+    hpack->head = (hpack->head + 1) % hpack->cap;
+    hpack->ring[hpack->head] = entry;
+    ++hpack->count;
+    hpack->size += size;
+    return 0;
+}
+
+static void
+__table_resize(bee_hpack_t *hpack, size_t max_size)
+{
+    hpack->max_size = max_size;
+    __table_evict(hpack, 0);
+}
+
+/* Resolves a table index, static or dynamic, to its name and value. */
+static int
+__table_lookup(bee_hpack_t *hpack, uint32_t i, const char **name, size_t *name_len,
+               const char **value, size_t *value_len)
+{
+    struct hpack_entry *entry;
+
+    if (i == 0)
+        return -1;
+
+    if (i <= STATIC_TABLE_SIZE) {
+        *name = static_table[i].name;
+        *name_len = static_table[i].name_len;
+        *value = static_table[i].value;
+        *value_len = static_table[i].value_len;
+        return 0;
+    }
+
+    i -= STATIC_TABLE_SIZE;
+    if (i > hpack->count)
+        return -1;
+
+    entry = __table_get(hpack, i);
+    *name = entry->data;
+    *name_len = entry->name_len;
+    *value = entry->data + entry->name_len;
+    *value_len = entry->value_len;
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Decoding                                                                  */
+/*---------------------------------------------------------------------------*/
+static int
+__decode_int(const uint8_t **pp, const uint8_t *end, int prefix, uint32_t *out)
+{
+    const uint8_t *p = *pp;
+    uint32_t mask = (1 << prefix) - 1, value, shift = 0;
+
+    if (p >= end)
+        return -1;
+
+    value = *p++ & mask;
+    if (value == mask) {
+        do {
+            if (p >= end || shift > 21)
+                return -1;
+            value += (uint32_t)(*p & 0x7f) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+
+        if (value > MAX_INT)
+            return -1;
+    }
+
+    *pp = p;
+    *out = value;
+    return 0;
+}
+
+static int
+__huffman_decode(bee_hpack_t *hpack, int which, const uint8_t *in, size_t len,
+                 const char **out, size_t *out_len)
+{
+    size_t need = len * 8 / 5 + 1, i, n = 0;
+    uint8_t state = 0, nibble;
+    char *dst;
+    int half;
+
+    if (hpack->scratch_cap[which] < need) {
+        dst = realloc(hpack->scratch[which], need);
+        if (!dst)
+            return -1;
+        hpack->scratch[which] = dst;
+        hpack->scratch_cap[which] = need;
+    }
+    dst = hpack->scratch[which];
+
+    for (i = 0; i < len; i++) {
+        for (half = 0; half < 2; half++) {
+            nibble = half ? in[i] & 0x0f : in[i] >> 4;
+            if (huffman_decode[state][nibble].flags & HUFFMAN_FAIL)
+                return -1;
+            if (huffman_decode[state][nibble].flags & HUFFMAN_EMIT)
+                dst[n++] = huffman_decode[state][nibble].sym;
+            state = huffman_decode[state][nibble].state;
+        }
+    }
+
+    if (!huffman_accept[state])
+        return -1;
+
+    *out = dst;
+    *out_len = n;
+    return 0;
+}
+
+static int
+__decode_str(bee_hpack_t *hpack, int which, const uint8_t **pp, const uint8_t *end,
+             const char **out, size_t *out_len)
+{
+    const uint8_t *p = *pp;
+    int huffman;
+    uint32_t len;
+
+    if (p >= end)
+        return -1;
+    huffman = *p & 0x80;
+    if (__decode_int(&p, end, 7, &len) < 0 || len > (size_t)(end - p))
+        return -1;
+
+    if (huffman) {
+        if (__huffman_decode(hpack, which, p, len, out, out_len) < 0)
+            return -1;
+    }
+    else {
+        *out = (const char *)p;
+        *out_len = len;
+    }
+
+    *pp = p + len;
+    return 0;
+}
+
+int
+bee_hpack_decode(bee_hpack_t *hpack, const uint8_t *in, size_t len, bee_hpack_field_cb cb, void *arg)
+{
+    const uint8_t *p = in, *end = in + len;
+    const char *name, *value;
+    size_t name_len, value_len;
+    uint32_t i;
+    int prefix, fields = 0;
+
+    while (p < end) {
+        if (*p & 0x80) {
+            /* indexed field; static entries are handed out without a copy */
+            if (__decode_int(&p, end, 7, &i) < 0 ||
+                __table_lookup(hpack, i, &name, &name_len, &value, &value_len) < 0)
+                return -1;
+        }
+        else if ((*p & 0xe0) == 0x20) {
+            /* table size update, only ahead of the first field */
+            if (fields > 0 || __decode_int(&p, end, 5, &i) < 0 || i > hpack->limit)
+                return -1;
+            __table_resize(hpack, i);
+            continue;
+        }
+        else {
+            /* literal, with incremental indexing (01) or without (0000, 0001) */
+            prefix = (*p & 0x40) ? 6 : 4;
+            if ((*p & 0x40) == 0 && (*p & 0xe0) != 0)
+                return -1;
+
+            if (__decode_int(&p, end, prefix, &i) < 0)
+                return -1;
+            if (i == 0) {
+                if (__decode_str(hpack, 0, &p, end, &name, &name_len) < 0)
+                    return -1;
+            }
+            else if (__table_lookup(hpack, i, &name, &name_len, &value, &value_len) < 0)
+                return -1;
+
+            if (__decode_str(hpack, 1, &p, end, &value, &value_len) < 0)
+                return -1;
+
+            /* handed over first: adding may evict the entry `name' points into */
+            ++fields;
+            if (cb(arg, name, name_len, value, value_len) != 0)
+                return -1;
+            if (prefix == 6 && __table_add(hpack, name, name_len, value, value_len) < 0)
+                return -1;
+            continue;
+        }
+
+        ++fields;
+        if (cb(arg, name, name_len, value, value_len) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Encoding                                                                  */
+/*---------------------------------------------------------------------------*/
+static int
+__encode_int(uint8_t *out, size_t cap, int prefix, uint8_t flags, uint32_t value)
+{
+    uint32_t mask = (1 << prefix) - 1;
+    size_t n = 0;
+
+    if (cap < 1)
+        return -1;
+
+    if (value < mask) {
+        out[n++] = flags | value;
+        return n;
+    }
+
+    out[n++] = flags | mask;
+    value -= mask;
+    while (value >= 0x80) {
+        if (n >= cap)
+            return -1;
+        out[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    if (n >= cap)
+        return -1;
+    out[n++] = value;
+    return n;
+}
+
+static int
+__encode_str(uint8_t *out, size_t cap, const char *s, size_t len)
+{
+    int n = __encode_int(out, cap, 7, 0, len);
+
+    if (n < 0 || cap - n < len)
+        return -1;
+    memcpy(out + n, s, len);
+    return n + len;
+}
+
+size_t
+bee_hpack_encode_bound(size_t name_len, size_t value_len)
+{
+    return name_len + value_len + 16;
+}
+
+int
+bee_hpack_encode_begin(bee_hpack_t *hpack, uint8_t *out, size_t cap)
+{
+    int n = 0, r;
+
+    if (!hpack->update)
+        return 0;
+
+    /* a shrink and regrow in between blocks must show the low point */
+    if (hpack->update_min < hpack->max_size) {
+        r = __encode_int(out, cap, 5, 0x20, hpack->update_min);
+        if (r < 0)
+            return -1;
+        n += r;
+    }
+    r = __encode_int(out + n, cap - n, 5, 0x20, hpack->max_size);
+    if (r < 0)
+        return -1;
+
+    hpack->update = 0;
+    return n + r;
+}
+
+/* `name' must be lower case, as HTTP/2 requires. */
+int
+bee_hpack_encode(bee_hpack_t *hpack, uint8_t *out, size_t cap, const char *name, size_t name_len,
+                 const char *value, size_t value_len, int mode)
+{
+    struct hpack_entry *entry;
+    uint32_t name_index = 0, i;
+    int n, r;
+
+    /* static table first: :status 200 or content-type text/html cost a byte */
+    i = __static_find(name, name_len);
+    if (i != 0) {
+        name_index = i;
+        for (; i <= STATIC_TABLE_SIZE && static_table[i].name_len == name_len &&
+               memcmp(static_table[i].name, name, name_len) == 0; i++) {
+            if (static_table[i].value_len == value_len &&
+                memcmp(static_table[i].value, value, value_len) == 0)
+                return __encode_int(out, cap, 7, 0x80, i);
+        }
+    }
+
+    if (mode == BEE_HPACK_INDEX) {
+        for (i = 1; i <= hpack->count; i++) {
+            entry = __table_get(hpack, i);
+            if (entry->name_len != name_len || memcmp(entry->data, name, name_len) != 0)
+                continue;
+            if (entry->value_len == value_len && memcmp(entry->data + name_len, value, value_len) == 0)
+                return __encode_int(out, cap, 7, 0x80, STATIC_TABLE_SIZE + i);
+            if (name_index == 0)
+                name_index = STATIC_TABLE_SIZE + i;
+        }
+        n = __encode_int(out, cap, 6, 0x40, name_index);
+    }
+    else
+        n = __encode_int(out, cap, 4, mode == BEE_HPACK_NEVER_INDEX ? 0x10 : 0x00, name_index);
+    if (n < 0)
+        return -1;
+
+    if (name_index == 0) {
+        r = __encode_str(out + n, cap - n, name, name_len);
+        if (r < 0)
+            return -1;
+        n += r;
+    }
+
+    r = __encode_str(out + n, cap - n, value, value_len);
+    if (r < 0)
+        return -1;
+    n += r;
+
+    if (mode == BEE_HPACK_INDEX && __table_add(hpack, name, name_len, value, value_len) < 0)
+        return -1;
+
+    return n;
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Exported functions                                                        */
+/*---------------------------------------------------------------------------*/
+bee_hpack_t *
+bee_hpack_new(size_t max_size)
+{
+    bee_hpack_t *hpack;
+
+    hpack = calloc(1, sizeof(*hpack));
+    if (!hpack)
+        return NULL;
+
+    hpack->cap = max_size / ENTRY_OVERHEAD + 1;
+    hpack->ring = calloc(hpack->cap, sizeof(*hpack->ring));
+    if (!hpack->ring) {
+        free(hpack);
+        return NULL;
+    }
+
+    hpack->max_size = max_size;
+    hpack->limit = max_size;
+    return hpack;
+}
+
+void
+bee_hpack_free(bee_hpack_t *hpack)
+{
+    __table_resize(hpack, 0);
+    free(hpack->scratch[0]);
+    free(hpack->scratch[1]);
+    free(hpack->ring);
+    free(hpack);
+}
+
+void
+bee_hpack_set_max_size(bee_hpack_t *hpack, size_t max_size)
+{
+    if (max_size > hpack->limit)
+        max_size = hpack->limit;
+    if (max_size == hpack->max_size)
+        return;
+
+    if (!hpack->update || max_size < hpack->update_min)
+        hpack->update_min = max_size;
+    hpack->update = 1;
+    __table_resize(hpack, max_size);
+}
+/*---------------------------------------------------------------------------*/
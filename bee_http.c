@@ -1,10 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
 #include <errno.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "bee.h"
 #include "bee_http.h"
+#include "bee_hpack.h"
 
 #ifndef TAILQ_FOREACH_SAFE
 #define TAILQ_FOREACH_SAFE(var, head, field, tvar)          \
@@ -21,74 +31,333 @@
     "\r\n"                          \
     "The requested URL was not found on this server.\n"
 
+#define UNAVAILABLE_RESPONSE    \
+    "HTTP/1.1 503 Service Unavailable\r\n"    \
+    "Content-Type: text/plain\r\n"  \
+    "Content-Length: 37\r\n"        \
+    "\r\n"                          \
+    "The server is temporarily too busy.\n"
+
+#define PAYLOAD_TOO_LARGE_RESPONSE  \
+    "HTTP/1.1 413 Payload Too Large\r\n"  \
+    "Content-Type: text/plain\r\n"  \
+    "Content-Length: 31\r\n"        \
+    "Connection: close\r\n"         \
+    "\r\n"                          \
+    "The request body is too large.\n"
+
+#define URI_TOO_LONG_RESPONSE   \
+    "HTTP/1.1 414 URI Too Long\r\n"  \
+    "Content-Type: text/plain\r\n"  \
+    "Content-Length: 29\r\n"        \
+    "Connection: close\r\n"         \
+    "\r\n"                          \
+    "The request URL is too long.\n"
+
+#define HEADERS_TOO_LARGE_RESPONSE  \
+    "HTTP/1.1 431 Request Header Fields Too Large\r\n"  \
+    "Content-Type: text/plain\r\n"  \
+    "Content-Length: 35\r\n"        \
+    "Connection: close\r\n"         \
+    "\r\n"                          \
+    "The request headers are too large.\n"
+
+#define TOO_MANY_REQUESTS_RESPONSE  \
+    "HTTP/1.1 429 Too Many Requests\r\n"  \
+    "Content-Type: text/plain\r\n"  \
+    "Content-Length: 30\r\n"        \
+    "Retry-After: 1\r\n"            \
+    "\r\n"                          \
+    "Too many requests, slow down.\n"
+
+#define INTERNAL_ERROR_RESPONSE \
+    "HTTP/1.1 500 Internal Server Error\r\n"  \
+    "Content-Type: text/plain\r\n"  \
+    "Content-Length: 33\r\n"        \
+    "Connection: close\r\n"         \
+    "\r\n"                          \
+    "The server ran out of resources.\n"
+
+#define HEALTHZ_RESPONSE        \
+    "HTTP/1.1 200 OK\r\n"           \
+    "Content-Type: text/plain\r\n"  \
+    "Content-Length: 3\r\n"         \
+    "\r\n"                          \
+    "ok\n"
+
+#define READY_RESPONSE          \
+    "HTTP/1.1 200 OK\r\n"           \
+    "Content-Type: text/plain\r\n"  \
+    "Content-Length: 6\r\n"         \
+    "\r\n"                          \
+    "ready\n"
+
+#define NOT_READY_RESPONSE      \
+    "HTTP/1.1 503 Service Unavailable\r\n"    \
+    "Content-Type: text/plain\r\n"  \
+    "Content-Length: 10\r\n"        \
+    "\r\n"                          \
+    "not ready\n"
+
+
+/* A request whose callback runs on a bee_pool_t worker. The reply written
+ * by the callback is captured and sent from the event loop afterwards.
+ */
+typedef struct {
+    bee_server_t          * server;
+    bee_conn_handle_t       handle;
+    bh_callback_t         * callback;
+    bh_request_t          * request;
+    int                     sfd;
+    uint32_t                stream_id;      /* HTTP/2 stream, 0 for HTTP/1.x */
+    char                  * reply;
+    size_t                  reply_len;
+} bh_offload_t;
+
+/* the reply being captured on this thread, by a pool worker or an HTTP/2 stream */
+static __thread bh_offload_t *offload_current = NULL;
+
+/* the connection whose request callback is running on this thread */
+static __thread bee_connection_t *http_current = NULL;
+
+
+/* What conn->pdata of an http connection points at: both structures
+ * start with one of these.
+ */
+#define BH_CONN_STREAM          1           /* bh_stream_t */
+#define BH_CONN_H2              2           /* bh_h2_t */
+
+typedef struct bh_h2            bh_h2_t;
+
+static void __h2_deliver(bee_connection_t *conn, bh_offload_t *offload);
+
+
+/* Memory for the lazily parsed parts of a request, released in one go
+ * with the request.
+ */
+#define ARENA_CHUNK_SIZE        4096
+#define ARENA_ALIGN             16
+
+struct bh_arena {
+    struct bh_arena       * next;
+    size_t                  size;
+    size_t                  used;
+    char                    data[];
+};
+
+/* freed requests kept per thread, each with its first arena chunk */
+#define REQUEST_CACHE_SIZE      8
+
+static __thread bh_request_t *request_cache[REQUEST_CACHE_SIZE];
+static __thread int request_cache_len = 0;
+
+#define BH_PARSED_URL           (1 << 0)
+#define BH_PARSED_PARAMS        (1 << 1)
+#define BH_PARSED_COOKIES       (1 << 2)
+
+
+/* Well-known header names, indexed by __header_hash(). The hash is
+ * collision-free over this set, so classifying a field takes one probe
+ * and one case-insensitive compare.
+ */
+#define HEADER_HASH_SIZE        64
+
+static const struct {
+    const char            * name;
+    size_t                  len;
+    enum BH_HEADER_ID       id;
+} known_headers[HEADER_HASH_SIZE] = {
+    [ 0] = { "upgrade",              7, BH_HDR_UPGRADE },
+    [ 1] = { "referer",              7, BH_HDR_REFERER },
+    [ 2] = { "content-length",      14, BH_HDR_CONTENT_LENGTH },
+    [ 4] = { "connection",          10, BH_HDR_CONNECTION },
+    [ 5] = { "cache-control",       13, BH_HDR_CACHE_CONTROL },
+    [ 8] = { "transfer-encoding",   17, BH_HDR_TRANSFER_ENCODING },
+    [14] = { "expect",               6, BH_HDR_EXPECT },
+    [18] = { "user-agent",          10, BH_HDR_USER_AGENT },
+    [24] = { "host",                 4, BH_HDR_HOST },
+    [25] = { "if-none-match",       13, BH_HDR_IF_NONE_MATCH },
+    [26] = { "if-modified-since",   17, BH_HDR_IF_MODIFIED_SINCE },
+    [33] = { "x-forwarded-for",     15, BH_HDR_X_FORWARDED_FOR },
+    [48] = { "origin",               6, BH_HDR_ORIGIN },
+    [50] = { "range",                5, BH_HDR_RANGE },
+    [55] = { "cookie",               6, BH_HDR_COOKIE },
+    [56] = { "accept-language",     15, BH_HDR_ACCEPT_LANGUAGE },
+    [58] = { "accept-encoding",     15, BH_HDR_ACCEPT_ENCODING },
+    [61] = { "content-type",        12, BH_HDR_CONTENT_TYPE },
+    [62] = { "accept",               6, BH_HDR_ACCEPT },
+    [63] = { "authorization",       13, BH_HDR_AUTHORIZATION },
+};
+
 
 static bh_request_t *
 __http_request_new(void)
 {
     bh_request_t *request;
-    bh_header_t *header = NULL;
-    int i;
 
-    request = malloc(sizeof(bh_request_t));
-    assert(request != NULL);
+    if (request_cache_len > 0)
+        request = request_cache[--request_cache_len];
+    else {
+        request = malloc(sizeof(bh_request_t));
+        assert(request != NULL);
+        request->arena = NULL;
+    }
+
+    request->limits = NULL;
+    request->header_bytes = 0;
+    request->reject = 0;
 
     request->url = NULL;
     request->method = NULL;
     request->header_lines = 0;
-
-    for (i = 0; i < MAX_HTTP_HEADERS; i++) {
-        header = &request->headers[i];
-        header->field = NULL;
-        header->value = NULL;
-        header->field_len = 0;
-        header->value_len = 0;
-    }
+    memset(request->known, 0, sizeof(request->known));
 
     request->body = NULL;
     request->body_len = 0;
+    request->body_cap = 0;
+
+    request->parsed = 0;
+    request->path = NULL;
+    request->query = NULL;
+    request->fragment = NULL;
+    request->params = NULL;
+    request->nparams = 0;
+    request->cookies = NULL;
+    request->ncookies = 0;
 
     return request;
 }
 
+/* Everything hanging off a request lives in its arena, so freeing it is
+ * one reset. The request and its first arena chunk are kept for the next
+ * request on this thread.
+ */
 static void
 __http_request_free(bh_request_t *request)
 {
-    int i;
-    bh_header_t *header = NULL;
+    struct bh_arena *chunk = request->arena, *next;
 
-    if (request->url != NULL) {
-        free(request->url);
-        request->url = NULL;
+    /* the oldest chunk is the standard-sized one */
+    while (chunk != NULL && chunk->next != NULL) {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    if (chunk != NULL && chunk->size != ARENA_CHUNK_SIZE) {
+        free(chunk);
+        chunk = NULL;
     }
+    if (chunk != NULL)
+        chunk->used = 0;
+    request->arena = chunk;
 
-    if (request->method != NULL) {
-        free(request->method);
-        request->method = NULL;
+    if (request_cache_len < REQUEST_CACHE_SIZE) {
+        request_cache[request_cache_len++] = request;
+        return;
     }
 
-    for (i = 0; i < request->header_lines; ++i) {
-        header = &request->headers[i];
-        if (header->field != NULL) {
-            free(header->field);
-            header->field = NULL;
-            header->field_len = 0;
-        }
-        if (header->value != NULL) {
-            free(header->value);
-            header->value = NULL;
-            header->value_len = 0;
-        }
+    free(chunk);
+    free(request);
+}
+
+static char *
+__request_strndup(bh_request_t *request, const char *s, size_t len)
+{
+    char *copy = bh_request_alloc(request, len + 1);
+
+    if (copy != NULL) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
     }
+    return copy;
+}
 
-    request->header_lines = 0;
+static unsigned int
+__header_hash(const char *field, size_t len)
+{
+    return (len + 4 * (field[0] | 0x20) + (field[len - 1] | 0x20)) & (HEADER_HASH_SIZE - 1);
+}
+
+/* Returns the BH_HEADER_ID of `field', or BH_HDR_MAX if it is not one of
+ * the well-known headers.
+ */
+static enum BH_HEADER_ID
+__header_classify(const char *field, size_t len)
+{
+    unsigned int h;
+
+    if (len == 0)
+        return BH_HDR_MAX;
+
+    h = __header_hash(field, len);
+    if (known_headers[h].name == NULL || known_headers[h].len != len ||
+        strncasecmp(known_headers[h].name, field, len) != 0)
+        return BH_HDR_MAX;
+
+    return known_headers[h].id;
+}
+
+/* Stops the parser before anything is copied; http_recv() answers with
+ * `status' and closes the connection.
+ */
+static int
+__request_reject(bh_request_t *request, int status)
+{
+    request->reject = status;
+    return -1;
+}
+
+/* The response for a request rejected with `status'. */
+static const char *
+__reject_response(int status, size_t *len)
+{
+    switch (status) {
+    case 413:
+        *len = sizeof(PAYLOAD_TOO_LARGE_RESPONSE) - 1;
+        return PAYLOAD_TOO_LARGE_RESPONSE;
+    case 414:
+        *len = sizeof(URI_TOO_LONG_RESPONSE) - 1;
+        return URI_TOO_LONG_RESPONSE;
+    case 429:
+        *len = sizeof(TOO_MANY_REQUESTS_RESPONSE) - 1;
+        return TOO_MANY_REQUESTS_RESPONSE;
+    case 500:
+        *len = sizeof(INTERNAL_ERROR_RESPONSE) - 1;
+        return INTERNAL_ERROR_RESPONSE;
+    default:
+        *len = sizeof(HEADERS_TOO_LARGE_RESPONSE) - 1;
+        return HEADERS_TOO_LARGE_RESPONSE;
+    }
+}
+
+/* The callback serving the path of `request', or NULL. The query string
+ * is the handler's business and takes no part in routing.
+ */
+static bh_callback_t *
+__http_route(bh_server_t *httpd, const bh_request_t *request)
+{
+    bh_callback_t *callback;
+    size_t path_len;
+
+    if (request->url == NULL)
+        return NULL;
 
-    if (request->body != NULL) {
-        free(request->body);
-        request->body = NULL;
-        request->body_len = 0;
+    path_len = strcspn(request->url, "?#");
+    TAILQ_FOREACH(callback, &httpd->callbacks, next) {
+        if (strncmp(callback->path, request->url, path_len) == 0 && callback->path[path_len] == '\0')
+            return callback;
     }
+    return NULL;
+}
 
-    free(request);
+/* Accounts `len' more bytes of url or headers. */
+static int
+__request_header_bytes(bh_request_t *request, size_t len)
+{
+    request->header_bytes += len;
+    if (request->limits != NULL && request->header_bytes > request->limits->max_header_bytes)
+        return __request_reject(request, 431);
+    return 0;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -103,15 +372,16 @@ __on_message_begin(http_parser *parser)
 static int
 __on_headers_complete(http_parser *parser)
 {
-    size_t len;
     bh_request_t *request = parser->data;
     const char *method = http_method_str((enum http_method)parser->method);
 
-    len = strlen(method);
-    request->method = malloc(len + 1);
+    /* a declared body over the limit is refused before any of it arrives */
+    if (request->limits != NULL && parser->content_length != ULLONG_MAX &&
+        parser->content_length > request->limits->max_body)
+        return __request_reject(request, 413);
+
+    request->method = __request_strndup(request, method, strlen(method));
     assert(request->method != NULL);
-    strncpy(request->method, method, len);
-    request->method[len] = '\0';
 
     return 0;
 }
@@ -121,10 +391,13 @@ __on_url(http_parser *parser, const char *at, size_t len)
 {
     bh_request_t *request = parser->data;
 
-    request->url = malloc(len + 1);
+    if (request->limits != NULL && len > request->limits->max_url)
+        return __request_reject(request, 414);
+    if (__request_header_bytes(request, len) < 0)
+        return -1;
+
+    request->url = __request_strndup(request, at, len);
     assert(request->url != NULL);
-    strncpy(request->url, at, len);
-    request->url[len] = '\0';
     return 0;
 }
 
@@ -132,13 +405,25 @@ static int
 __on_header_field(http_parser *parser, const char *at, size_t len)
 {
     bh_request_t *request = parser->data;
-    bh_header_t *header = &request->headers[request->header_lines];
+    int max_headers = request->limits ? request->limits->max_headers : MAX_HTTP_HEADERS;
+    bh_header_t *header;
+    enum BH_HEADER_ID id;
+
+    if (request->header_lines >= max_headers)
+        return __request_reject(request, 431);
+    if (__request_header_bytes(request, len) < 0)
+        return -1;
 
-    header->field = malloc(len + 1);
+    header = &request->headers[request->header_lines];
+    header->field = __request_strndup(request, at, len);
     assert(header->field != NULL);
     header->field_len = len;
-    strncpy(header->field, at, len);
-    header->field[len] = '\0';
+    header->value = NULL;
+    header->value_len = 0;
+
+    id = __header_classify(at, len);
+    if (id != BH_HDR_MAX && request->known[id] == NULL)
+        request->known[id] = header;
     return 0;
 }
 
@@ -148,26 +433,45 @@ __on_header_value(http_parser *parser, const char *at, size_t len)
     bh_request_t *request = parser->data;
     bh_header_t *header = &request->headers[request->header_lines];
 
-    header->value = malloc(len + 1);
+    if (__request_header_bytes(request, len) < 0)
+        return -1;
+
+    header->value = __request_strndup(request, at, len);
     assert(header->value != NULL);
     header->value_len = len;
-    strncpy(header->value, at, len);
-    header->value[len] = '\0';
     ++request->header_lines;
 
     return 0;
 }
 
+/* A chunked body arrives in pieces; they are joined into one. */
 static int
 __on_body(http_parser *parser, const char *at, size_t len)
 {
     bh_request_t *request = parser->data;
+    size_t need = request->body_len + len + 1;
+    size_t cap;
+    char *body;
+
+    /* chunked bodies have no declared length to check up front */
+    if (request->limits != NULL && request->body_len + len > request->limits->max_body)
+        return __request_reject(request, 413);
+
+    /* the room doubles, so a body in many small pieces is copied O(n) */
+    if (need > request->body_cap) {
+        cap = request->body_cap * 2 > need ? request->body_cap * 2 : need;
+        body = bh_request_alloc(request, cap);
+        if (body == NULL)
+            return __request_reject(request, 500);
+        if (request->body_len > 0)
+            memcpy(body, request->body, request->body_len);
+        request->body = body;
+        request->body_cap = cap;
+    }
 
-    request->body = malloc(len + 1);
-    assert(request->body != NULL);
-    request->body_len = len;
-    strncpy(request->body, at, len);
-    request->body[len] = '\0';
+    memcpy(request->body + request->body_len, at, len);
+    request->body_len += len;
+    request->body[request->body_len] = '\0';
 
     return 0;
 }
@@ -181,7 +485,7 @@ __on_message_complete(http_parser *parser)
 
     printf("url: %s\n", request->url);
     printf("method: %s\n", request->method);
-    for (i = 0; i < MAX_HTTP_HEADERS; ++i) {
+    for (i = 0; i < request->header_lines; ++i) {
         header = &request->headers[i];
         if (header->field) {
             printf("header: %s: %s\n", header->field, header->value);
@@ -198,154 +502,2585 @@ __on_message_complete(http_parser *parser)
 
 
 /*---------------------------------------------------------------------------*/
-/* Bee server callbacks                                                      */
+/* Built-in routes                                                           */
 /*---------------------------------------------------------------------------*/
-enum BEE_HOOK_RESULT http_recv(int sfd, void *arg)
+/* The BH_PROBE_* served at `path', 0 if none is. */
+static unsigned int
+__probe_route(const bh_server_t *httpd, const char *path, size_t len)
 {
-    bee_connection_t *conn = arg;
-    bh_server_t *httpd = conn->server->pdata;
-    bh_request_t *request;
-    http_parser parser;
-    char buf[65535];
-    ssize_t nparsed = 0, nr = 0;
+    unsigned int probe = 0;
 
-    memset(buf, 0, sizeof(buf));
-    nr = recv(sfd, buf, sizeof(buf), 0);
-    if (nr < 0) {
-        if (errno == EAGAIN)
-            return BEE_HOOK_EAGAIN;
-        perror("recv");
-        return BEE_HOOK_ERR;
+    if (len == 8 && memcmp(path, "/healthz", 8) == 0)
+        probe = BH_PROBE_HEALTH;
+    else if (len == 7 && memcmp(path, "/readyz", 7) == 0)
+        probe = BH_PROBE_READY;
+    else if (len == 10 && memcmp(path, "/debug/bee", 10) == 0)
+        probe = BH_PROBE_DEBUG;
+
+    return probe & httpd->probes;
+}
+
+static int
+__has_close(const char *s, const char *end)
+{
+    for (; end - s >= 5; s++) {
+        if (strncasecmp(s, "close", 5) == 0)
+            return 1;
     }
-    else if (nr == 0) {
-        close(sfd);
-        return BEE_HOOK_PEER_CLOSED;
+    return 0;
+}
+
+/* Matches a whole GET request for a built-in route at the start of `buf'
+ * without running the parser. Returns its BH_PROBE_*, the length of the
+ * request and whether the client keeps the connection; 0 if it is not one,
+ * has a body or is not all there, which the parser then deals with.
+ */
+static unsigned int
+__probe_request(const bh_server_t *httpd, const char *buf, size_t len, size_t *req_len, int *keepalive)
+{
+    const char *end = buf + len;
+    const char *p = buf + 4;
+    const char *line, *eol;
+    unsigned int probe;
+
+    if (len < 4 || memcmp(buf, "GET ", 4) != 0)
+        return 0;
+
+    while (p < end && *p != ' ' && *p != '?')
+        ++p;
+    probe = __probe_route(httpd, buf + 4, p - (buf + 4));
+    if (probe == 0)
+        return 0;
+
+    for (line = p; ; line = eol + 2) {
+        eol = memchr(line, '\r', end - line);
+        if (eol == NULL || eol + 1 >= end || eol[1] != '\n')
+            return 0;
+
+        if (line == p)
+            *keepalive = eol - p >= 9 && memcmp(eol - 8, "HTTP/1.1", 8) == 0;
+        else if (eol == line)
+            break;
+        else if (strncasecmp(line, "content-length:", 15) == 0 ||
+                 strncasecmp(line, "transfer-encoding:", 18) == 0)
+            return 0;
+        else if (strncasecmp(line, "connection:", 11) == 0 && __has_close(line + 11, eol))
+            *keepalive = 0;
     }
 
-    request = __http_request_new();
-    if (request == NULL)
-        return BEE_HOOK_ERR;
+    *req_len = eol + 2 - buf;
+    return probe;
+}
 
-    http_parser_init(&parser, HTTP_REQUEST);
-    parser.data = request;
-    nparsed = http_parser_execute(&parser, &httpd->parser_settings, buf, nr);
-    if (nparsed < nr)
-        fprintf(stderr, "parse error.\n");
-    else {
-        /* handle the http request */
-        bh_callback_t *callback;
-        int found = 0;
-
-        TAILQ_FOREACH(callback, &httpd->callbacks, next) {
-            if (strcmp(callback->path, request->url) == 0) {
-                callback->cb(sfd, request);
-                found = 1;
-                break;
-            }
-        }
+/* Ready unless draining, or the loop lags behind by more than allowed on
+ * average.
+ */
+static int
+__http_ready(bee_server_t *server)
+{
+    bh_server_t *httpd = server->pdata;
+    bee_loop_stats_t stats;
 
-        if (!found) {
-            nr = send(sfd, NOTFOUND_RESPONSE, sizeof(NOTFOUND_RESPONSE), 0);
-            if (nr < 0) {
-                perror("send");
-                return BEE_HOOK_ERR;
-            }
-        }
+    if (bee_server_is_draining(server))
+        return 0;
+
+    if (server->monitor != NULL && httpd->ready_max_lag_ms > 0) {
+        bee_monitor_get_stats(server->monitor, &stats);
+        if (stats.lag_avg_us > (uint64_t)httpd->ready_max_lag_ms * 1000)
+            return 0;
     }
 
-    __http_request_free(request);
-    return BEE_HOOK_CLOSED;
+    return 1;
 }
-/*---------------------------------------------------------------------------*/
 
-
-/*---------------------------------------------------------------------------*/
-/* Exported functions                                                        */
-/*---------------------------------------------------------------------------*/
-bee_server_t *
-bh_server_new(struct event_base *evbase, const char *baddr, uint16_t port, int backlog)
+static void
+__json_string(FILE *f, const char *s)
 {
-    bh_server_t * httpd;
-    bee_server_t * server;
+    fputc('"', f);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", *s);
+        else
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
 
-    httpd = calloc(1, sizeof(*httpd));
-    if (!httpd)
+/* The response of /debug/bee in a buffer of its own, NULL if out of memory. */
+static char *
+__debug_response(bee_server_t *server, size_t *len)
+{
+    bh_server_t *httpd = server->pdata;
+    bh_callback_t *callback;
+    bee_loop_stats_t loop;
+    char *body = NULL, *response;
+    size_t body_len = 0;
+    int used, pooled, n;
+    FILE *f;
+
+    f = open_memstream(&body, &body_len);
+    if (f == NULL)
         return NULL;
 
-    httpd->parser_settings.on_message_begin = __on_message_begin;
-    httpd->parser_settings.on_url = __on_url;
-    httpd->parser_settings.on_header_field = __on_header_field;
-    httpd->parser_settings.on_header_value = __on_header_value;
-    httpd->parser_settings.on_headers_complete = __on_headers_complete;
-    httpd->parser_settings.on_body = __on_body;
-    httpd->parser_settings.on_message_complete = __on_message_complete;
-    TAILQ_INIT(&httpd->callbacks);
+    fprintf(f, "{\"connections\":%u,\"draining\":%s,\"ready\":%s,",
+            bee_server_conn_count(server), bee_server_is_draining(server) ? "true" : "false",
+            __http_ready(server) ? "true" : "false");
+    fprintf(f, "\"probed\":%llu,\"not_found\":%llu,\"limited\":%llu,",
+            (unsigned long long)httpd->probed, (unsigned long long)httpd->not_found,
+            (unsigned long long)httpd->limited);
+
+    if (server->monitor != NULL) {
+        bee_monitor_get_stats(server->monitor, &loop);
+        fprintf(f, "\"loop\":{\"lag_us\":%llu,\"lag_avg_us\":%llu,\"lag_max_us\":%llu,"
+                "\"passes\":%llu,\"hooks\":%llu,\"hooks_max\":%llu,\"hook_ns\":%llu,\"hook_max_ns\":%llu},",
+                (unsigned long long)loop.lag_us, (unsigned long long)loop.lag_avg_us,
+                (unsigned long long)loop.lag_max_us, (unsigned long long)loop.passes,
+                (unsigned long long)loop.hooks, (unsigned long long)loop.hooks_max,
+                (unsigned long long)loop.hook_ns, (unsigned long long)loop.hook_max_ns);
+    }
+    else
+        fputs("\"loop\":null,", f);
+
+    fputs("\"routes\":[", f);
+    TAILQ_FOREACH(callback, &httpd->callbacks, next) {
+        if (callback != TAILQ_FIRST(&httpd->callbacks))
+            fputc(',', f);
+        fputs("{\"path\":", f);
+        __json_string(f, callback->path);
+        fprintf(f, ",\"requests\":%llu,\"limited\":%llu,\"pool\":%s}",
+                (unsigned long long)callback->requests, (unsigned long long)callback->limited,
+                callback->pool != NULL ? "true" : "false");
+    }
 
-    server = bee_server_tcp_new(evbase, baddr, port, backlog);
-    if (!server) {
-        free(httpd);
+    bee_outbuf_stats(&used, &pooled);
+    fprintf(f, "],\"buffers\":{\"outbuf_used\":%d,\"outbuf_pooled\":%d,\"request_cache\":%d}}\n",
+            used, pooled, request_cache_len);
+
+    if (fclose(f) != 0) {
+        free(body);
         return NULL;
     }
 
-    server->pdata = httpd;
-    server->on_recv = http_recv;
+    response = malloc(128 + body_len);
+    if (response != NULL) {
+        n = sprintf(response, "HTTP/1.1 200 OK\r\n"
+                              "Content-Type: application/json\r\n"
+                              "Content-Length: %zu\r\n"
+                              "\r\n", body_len);
+        memcpy(response + n, body, body_len);
+        *len = n + body_len;
+    }
 
-    return server;
+    free(body);
+    return response;
 }
 
-void
-bh_server_free(bee_server_t *server)
+/* The response to `probe': prebuilt bytes, except for /debug/bee, which
+ * is built in a buffer also returned in `*built' for the caller to free.
+ */
+static const char *
+__probe_response(bee_server_t *server, unsigned int probe, size_t *len, char **built)
 {
     bh_server_t *httpd = server->pdata;
-    bh_callback_t *callback, *tmp;
 
-    TAILQ_FOREACH_SAFE(callback, &httpd->callbacks, next, tmp) {
-        if (callback->path != NULL)
-            free(callback->path);
+    ++httpd->probed;
+    *built = NULL;
+    switch (probe) {
+    case BH_PROBE_HEALTH:
+        *len = sizeof(HEALTHZ_RESPONSE) - 1;
+        return HEALTHZ_RESPONSE;
+    case BH_PROBE_READY:
+        if (__http_ready(server)) {
+            *len = sizeof(READY_RESPONSE) - 1;
+            return READY_RESPONSE;
+        }
+        *len = sizeof(NOT_READY_RESPONSE) - 1;
+        return NOT_READY_RESPONSE;
+    default:
+        *built = __debug_response(server, len);
+        if (*built != NULL)
+            return *built;
+        *len = sizeof(UNAVAILABLE_RESPONSE) - 1;
+        return UNAVAILABLE_RESPONSE;
+    }
+}
 
-        TAILQ_REMOVE(&httpd->callbacks, callback, next);
-        free(callback);
+static void
+__http_probe(bee_connection_t *conn, unsigned int probe)
+{
+    size_t len;
+    char *built;
+    const char *response = __probe_response(conn->server, probe, &len, &built);
+
+    if (bee_conn_write(conn, response, len) < 0)
+        perror("bee_conn_write");
+    free(built);
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Offloaded callbacks                                                       */
+/*---------------------------------------------------------------------------*/
+static void
+__http_write(int sfd, const char *buf, size_t len)
+{
+    bh_offload_t *offload = offload_current;
+    ssize_t nr;
+
+    if (offload != NULL && offload->sfd == sfd) {
+        char *reply = realloc(offload->reply, offload->reply_len + len);
+        assert(reply != NULL);
+        memcpy(reply + offload->reply_len, buf, len);
+        offload->reply = reply;
+        offload->reply_len += len;
+        return;
     }
 
-    free(httpd);
-    bee_server_free(server);
+    /* a reply from a callback on the event loop */
+    if (http_current != NULL && http_current->sfd == sfd) {
+        if (bee_conn_write(http_current, buf, len) < 0)
+            perror("bee_conn_write");
+        return;
+    }
+
+    nr = send(sfd, buf, len, MSG_NOSIGNAL);
+    if (nr < 0)
+        perror("send");
 }
 
+static void
+__offload_work(void *arg)
+{
+    bh_offload_t *offload = arg;
 
-bh_callback_t *
-bh_server_set_cb(bee_server_t *server, const char *path, bh_callback_cb cb)
+    offload_current = offload;
+    offload->callback->cb(offload->sfd, offload->request);
+    offload_current = NULL;
+}
+
+static void
+__offload_done(void *arg)
 {
-    bh_server_t *httpd = server->pdata;
-    bh_callback_t *callback;
+    bh_offload_t *offload = arg;
+    bee_connection_t *conn = bee_connection_lookup(offload->server, offload->handle);
+
+    if (conn != NULL && offload->stream_id != 0)
+        __h2_deliver(conn, offload);
+    else if (conn != NULL) {
+        if (offload->reply_len > 0 && bee_conn_write(conn, offload->reply, offload->reply_len) < 0)
+            perror("bee_conn_write");
+        bee_connection_close(conn);
+    }
 
-    callback = calloc(1, sizeof(*callback));
-    if (!callback)
-        return NULL;
+    __http_request_free(offload->request);
+    free(offload->reply);
+    free(offload);
+}
 
-    callback->path = strdup(path);
-    callback->cb = cb;
-    TAILQ_INSERT_TAIL(&httpd->callbacks, callback, next);
+/* An HTTP/1.x connection is paused until the reply is sent; the other
+ * streams of an HTTP/2 connection keep going.
+ */
+static int
+__http_offload(bee_connection_t *conn, int sfd, uint32_t stream_id, bh_callback_t *callback, bh_request_t *request)
+{
+    bh_server_t *httpd = conn->server->pdata;
+    bh_offload_t *offload;
+
+    offload = calloc(1, sizeof(*offload));
+    if (!offload)
+        return -1;
+
+    offload->server = conn->server;
+    offload->handle = conn->handle;
+    offload->callback = callback;
+    offload->request = request;
+    offload->sfd = sfd;
+    offload->stream_id = stream_id;
+
+    if (stream_id == 0)
+        bee_connection_pause(conn);
+    if (bee_pool_submit(callback->pool, httpd->cq, __offload_work, __offload_done, offload) < 0) {
+        if (stream_id == 0)
+            bee_connection_resume(conn);
+        free(offload);
+        return -1;
+    }
 
-    return callback;
+    return 0;
 }
+/*---------------------------------------------------------------------------*/
 
 
-void bh_send_reply(int sfd, const char *content_type, const char *body, int body_len)
+
+
+/*---------------------------------------------------------------------------*/
+/* Streamed responses                                                        */
+/*---------------------------------------------------------------------------*/
+/* Bytes reserved in front of a coalescing block for the chunk-size line */
+#define STREAM_CHUNK_HDR        8
+
+struct bh_stream_block {
+    size_t                      off;        /* start of the sealed chunk */
+    size_t                      len;        /* end of data */
+    size_t                      cap;
+    char                        data[];
+};
+
+/* The chunks are handed to bee_conn_write(); the connection queues what
+ * the socket does not take and calls http_drain() as it empties.
+ */
+struct bh_stream {
+    int                         kind;       /* BH_CONN_STREAM */
+    bee_connection_t          * conn;       /* NULL once the connection is gone */
+    int                         ended;      /* bh_stream_end() was called */
+    int                         wrote;      /* written to since the last on_drain */
+    struct bh_stream_block    * pending;    /* small writes being coalesced */
+    size_t                      low_wm;
+    size_t                      high_wm;
+    bh_stream_cb                on_drain;
+    void                      * arg;
+};
+
+static struct bh_stream_block *
+__stream_block_new(size_t cap)
 {
-    int len = 0;
-    int total = body_len + 128;
-    char *buf = calloc(sizeof(char), total);
-    ssize_t nr = 0;
+    struct bh_stream_block *block = malloc(sizeof(*block) + cap);
 
-    len += snprintf(buf+len, total-len, "HTTP/1.1 200 OK\r\n");
-    len += snprintf(buf+len, total-len, "Content-Type: %s\r\n", content_type);
-    len += snprintf(buf+len, total-len, "Content-Length: %d\r\n", body_len);
-    len += snprintf(buf+len, total-len, "\r\n");
-    len += snprintf(buf+len, total-len, "%s", body);
+    if (block != NULL) {
+        block->off = 0;
+        block->len = STREAM_CHUNK_HDR;
+        block->cap = cap;
+    }
+    return block;
+}
 
-    nr = send(sfd, buf, len, 0);
-    if (nr < 0)
-        perror("send");
+/* Turns the coalescing block into one chunk, writing the size line into the
+ * room reserved in front of the data, and sends it. The block is reused.
+ */
+static int
+__stream_seal_pending(bh_stream_t *stream)
+{
+    struct bh_stream_block *block = stream->pending;
+    size_t size = block ? block->len - STREAM_CHUNK_HDR : 0;
+    char line[STREAM_CHUNK_HDR + 1];
+    int n;
+
+    if (size == 0)
+        return 0;
+
+    n = snprintf(line, sizeof(line), "%zx\r\n", size);
+    memcpy(block->data + STREAM_CHUNK_HDR - n, line, n);
+    block->off = STREAM_CHUNK_HDR - n;
+    memcpy(block->data + block->len, "\r\n", 2);
+    block->len += 2;
+
+    n = bee_conn_write(stream->conn, block->data + block->off, block->len - block->off);
+    block->off = 0;
+    block->len = STREAM_CHUNK_HDR;
+    return n;
+}
+
+static void
+__stream_free(bh_stream_t *stream)
+{
+    free(stream->pending);
+    free(stream);
+}
+
+/* The connection has room for more: send what was coalesced and ask the
+ * producer for the next part, unless it just had nothing.
+ */
+static enum BEE_HOOK_RESULT
+__stream_drain(bh_stream_t *stream)
+{
+    if (__stream_seal_pending(stream) < 0)
+        return BEE_HOOK_CLOSED;
+
+    /* the last chunk is queued: the connection ends with the response */
+    if (stream->ended)
+        return BEE_HOOK_CLOSED;
+
+    if (stream->on_drain == NULL || !stream->wrote)
+        return BEE_HOOK_OK;
+
+    /* bh_stream_write() asks for the next round */
+    stream->wrote = 0;
+    stream->on_drain(stream, stream->arg);
+    return BEE_HOOK_OK;
+}
+
+/* The connection of `stream' is closing. */
+static void
+__stream_detach(bh_stream_t *stream)
+{
+    stream->conn = NULL;
+
+    /* the producer still owns the stream: let it see the failure */
+    if (!stream->ended) {
+        if (stream->on_drain != NULL)
+            stream->on_drain(stream, stream->arg);
+        return;
+    }
+
+    __stream_free(stream);
+}
+/*---------------------------------------------------------------------------*/
+
+
+/*---------------------------------------------------------------------------*/
+/* HTTP/2                                                                    */
+/*---------------------------------------------------------------------------*/
+/* Cleartext HTTP/2 (RFC 9113), entered with the client preface or through
+ * an "Upgrade: h2c" request. Each stream is read into a bh_request_t by the
+ * same http_parser callbacks as HTTP/1.x and routed the same way; the
+ * HTTP/1.x reply its callback writes is captured, parsed back and sent as
+ * HEADERS and DATA frames.
+ */
+#define H2_PREFACE              "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN          24
+#define H2_FRAME_HDR            9
+#define H2_FRAME_SIZE           16384       /* SETTINGS_MAX_FRAME_SIZE default */
+#define H2_DEFAULT_WINDOW       65535
+#define H2_MAX_WINDOW           0x7fffffff
+#define H2_STREAM_HASH          64
+
+enum H2_FRAME_TYPE {
+    H2_DATA = 0,
+    H2_HEADERS,
+    H2_PRIORITY,
+    H2_RST_STREAM,
+    H2_SETTINGS,
+    H2_PUSH_PROMISE,
+    H2_PING,
+    H2_GOAWAY,
+    H2_WINDOW_UPDATE,
+    H2_CONTINUATION
+};
+
+#define H2_F_END_STREAM         0x01
+#define H2_F_ACK                0x01
+#define H2_F_END_HEADERS        0x04
+#define H2_F_PADDED             0x08
+#define H2_F_PRIORITY           0x20
+
+enum H2_ERROR {
+    H2_NO_ERROR = 0,
+    H2_PROTOCOL_ERROR,
+    H2_INTERNAL_ERROR,
+    H2_FLOW_CONTROL_ERROR,
+    H2_SETTINGS_TIMEOUT,
+    H2_STREAM_CLOSED,
+    H2_FRAME_SIZE_ERROR,
+    H2_REFUSED_STREAM,
+    H2_CANCEL,
+    H2_COMPRESSION_ERROR,
+    H2_CONNECT_ERROR,
+    H2_ENHANCE_YOUR_CALM
+};
+
+enum H2_SETTING {
+    H2_SETTINGS_HEADER_TABLE_SIZE = 1,
+    H2_SETTINGS_ENABLE_PUSH,
+    H2_SETTINGS_MAX_CONCURRENT_STREAMS,
+    H2_SETTINGS_INITIAL_WINDOW_SIZE,
+    H2_SETTINGS_MAX_FRAME_SIZE,
+    H2_SETTINGS_MAX_HEADER_LIST_SIZE
+};
+
+struct bh_h2_stream {
+    uint32_t                    id;
+    int                         remote_closed;  /* END_STREAM received */
+    int                         dispatched;     /* answered, or handed to its callback */
+    int                         blocked;        /* on bh_h2_t.blocked */
+    http_parser                 parser;         /* only carries `request' to the __on_* callbacks */
+    bh_request_t              * request;
+    int64_t                     send_window;
+    int64_t                     recv_window;
+    char                      * reply;          /* owns `body' */
+    const char                * body;           /* response bytes not framed yet */
+    size_t                      body_len;
+    struct bh_h2_stream       * hnext;
+    TAILQ_ENTRY(bh_h2_stream)   bnext;
+};
+
+struct bh_h2 {
+    int                         kind;           /* BH_CONN_H2 */
+    bee_connection_t          * conn;
+    bh_server_t               * httpd;
+    int                         sfd;
+    bee_hpack_t               * decoder;
+    bee_hpack_t               * encoder;
+    int                         preface;        /* client preface seen */
+    uint8_t                   * in;             /* the start of a frame */
+    size_t                      in_len;
+    size_t                      in_cap;
+    uint8_t                   * out;            /* frames for the next bee_conn_write() */
+    size_t                      out_len;
+    size_t                      out_cap;
+    uint8_t                   * hblock;         /* header block split over CONTINUATIONs */
+    size_t                      hblock_len;
+    size_t                      hblock_cap;
+    uint32_t                    hblock_id;      /* 0 unless a CONTINUATION must follow */
+    uint8_t                     hblock_flags;
+    uint32_t                    last_id;        /* highest stream the client opened */
+    uint32_t                    nstreams;
+    struct bh_h2_stream       * streams[H2_STREAM_HASH];
+    TAILQ_HEAD(, bh_h2_stream)  blocked;        /* waiting for window or socket room */
+    int64_t                     send_window;
+    int64_t                     recv_window;
+    uint32_t                    peer_window;    /* the client's SETTINGS_INITIAL_WINDOW_SIZE */
+    uint32_t                    peer_frame_size;
+    int                         goaway;         /* no new streams, close once idle */
+    int                         failed;         /* a connection error was sent */
+};
+
+/* Gathers the HTTP/1.x reply of a callback, in place. */
+struct h2_reply {
+    const char                * field[MAX_HTTP_HEADERS];
+    size_t                      field_len[MAX_HTTP_HEADERS];
+    const char                * value[MAX_HTTP_HEADERS];
+    size_t                      value_len[MAX_HTTP_HEADERS];
+    int                         nfields;
+    char                      * body;
+    size_t                      body_len;
+    int                         complete;
+};
+
+/* Headers that only mean something to one HTTP/1.x connection. */
+static const char * const h2_hop_headers[] = {
+    "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", NULL
+};
+
+
+static uint32_t
+__get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void
+__put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint8_t *
+__h2_reserve(bh_h2_t *h2, size_t len)
+{
+    uint8_t *out;
+    size_t cap;
+
+    if (h2->out_len + len > h2->out_cap) {
+        for (cap = h2->out_cap ? h2->out_cap : 4096; cap < h2->out_len + len; cap *= 2)
+            ;
+        out = realloc(h2->out, cap);
+        assert(out != NULL);
+        h2->out = out;
+        h2->out_cap = cap;
+    }
+
+    out = h2->out + h2->out_len;
+    h2->out_len += len;
+    return out;
+}
+
+static void
+__h2_frame(bh_h2_t *h2, enum H2_FRAME_TYPE type, uint8_t flags, uint32_t id, const void *payload, size_t len)
+{
+    uint8_t *p = __h2_reserve(h2, H2_FRAME_HDR + len);
+
+    p[0] = len >> 16;
+    p[1] = len >> 8;
+    p[2] = len;
+    p[3] = type;
+    p[4] = flags;
+    __put32(p + 5, id);
+    if (len > 0)
+        memcpy(p + H2_FRAME_HDR, payload, len);
+}
+
+/* Refuses new streams; the ones up to `last_id' still get their response. */
+static void
+__h2_send_goaway(bh_h2_t *h2, enum H2_ERROR error)
+{
+    uint8_t payload[8];
+
+    __put32(payload, h2->last_id);
+    __put32(payload + 4, error);
+    __h2_frame(h2, H2_GOAWAY, 0, 0, payload, sizeof(payload));
+    h2->goaway = 1;
+}
+
+/* Queues a connection error; the connection closes once it is sent.
+ * Returns -1 for the caller to pass on.
+ */
+static int
+__h2_goaway(bh_h2_t *h2, enum H2_ERROR error)
+{
+    __h2_send_goaway(h2, error);
+    h2->failed = 1;
+    return -1;
+}
+
+static void
+__h2_rst(bh_h2_t *h2, uint32_t id, enum H2_ERROR error)
+{
+    uint8_t payload[4];
+
+    __put32(payload, error);
+    __h2_frame(h2, H2_RST_STREAM, 0, id, payload, sizeof(payload));
+}
+
+static void
+__h2_window_update(bh_h2_t *h2, uint32_t id, uint32_t increment)
+{
+    uint8_t payload[4];
+
+    __put32(payload, increment);
+    __h2_frame(h2, H2_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+static struct bh_h2_stream *
+__h2_stream_find(bh_h2_t *h2, uint32_t id)
+{
+    struct bh_h2_stream *stream = h2->streams[(id >> 1) & (H2_STREAM_HASH - 1)];
+
+    while (stream != NULL && stream->id != id)
+        stream = stream->hnext;
+    return stream;
+}
+
+static struct bh_h2_stream *
+__h2_stream_new(bh_h2_t *h2, uint32_t id)
+{
+    struct bh_h2_stream *stream = calloc(1, sizeof(*stream));
+    struct bh_h2_stream **bucket = &h2->streams[(id >> 1) & (H2_STREAM_HASH - 1)];
+
+    assert(stream != NULL);
+    stream->id = id;
+    stream->send_window = h2->peer_window;
+    stream->recv_window = BH_H2_WINDOW_SIZE;
+    stream->hnext = *bucket;
+    *bucket = stream;
+    /* a drain waits for the streams, they don't pause the connection */
+    if (h2->nstreams++ == 0)
+        bee_conn_set_busy(h2->conn, 1);
+
+    if (id > h2->last_id)
+        h2->last_id = id;
+    return stream;
+}
+
+static void
+__h2_stream_close(bh_h2_t *h2, struct bh_h2_stream *stream)
+{
+    struct bh_h2_stream **link = &h2->streams[(stream->id >> 1) & (H2_STREAM_HASH - 1)];
+
+    while (*link != stream)
+        link = &(*link)->hnext;
+    *link = stream->hnext;
+    if (--h2->nstreams == 0)
+        bee_conn_set_busy(h2->conn, 0);
+
+    if (stream->blocked)
+        TAILQ_REMOVE(&h2->blocked, stream, bnext);
+    if (stream->request != NULL)
+        __http_request_free(stream->request);
+    free(stream->reply);
+    free(stream);
+}
+
+/* Frames as much of the response body as the flow-control windows and
+ * the connection's output queue allow. The stream is gone once all of it is out.
+ */
+static void
+__h2_stream_send(bh_h2_t *h2, struct bh_h2_stream *stream)
+{
+    int64_t room;
+    size_t n;
+
+    while (stream->body_len > 0) {
+        room = stream->send_window < h2->send_window ? stream->send_window : h2->send_window;
+        if (room <= 0 || h2->out_len + bee_conn_pending(h2->conn) > BH_STREAM_HIGH_WATERMARK) {
+            if (!stream->blocked) {
+                TAILQ_INSERT_TAIL(&h2->blocked, stream, bnext);
+                stream->blocked = 1;
+            }
+            return;
+        }
+
+        n = stream->body_len;
+        if (n > h2->peer_frame_size)
+            n = h2->peer_frame_size;
+        if ((int64_t)n > room)
+            n = room;
+
+        __h2_frame(h2, H2_DATA, n == stream->body_len ? H2_F_END_STREAM : 0, stream->id, stream->body, n);
+        stream->body += n;
+        stream->body_len -= n;
+        stream->send_window -= n;
+        h2->send_window -= n;
+    }
+
+    /* answered before the request was complete: the rest is not wanted */
+    if (!stream->remote_closed)
+        __h2_rst(h2, stream->id, H2_NO_ERROR);
+    __h2_stream_close(h2, stream);
+}
+
+/* Gives the blocked streams another go, each at most once. */
+static void
+__h2_unblock(bh_h2_t *h2)
+{
+    struct bh_h2_stream *stream;
+    uint32_t n = 0, count = 0;
+
+    TAILQ_FOREACH(stream, &h2->blocked, bnext)
+        ++count;
+
+    while (n++ < count && (stream = TAILQ_FIRST(&h2->blocked)) != NULL) {
+        TAILQ_REMOVE(&h2->blocked, stream, bnext);
+        stream->blocked = 0;
+        __h2_stream_send(h2, stream);
+    }
+}
+
+static int
+__reply_on_header_field(http_parser *parser, const char *at, size_t len)
+{
+    struct h2_reply *reply = parser->data;
+
+    if (reply->nfields < MAX_HTTP_HEADERS) {
+        reply->field[reply->nfields] = at;
+        reply->field_len[reply->nfields] = len;
+        reply->value[reply->nfields] = "";
+        reply->value_len[reply->nfields] = 0;
+    }
+    return 0;
+}
+
+static int
+__reply_on_header_value(http_parser *parser, const char *at, size_t len)
+{
+    struct h2_reply *reply = parser->data;
+
+    if (reply->nfields < MAX_HTTP_HEADERS) {
+        reply->value[reply->nfields] = at;
+        reply->value_len[reply->nfields] = len;
+        ++reply->nfields;
+    }
+    return 0;
+}
+
+/* Chunks of a chunked reply are moved down to join the first one. */
+static int
+__reply_on_body(http_parser *parser, const char *at, size_t len)
+{
+    struct h2_reply *reply = parser->data;
+
+    if (reply->body == NULL)
+        reply->body = (char *)at;
+    else
+        memmove(reply->body + reply->body_len, at, len);
+    reply->body_len += len;
+    return 0;
+}
+
+static int
+__reply_on_message_complete(http_parser *parser)
+{
+    struct h2_reply *reply = parser->data;
+
+    reply->complete = 1;
+    return 0;
+}
+
+static const http_parser_settings h2_reply_settings = {
+    .on_header_field = __reply_on_header_field,
+    .on_header_value = __reply_on_header_value,
+    .on_body = __reply_on_body,
+    .on_message_complete = __reply_on_message_complete,
+};
+
+static int
+__h2_index_mode(const char *name, size_t len)
+{
+    /* values that change with every response would only churn the table */
+    if ((len == 14 && memcmp(name, "content-length", 14) == 0) ||
+        (len == 4 && memcmp(name, "date", 4) == 0) ||
+        (len == 4 && memcmp(name, "etag", 4) == 0) ||
+        (len == 13 && memcmp(name, "last-modified", 13) == 0))
+        return BEE_HPACK_NO_INDEX;
+    if (len == 10 && memcmp(name, "set-cookie", 10) == 0)
+        return BEE_HPACK_NEVER_INDEX;
+    return BEE_HPACK_INDEX;
+}
+
+/* Queues a header block as HEADERS and as many CONTINUATIONs as the
+ * client's frame size needs.
+ */
+static void
+__h2_send_headers(bh_h2_t *h2, uint32_t id, const uint8_t *block, size_t len, int end_stream)
+{
+    enum H2_FRAME_TYPE type = H2_HEADERS;
+    uint8_t flags;
+    size_t n;
+
+    do {
+        n = len < h2->peer_frame_size ? len : h2->peer_frame_size;
+        flags = n == len ? H2_F_END_HEADERS : 0;
+        if (type == H2_HEADERS && end_stream)
+            flags |= H2_F_END_STREAM;
+        __h2_frame(h2, type, flags, id, block, n);
+        block += n;
+        len -= n;
+        type = H2_CONTINUATION;
+    } while (len > 0);
+}
+
+/* Sends the HTTP/1.x `reply' a callback wrote for `stream', taking
+ * ownership of it.
+ */
+static void
+__h2_respond(bh_h2_t *h2, struct bh_h2_stream *stream, char *reply, size_t reply_len)
+{
+    http_parser parser;
+    struct h2_reply reply_fields, *r = &reply_fields;
+    uint8_t *block;
+    char name[256], status[3];
+    size_t size, len = 0;
+    int i, j, n, skip;
+
+    stream->dispatched = 1;
+    r->nfields = 0;
+    r->body = NULL;
+    r->body_len = 0;
+    r->complete = 0;
+
+    http_parser_init(&parser, HTTP_RESPONSE);
+    if (reply_len > 0) {
+        parser.data = r;
+        http_parser_execute(&parser, &h2_reply_settings, reply, reply_len);
+        if (!r->complete && HTTP_PARSER_ERRNO(&parser) == HPE_OK)
+            http_parser_execute(&parser, &h2_reply_settings, NULL, 0);  /* the body ends here */
+    }
+
+    if (!r->complete || parser.status_code < 100 || parser.status_code > 999) {
+        /* nothing, or nothing we understand: the stream is dropped */
+        free(reply);
+        __h2_rst(h2, stream->id, H2_INTERNAL_ERROR);
+        __h2_stream_close(h2, stream);
+        return;
+    }
+
+    size = 64;      /* table size updates and :status */
+    for (i = 0; i < r->nfields; i++)
+        size += bee_hpack_encode_bound(r->field_len[i], r->value_len[i]);
+    block = malloc(size);
+    assert(block != NULL);
+
+    status[0] = '0' + parser.status_code / 100;
+    status[1] = '0' + parser.status_code / 10 % 10;
+    status[2] = '0' + parser.status_code % 10;
+    n = bee_hpack_encode_begin(h2->encoder, block, size);
+    if (n < 0)
+        goto err;
+    len = n;
+    n = bee_hpack_encode(h2->encoder, block + len, size - len, ":status", 7, status, 3, BEE_HPACK_INDEX);
+    if (n < 0)
+        goto err;
+    len += n;
+
+    for (i = 0; i < r->nfields; i++) {
+        if (r->field_len[i] >= sizeof(name))
+            continue;
+        for (j = 0; j < (int)r->field_len[i]; j++)
+            name[j] = tolower((unsigned char)r->field[i][j]);
+        name[j] = '\0';
+
+        for (skip = 0, j = 0; h2_hop_headers[j] != NULL && !skip; j++)
+            skip = strcmp(name, h2_hop_headers[j]) == 0;
+        if (skip)
+            continue;
+
+        n = bee_hpack_encode(h2->encoder, block + len, size - len, name, r->field_len[i],
+                             r->value[i], r->value_len[i], __h2_index_mode(name, r->field_len[i]));
+        if (n < 0)
+            goto err;
+        len += n;
+    }
+
+    __h2_send_headers(h2, stream->id, block, len, r->body_len == 0);
+    free(block);
+
+    stream->reply = reply;
+    stream->body = r->body;
+    stream->body_len = r->body_len;
+
+    if (stream->body_len == 0) {
+        if (!stream->remote_closed)
+            __h2_rst(h2, stream->id, H2_NO_ERROR);
+        __h2_stream_close(h2, stream);
+        return;
+    }
+    __h2_stream_send(h2, stream);
+    return;
+
+err:
+    /* the encoder's table already moved on without the peer's */
+    free(block);
+    free(reply);
+    __h2_stream_close(h2, stream);
+    __h2_goaway(h2, H2_INTERNAL_ERROR);
+}
+
+static void
+__h2_respond_copy(bh_h2_t *h2, struct bh_h2_stream *stream, const char *reply, size_t len)
+{
+    char *copy = malloc(len);
+
+    assert(copy != NULL);
+    memcpy(copy, reply, len);
+    __h2_respond(h2, stream, copy, len);
+}
+
+/* The request on `stream' broke one of the server limits. */
+static void
+__h2_reject(bh_h2_t *h2, struct bh_h2_stream *stream)
+{
+    size_t len;
+    const char *response = __reject_response(stream->request->reject, &len);
+
+    __h2_respond_copy(h2, stream, response, len);
+}
+
+/* Runs the callback of a complete request. Like HTTP/1.x, the callback
+ * writes to `sfd'; what it writes is captured instead of sent.
+ */
+static void
+__h2_dispatch(bh_h2_t *h2, struct bh_h2_stream *stream)
+{
+    bh_request_t *request = stream->request;
+    bh_callback_t *callback;
+    bh_offload_t capture;
+    const char *response;
+    unsigned int probe;
+    size_t len;
+    char *built;
+
+    stream->dispatched = 1;
+    if (request->method == NULL || request->url == NULL) {
+        __h2_rst(h2, stream->id, H2_PROTOCOL_ERROR);
+        __h2_stream_close(h2, stream);
+        return;
+    }
+
+    probe = __probe_route(h2->httpd, request->url, strcspn(request->url, "?#"));
+    if (probe != 0) {
+        response = __probe_response(h2->conn->server, probe, &len, &built);
+        if (built != NULL)
+            __h2_respond(h2, stream, built, len);
+        else
+            __h2_respond_copy(h2, stream, response, len);
+        return;
+    }
+
+    if (h2->httpd->ratelimit != NULL && bee_ratelimit_take(h2->httpd->ratelimit, &h2->conn->saddr) < 0) {
+        ++h2->httpd->limited;
+        __h2_respond_copy(h2, stream, TOO_MANY_REQUESTS_RESPONSE, sizeof(TOO_MANY_REQUESTS_RESPONSE) - 1);
+        return;
+    }
+
+    callback = __http_route(h2->httpd, request);
+    if (callback == NULL) {
+        ++h2->httpd->not_found;
+        __h2_respond_copy(h2, stream, NOTFOUND_RESPONSE, sizeof(NOTFOUND_RESPONSE) - 1);
+        return;
+    }
+
+    ++callback->requests;
+    if (callback->ratelimit != NULL && bee_ratelimit_take(callback->ratelimit, &h2->conn->saddr) < 0) {
+        ++callback->limited;
+        __h2_respond_copy(h2, stream, TOO_MANY_REQUESTS_RESPONSE, sizeof(TOO_MANY_REQUESTS_RESPONSE) - 1);
+        return;
+    }
+
+    if (callback->pool != NULL) {
+        /* the request goes with the job; the stream waits for __h2_deliver() */
+        if (__http_offload(h2->conn, h2->sfd, stream->id, callback, request) == 0) {
+            stream->request = NULL;
+            return;
+        }
+        __h2_respond_copy(h2, stream, UNAVAILABLE_RESPONSE, sizeof(UNAVAILABLE_RESPONSE) - 1);
+        return;
+    }
+
+    memset(&capture, 0, sizeof(capture));
+    capture.sfd = h2->sfd;
+    offload_current = &capture;
+    callback->cb(h2->sfd, request);
+    offload_current = NULL;
+
+    __h2_respond(h2, stream, capture.reply, capture.reply_len);
+}
+
+/* bee_hpack_field_cb of request header blocks; `arg' is NULL for a
+ * refused stream, whose block is only decoded to keep HPACK in step.
+ */
+static int
+__h2_field(void *arg, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    struct bh_h2_stream *stream = arg;
+    bh_request_t *request = stream ? stream->request : NULL;
+    http_parser *parser = stream ? &stream->parser : NULL;
+
+    if (request == NULL || request->reject)
+        return 0;
+
+    if (name_len > 0 && name[0] == ':') {
+        if (name_len == 7 && memcmp(name, ":method", 7) == 0 && request->method == NULL)
+            request->method = __request_strndup(request, value, value_len);
+        else if (name_len == 5 && memcmp(name, ":path", 5) == 0 && request->url == NULL)
+            __on_url(parser, value, value_len);
+        else if (name_len == 10 && memcmp(name, ":authority", 10) == 0 && request->known[BH_HDR_HOST] == NULL) {
+            /* handlers look for it as Host */
+            if (__on_header_field(parser, "host", 4) == 0)
+                __on_header_value(parser, value, value_len);
+        }
+        return 0;
+    }
+
+    if (__on_header_field(parser, name, name_len) == 0)
+        __on_header_value(parser, value, value_len);
+    return 0;
+}
+
+static int
+__h2_headers(bh_h2_t *h2, uint32_t id, uint8_t flags, const uint8_t *block, size_t len)
+{
+    struct bh_h2_stream *stream = __h2_stream_find(h2, id);
+    bh_request_t *request;
+    const char *length;
+    int refused = 0;
+
+    if (stream == NULL && id > h2->last_id) {
+        if (h2->goaway || h2->nstreams >= BH_H2_MAX_STREAMS)
+            refused = 1;
+        else {
+            stream = __h2_stream_new(h2, id);
+            stream->request = __http_request_new();
+            assert(stream->request != NULL);
+            stream->request->limits = &h2->httpd->limits;
+            stream->parser.data = stream->request;
+        }
+        h2->last_id = id;
+    }
+    else if (stream != NULL && (stream->remote_closed || !(flags & H2_F_END_STREAM)))
+        return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+
+    /* trailers go into the request as more headers */
+    if (bee_hpack_decode(h2->decoder, block, len, __h2_field, stream) < 0)
+        return __h2_goaway(h2, H2_COMPRESSION_ERROR);
+
+    if (refused) {
+        __h2_rst(h2, id, H2_REFUSED_STREAM);
+        return 0;
+    }
+    if (stream == NULL || stream->dispatched) {
+        /* reset by either side */
+        if (stream != NULL && (flags & H2_F_END_STREAM))
+            stream->remote_closed = 1;
+        return 0;
+    }
+
+    if (flags & H2_F_END_STREAM)
+        stream->remote_closed = 1;
+
+    request = stream->request;
+    length = bh_request_get_header(request, BH_HDR_CONTENT_LENGTH);
+    if (!request->reject && length != NULL && strtoull(length, NULL, 10) > request->limits->max_body)
+        __request_reject(request, 413);
+
+    if (request->reject)
+        __h2_reject(h2, stream);
+    else if (stream->remote_closed)
+        __h2_dispatch(h2, stream);
+    return 0;
+}
+
+static int
+__h2_data(bh_h2_t *h2, uint32_t id, uint8_t flags, const uint8_t *data, size_t len)
+{
+    struct bh_h2_stream *stream;
+    size_t frame_len = len;
+
+    if (id == 0)
+        return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+
+    /* the whole frame counts against the windows, padding included */
+    h2->recv_window -= len;
+    if (h2->recv_window < 0)
+        return __h2_goaway(h2, H2_FLOW_CONTROL_ERROR);
+    if (h2->recv_window < BH_H2_WINDOW_SIZE / 2) {
+        __h2_window_update(h2, 0, BH_H2_WINDOW_SIZE - h2->recv_window);
+        h2->recv_window = BH_H2_WINDOW_SIZE;
+    }
+
+    if (flags & H2_F_PADDED) {
+        if (len < 1 || data[0] >= len)
+            return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+        len -= 1 + data[0];
+        data += 1;
+    }
+
+    stream = __h2_stream_find(h2, id);
+    if (stream == NULL) {
+        if (id > h2->last_id)
+            return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+        return 0;
+    }
+    if (stream->remote_closed) {
+        __h2_rst(h2, id, H2_STREAM_CLOSED);
+        return 0;
+    }
+
+    stream->recv_window -= frame_len;
+    if (stream->recv_window < 0) {
+        __h2_rst(h2, id, H2_FLOW_CONTROL_ERROR);
+        __h2_stream_close(h2, stream);
+        return 0;
+    }
+
+    if (flags & H2_F_END_STREAM)
+        stream->remote_closed = 1;
+    if (stream->dispatched)
+        return 0;
+
+    if (len > 0 && __on_body(&stream->parser, (const char *)data, len) < 0)
+        __h2_reject(h2, stream);
+    else if (stream->remote_closed)
+        __h2_dispatch(h2, stream);
+    else if (stream->recv_window < BH_H2_WINDOW_SIZE / 2) {
+        __h2_window_update(h2, id, BH_H2_WINDOW_SIZE - stream->recv_window);
+        stream->recv_window = BH_H2_WINDOW_SIZE;
+    }
+    return 0;
+}
+
+static int
+__h2_settings(bh_h2_t *h2, const uint8_t *p, size_t len)
+{
+    struct bh_h2_stream *stream;
+    uint32_t value;
+    int64_t delta;
+    int i;
+
+    for (; len >= 6; p += 6, len -= 6) {
+        value = __get32(p + 2);
+        switch (p[0] << 8 | p[1]) {
+        case H2_SETTINGS_HEADER_TABLE_SIZE:
+            bee_hpack_set_max_size(h2->encoder, value);
+            break;
+        case H2_SETTINGS_ENABLE_PUSH:
+            if (value > 1)
+                return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+            break;
+        case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+            if (value > H2_MAX_WINDOW)
+                return __h2_goaway(h2, H2_FLOW_CONTROL_ERROR);
+            /* applies to the open streams too */
+            delta = (int64_t)value - h2->peer_window;
+            for (i = 0; i < H2_STREAM_HASH; i++)
+                for (stream = h2->streams[i]; stream != NULL; stream = stream->hnext)
+                    stream->send_window += delta;
+            h2->peer_window = value;
+            break;
+        case H2_SETTINGS_MAX_FRAME_SIZE:
+            if (value < H2_FRAME_SIZE || value > 0xffffff)
+                return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+            h2->peer_frame_size = value;
+            break;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+static int
+__h2_process(bh_h2_t *h2, const uint8_t *frame, size_t len)
+{
+    uint8_t type = frame[3], flags = frame[4];
+    uint32_t id = __get32(frame + 5) & 0x7fffffff, increment;
+    const uint8_t *p = frame + H2_FRAME_HDR;
+    struct bh_h2_stream *stream;
+    uint8_t *hblock;
+    size_t pad = 0, cap;
+
+    if (h2->hblock_id != 0 && (type != H2_CONTINUATION || id != h2->hblock_id))
+        return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+
+    switch (type) {
+    case H2_DATA:
+        return __h2_data(h2, id, flags, p, len);
+
+    case H2_HEADERS:
+        if (id == 0 || (id & 1) == 0)
+            return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+        if (flags & H2_F_PADDED) {
+            if (len < 1)
+                return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+            pad = *p++;
+            --len;
+        }
+        if (flags & H2_F_PRIORITY) {
+            if (len < 5)
+                return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+            p += 5;
+            len -= 5;
+        }
+        if (pad > len)
+            return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+        len -= pad;
+
+        if (flags & H2_F_END_HEADERS)
+            return __h2_headers(h2, id, flags, p, len);
+        h2->hblock_id = id;
+        h2->hblock_flags = flags;
+        h2->hblock_len = 0;
+        /* fall through */
+    case H2_CONTINUATION:
+        if (h2->hblock_id == 0)
+            return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+        if (h2->hblock_len + len > h2->httpd->limits.max_header_bytes + H2_FRAME_SIZE)
+            return __h2_goaway(h2, H2_ENHANCE_YOUR_CALM);
+        if (h2->hblock_len + len > h2->hblock_cap) {
+            cap = h2->hblock_len + len + H2_FRAME_SIZE;
+            hblock = realloc(h2->hblock, cap);
+            assert(hblock != NULL);
+            h2->hblock = hblock;
+            h2->hblock_cap = cap;
+        }
+        memcpy(h2->hblock + h2->hblock_len, p, len);
+        h2->hblock_len += len;
+        if (type == H2_CONTINUATION && (flags & H2_F_END_HEADERS)) {
+            id = h2->hblock_id;
+            h2->hblock_id = 0;
+            return __h2_headers(h2, id, h2->hblock_flags, h2->hblock, h2->hblock_len);
+        }
+        return 0;
+
+    case H2_PRIORITY:
+        if (len != 5)
+            return __h2_goaway(h2, H2_FRAME_SIZE_ERROR);
+        return 0;
+
+    case H2_RST_STREAM:
+        if (len != 4)
+            return __h2_goaway(h2, H2_FRAME_SIZE_ERROR);
+        if (id == 0 || id > h2->last_id)
+            return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+        /* a callback still running on a pool finds the stream gone */
+        stream = __h2_stream_find(h2, id);
+        if (stream != NULL)
+            __h2_stream_close(h2, stream);
+        return 0;
+
+    case H2_SETTINGS:
+        if (id != 0)
+            return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+        if (flags & H2_F_ACK)
+            return len == 0 ? 0 : __h2_goaway(h2, H2_FRAME_SIZE_ERROR);
+        if (len % 6 != 0)
+            return __h2_goaway(h2, H2_FRAME_SIZE_ERROR);
+        if (__h2_settings(h2, p, len) < 0)
+            return -1;
+        __h2_frame(h2, H2_SETTINGS, H2_F_ACK, 0, NULL, 0);
+        __h2_unblock(h2);
+        return 0;
+
+    case H2_PING:
+        if (len != 8)
+            return __h2_goaway(h2, H2_FRAME_SIZE_ERROR);
+        if (id != 0)
+            return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+        if (!(flags & H2_F_ACK))
+            __h2_frame(h2, H2_PING, H2_F_ACK, 0, p, 8);
+        return 0;
+
+    case H2_GOAWAY:
+        if (id != 0 || len < 8)
+            return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+        h2->goaway = 1;
+        return 0;
+
+    case H2_WINDOW_UPDATE:
+        if (len != 4)
+            return __h2_goaway(h2, H2_FRAME_SIZE_ERROR);
+        increment = __get32(p) & 0x7fffffff;
+        if (id == 0) {
+            if (increment == 0 || h2->send_window + increment > H2_MAX_WINDOW)
+                return __h2_goaway(h2, increment ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+            h2->send_window += increment;
+            __h2_unblock(h2);
+            return 0;
+        }
+        stream = __h2_stream_find(h2, id);
+        if (stream == NULL)
+            return 0;
+        if (increment == 0 || stream->send_window + increment > H2_MAX_WINDOW) {
+            __h2_rst(h2, id, increment ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+            __h2_stream_close(h2, stream);
+            return 0;
+        }
+        stream->send_window += increment;
+        if (stream->blocked) {
+            TAILQ_REMOVE(&h2->blocked, stream, bnext);
+            stream->blocked = 0;
+            __h2_stream_send(h2, stream);
+        }
+        return 0;
+
+    case H2_PUSH_PROMISE:
+        /* clients don't push */
+        return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+
+    default:
+        /* unknown frame types are ignored */
+        return 0;
+    }
+}
+
+/* Feeds received bytes through the frame parser; whatever is left of an
+ * incomplete frame waits in h2->in for the next read.
+ */
+static int
+__h2_input(bh_h2_t *h2, const char *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    size_t avail = len, off = 0, flen, cap;
+    uint8_t *in;
+
+    if (h2->in_len > 0) {
+        if (h2->in_len + len > h2->in_cap) {
+            cap = h2->in_len + len;
+            in = realloc(h2->in, cap);
+            assert(in != NULL);
+            h2->in = in;
+            h2->in_cap = cap;
+        }
+        memcpy(h2->in + h2->in_len, data, len);
+        h2->in_len += len;
+        p = h2->in;
+        avail = h2->in_len;
+    }
+
+    if (!h2->preface) {
+        if (memcmp(p, H2_PREFACE, avail < H2_PREFACE_LEN ? avail : H2_PREFACE_LEN) != 0)
+            return __h2_goaway(h2, H2_PROTOCOL_ERROR);
+        if (avail >= H2_PREFACE_LEN) {
+            h2->preface = 1;
+            off = H2_PREFACE_LEN;
+        }
+    }
+
+    while (h2->preface && avail - off >= H2_FRAME_HDR) {
+        flen = (size_t)p[off] << 16 | p[off + 1] << 8 | p[off + 2];
+        if (flen > H2_FRAME_SIZE)
+            return __h2_goaway(h2, H2_FRAME_SIZE_ERROR);
+        if (avail - off < H2_FRAME_HDR + flen)
+            break;
+        if (__h2_process(h2, p + off, flen) < 0)
+            return -1;
+        off += H2_FRAME_HDR + flen;
+    }
+
+    if (p == h2->in) {
+        memmove(h2->in, h2->in + off, avail - off);
+        h2->in_len = avail - off;
+    }
+    else if (off < avail) {
+        if (avail - off > h2->in_cap) {
+            in = realloc(h2->in, avail - off);
+            assert(in != NULL);
+            h2->in = in;
+            h2->in_cap = avail - off;
+        }
+        memcpy(h2->in, p + off, avail - off);
+        h2->in_len = avail - off;
+    }
+    return 0;
+}
+
+/* Hands the frames built so far to the connection, refilling from the
+ * blocked streams while its queue has room. -1 if the socket failed.
+ */
+static int
+__h2_flush(bh_h2_t *h2)
+{
+    for (;;) {
+        if (h2->out_len > 0 && bee_conn_write(h2->conn, h2->out, h2->out_len) < 0)
+            return -1;
+        h2->out_len = 0;
+
+        if (TAILQ_EMPTY(&h2->blocked) || bee_conn_pending(h2->conn) > BH_STREAM_HIGH_WATERMARK)
+            break;
+        __h2_unblock(h2);
+        if (h2->out_len == 0)
+            break;
+    }
+    return 0;
+}
+
+/* Flushes, and tells whether the connection should now be closed. */
+static enum BEE_HOOK_RESULT
+__h2_finish(bh_h2_t *h2)
+{
+    if (__h2_flush(h2) < 0 || h2->failed)
+        return BEE_HOOK_CLOSED;
+    if (h2->goaway && h2->nstreams == 0)
+        return BEE_HOOK_CLOSED;
+    return BEE_HOOK_OK;
+}
+
+/* __h2_finish() from outside the read hook. */
+static void
+__h2_kick(bh_h2_t *h2)
+{
+    if (__h2_finish(h2) != BEE_HOOK_OK)
+        bee_connection_close(h2->conn);
+}
+
+/* The reply of a callback that ran on a pool. */
+static void
+__h2_deliver(bee_connection_t *conn, bh_offload_t *offload)
+{
+    bh_h2_t *h2 = conn->pdata;
+    struct bh_h2_stream *stream;
+
+    if (h2 == NULL || h2->kind != BH_CONN_H2)
+        return;
+
+    stream = __h2_stream_find(h2, offload->stream_id);
+    if (stream == NULL)
+        return;
+
+    __h2_respond(h2, stream, offload->reply, offload->reply_len);
+    offload->reply = NULL;
+    __h2_kick(h2);
+}
+
+static void
+__h2_free(bh_h2_t *h2)
+{
+    struct bh_h2_stream *stream;
+    int i;
+
+    for (i = 0; i < H2_STREAM_HASH; i++) {
+        while ((stream = h2->streams[i]) != NULL)
+            __h2_stream_close(h2, stream);
+    }
+
+    bee_hpack_free(h2->decoder);
+    bee_hpack_free(h2->encoder);
+    free(h2->in);
+    free(h2->out);
+    free(h2->hblock);
+    free(h2);
+}
+
+static bh_h2_t *
+__h2_new(bee_connection_t *conn, int sfd)
+{
+    bh_h2_t *h2 = calloc(1, sizeof(*h2));
+
+    if (!h2)
+        return NULL;
+
+    h2->kind = BH_CONN_H2;
+    h2->conn = conn;
+    h2->httpd = conn->server->pdata;
+    h2->sfd = sfd;
+    h2->send_window = H2_DEFAULT_WINDOW;
+    h2->recv_window = H2_DEFAULT_WINDOW;
+    h2->peer_window = H2_DEFAULT_WINDOW;
+    h2->peer_frame_size = H2_FRAME_SIZE;
+    TAILQ_INIT(&h2->blocked);
+
+    h2->decoder = bee_hpack_new(BEE_HPACK_TABLE_SIZE);
+    h2->encoder = bee_hpack_new(BEE_HPACK_TABLE_SIZE);
+    if (!h2->decoder || !h2->encoder) {
+        if (h2->decoder)
+            bee_hpack_free(h2->decoder);
+        if (h2->encoder)
+            bee_hpack_free(h2->encoder);
+        free(h2);
+        return NULL;
+    }
+
+    conn->pdata = h2;
+    return h2;
+}
+
+/* The server preface: our SETTINGS, and the connection window opened up
+ * to match the streams'.
+ */
+static void
+__h2_preface(bh_h2_t *h2)
+{
+    uint8_t settings[12];
+
+    settings[0] = 0;
+    settings[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    __put32(settings + 2, BH_H2_MAX_STREAMS);
+    settings[6] = 0;
+    settings[7] = H2_SETTINGS_INITIAL_WINDOW_SIZE;
+    __put32(settings + 8, BH_H2_WINDOW_SIZE);
+    __h2_frame(h2, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+
+    __h2_window_update(h2, 0, BH_H2_WINDOW_SIZE - H2_DEFAULT_WINDOW);
+    h2->recv_window = BH_H2_WINDOW_SIZE;
+}
+
+/* A connection that opened with the client preface. */
+static enum BEE_HOOK_RESULT
+__h2_start(bee_connection_t *conn, int sfd, const char *data, size_t len)
+{
+    bh_h2_t *h2 = __h2_new(conn, sfd);
+
+    if (!h2)
+        return BEE_HOOK_CLOSED;
+
+    __h2_preface(h2);
+    __h2_input(h2, data, len);
+    return __h2_finish(h2);
+}
+
+static enum BEE_HOOK_RESULT
+__h2_recv(bh_h2_t *h2)
+{
+    char buf[65535];
+    ssize_t nr;
+
+    nr = recv(h2->sfd, buf, sizeof(buf), 0);
+    if (nr < 0) {
+        if (errno == EAGAIN)
+            return BEE_HOOK_EAGAIN;
+        return BEE_HOOK_CLOSED;
+    }
+    else if (nr == 0)
+        return BEE_HOOK_PEER_CLOSED;
+
+    __h2_input(h2, buf, nr);
+    return __h2_finish(h2);
+}
+
+static int
+__base64url_value(char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+    if (c == '-' || c == '+')
+        return 62;
+    if (c == '_' || c == '/')
+        return 63;
+    return -1;
+}
+
+/* Decodes unpadded base64url, as in HTTP2-Settings. */
+static int
+__base64url_decode(const char *in, uint8_t *out, size_t cap)
+{
+    uint32_t bits = 0;
+    size_t n = 0;
+    int nbits = 0, v;
+
+    for (; *in != '\0' && *in != '='; in++) {
+        v = __base64url_value(*in);
+        if (v < 0)
+            return -1;
+        bits = bits << 6 | v;
+        nbits += 6;
+        if (nbits >= 8) {
+            nbits -= 8;
+            if (n == cap)
+                return -1;
+            out[n++] = bits >> nbits;
+        }
+    }
+    return n;
+}
+
+/* An "Upgrade: h2c" request also carries HTTP2-Settings. One with a body
+ * is served as HTTP/1.1, which the client has to accept.
+ */
+static int
+__h2c_requested(const bh_request_t *request)
+{
+    const char *upgrade = bh_request_get_header(request, BH_HDR_UPGRADE);
+    const char *length = bh_request_get_header(request, BH_HDR_CONTENT_LENGTH);
+
+    if (request->body_len > 0 || bh_request_get_header(request, BH_HDR_TRANSFER_ENCODING) != NULL ||
+        (length != NULL && strtoull(length, NULL, 10) > 0))
+        return 0;
+
+    return upgrade != NULL && strncasecmp(upgrade, "h2c", 3) == 0 &&
+           (upgrade[3] == '\0' || upgrade[3] == ',' || upgrade[3] == ' ') &&
+           bh_request_find_header(request, "HTTP2-Settings") != NULL;
+}
+
+/* Switches to HTTP/2 after an h2c upgrade request; the request itself is
+ * answered on stream 1 and `rest' holds what followed it.
+ */
+static enum BEE_HOOK_RESULT
+__h2_upgrade(bee_connection_t *conn, int sfd, bh_request_t *request, const char *rest, size_t rest_len)
+{
+    static const char switching[] =
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Connection: Upgrade\r\n"
+        "Upgrade: h2c\r\n"
+        "\r\n";
+    const char *encoded = bh_request_find_header(request, "HTTP2-Settings");
+    struct bh_h2_stream *stream;
+    uint8_t settings[256];
+    bh_h2_t *h2;
+    int len;
+
+    len = __base64url_decode(encoded, settings, sizeof(settings));
+    h2 = len >= 0 && len % 6 == 0 ? __h2_new(conn, sfd) : NULL;
+    if (!h2) {
+        __http_request_free(request);
+        return BEE_HOOK_CLOSED;
+    }
+
+    memcpy(__h2_reserve(h2, sizeof(switching) - 1), switching, sizeof(switching) - 1);
+    __h2_preface(h2);
+
+    stream = __h2_stream_new(h2, 1);
+    stream->request = request;
+    stream->parser.data = request;
+    stream->remote_closed = 1;
+
+    /* acknowledged by the 101 itself */
+    if (__h2_settings(h2, settings, len) < 0)
+        return __h2_finish(h2);
+
+    __h2_dispatch(h2, stream);
+
+    if (rest_len > 0)
+        __h2_input(h2, rest, rest_len);
+    return __h2_finish(h2);
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Bee server callbacks                                                      */
+/*---------------------------------------------------------------------------*/
+/* on_close hook of the http server */
+static enum BEE_HOOK_RESULT
+http_close(int sfd, void *arg)
+{
+    bee_connection_t *conn = arg;
+    void *pdata = conn->pdata;
+
+    if (pdata == NULL)
+        return BEE_HOOK_OK;
+
+    conn->pdata = NULL;
+    if (*(int *)pdata == BH_CONN_H2)
+        __h2_free(pdata);
+    else
+        __stream_detach(pdata);
+    return BEE_HOOK_OK;
+}
+
+/* on_drain hook of the http server: the output queued on `conn' went out */
+static enum BEE_HOOK_RESULT
+http_drain(int sfd, void *arg)
+{
+    bee_connection_t *conn = arg;
+    void *pdata = conn->pdata;
+
+    if (pdata == NULL)
+        return BEE_HOOK_OK;
+    if (*(int *)pdata == BH_CONN_H2)
+        return __h2_finish(pdata);
+    return __stream_drain(pdata);
+}
+
+/* on_shutdown hook of the http server: it began to drain */
+static enum BEE_HOOK_RESULT
+http_shutdown(int sfd, void *arg)
+{
+    bee_connection_t *conn = arg;
+    bh_h2_t *h2 = conn->pdata;
+
+    if (h2 == NULL || h2->kind != BH_CONN_H2 || h2->goaway)
+        return BEE_HOOK_OK;
+
+    __h2_send_goaway(h2, H2_NO_ERROR);
+    return __h2_finish(h2);
+}
+
+static void
+__http_reject(bee_connection_t *conn, int status)
+{
+    size_t len;
+    const char *response = __reject_response(status, &len);
+
+    if (bee_conn_write(conn, response, len) < 0)
+        perror("bee_conn_write");
+}
+
+enum BEE_HOOK_RESULT http_recv(int sfd, void *arg)
+{
+    bee_connection_t *conn = arg;
+    bh_server_t *httpd = conn->server->pdata;
+    bh_request_t *request;
+    http_parser parser;
+    char buf[65535];
+    ssize_t nparsed = 0, nr = 0;
+    size_t off = 0, req_len;
+    unsigned int probe;
+    int keepalive;
+
+    /* an HTTP/2 connection; a streamed response has the connection paused */
+    if (conn->pdata != NULL) {
+        if (*(int *)conn->pdata == BH_CONN_H2)
+            return __h2_recv(conn->pdata);
+        return BEE_HOOK_OK;
+    }
+
+    memset(buf, 0, sizeof(buf));
+    nr = recv(sfd, buf, sizeof(buf), 0);
+    if (nr < 0) {
+        if (errno == EAGAIN)
+            return BEE_HOOK_EAGAIN;
+        perror("recv");
+        return BEE_HOOK_ERR;
+    }
+    else if (nr == 0)
+        return BEE_HOOK_PEER_CLOSED;
+
+    /* "PRI * HTTP/2.0": a client that knows we speak HTTP/2 */
+    if (memcmp(buf, H2_PREFACE, (size_t)nr < H2_PREFACE_LEN ? (size_t)nr : H2_PREFACE_LEN) == 0)
+        return __h2_start(conn, sfd, buf, nr);
+
+    /* probes are answered before parsing, routing or rate limits, and
+     * keep the connection for the next one if the client does
+     */
+    while (httpd->probes && (probe = __probe_request(httpd, buf + off, nr - off, &req_len, &keepalive)) != 0) {
+        __http_probe(conn, probe);
+        off += req_len;
+        if (!keepalive)
+            return BEE_HOOK_CLOSED;
+        if (off == (size_t)nr)
+            return BEE_HOOK_OK;
+    }
+    if (off > 0) {
+        memmove(buf, buf + off, nr - off);
+        nr -= off;
+        buf[nr] = '\0';
+    }
+
+    /* a client over its rate is answered before anything is parsed */
+    if (httpd->ratelimit != NULL && bee_ratelimit_take(httpd->ratelimit, &conn->saddr) < 0) {
+        ++httpd->limited;
+        __http_reject(conn, 429);
+        return BEE_HOOK_CLOSED;
+    }
+
+    request = __http_request_new();
+    if (request == NULL)
+        return BEE_HOOK_ERR;
+
+    request->limits = &httpd->limits;
+    http_parser_init(&parser, HTTP_REQUEST);
+    parser.data = request;
+    nparsed = http_parser_execute(&parser, &httpd->parser_settings, buf, nr);
+    if (request->reject) {
+        __http_reject(conn, request->reject);
+        __http_request_free(request);
+        return BEE_HOOK_CLOSED;
+    }
+    else if (parser.upgrade && __h2c_requested(request)) {
+        /* the request becomes stream 1, anything after it is HTTP/2 */
+        return __h2_upgrade(conn, sfd, request, buf + nparsed, nr - nparsed);
+    }
+    else if (nparsed < nr)
+        fprintf(stderr, "parse error.\n");
+    else if (request->url != NULL &&
+             (probe = __probe_route(httpd, request->url, strcspn(request->url, "?#"))) != 0)
+        __http_probe(conn, probe);
+    else {
+        /* handle the http request */
+        bh_callback_t *callback = __http_route(httpd, request);
+
+        if (callback != NULL)
+            ++callback->requests;
+
+        if (callback == NULL) {
+            ++httpd->not_found;
+            if (bee_conn_write(conn, NOTFOUND_RESPONSE, sizeof(NOTFOUND_RESPONSE) - 1) < 0)
+                perror("bee_conn_write");
+        }
+        else if (callback->ratelimit != NULL && bee_ratelimit_take(callback->ratelimit, &conn->saddr) < 0) {
+            ++callback->limited;
+            __http_reject(conn, 429);
+        }
+        else if (callback->pool == NULL) {
+            /* the reply leaves in one write, however it was pieced together */
+            http_current = conn;
+            bee_conn_cork(conn);
+            callback->cb(sfd, request);
+            bee_conn_uncork(conn);
+            http_current = NULL;
+        }
+        else {
+            /* the connection is closed once the pool job completes */
+            if (__http_offload(conn, sfd, 0, callback, request) == 0)
+                return BEE_HOOK_OK;
+
+            if (bee_conn_write(conn, UNAVAILABLE_RESPONSE, sizeof(UNAVAILABLE_RESPONSE) - 1) < 0)
+                perror("bee_conn_write");
+        }
+    }
+
+    __http_request_free(request);
+
+    /* a streamed response keeps the connection until bh_stream_end() */
+    if (conn->pdata != NULL)
+        return BEE_HOOK_OK;
+    return BEE_HOOK_CLOSED;
+}
+/*---------------------------------------------------------------------------*/
+
+
+/*---------------------------------------------------------------------------*/
+/* URL, query string and cookie parsing                                      */
+/*---------------------------------------------------------------------------*/
+static int
+__hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/* Decodes %XX escapes, and '+' as a space if `plus' is set, from `src' into
+ * `dst', which must hold `len' + 1 bytes. Malformed escapes are kept as
+ * they are. Returns the decoded length.
+ */
+static size_t
+__percent_decode(char *dst, const char *src, size_t len, int plus)
+{
+    size_t i = 0, o = 0;
+    int hi, lo;
+
+#ifdef __SSE2__
+    /* copy 16 bytes at a time up to the next escape */
+    const __m128i pct = _mm_set1_epi8('%');
+    const __m128i sp = _mm_set1_epi8(plus ? '+' : '%');
+
+    while (len - i >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, pct), _mm_cmpeq_epi8(v, sp)));
+
+        /* safe: o <= i, so at most `len' bytes of dst are touched */
+        _mm_storeu_si128((__m128i *)(dst + o), v);
+        if (mask == 0) {
+            i += 16;
+            o += 16;
+            continue;
+        }
+
+        i += __builtin_ctz(mask);
+        o += __builtin_ctz(mask);
+        if (src[i] == '+') {
+            dst[o++] = ' ';
+            i++;
+        } else if (i + 2 < len && (hi = __hex_value(src[i + 1])) >= 0 && (lo = __hex_value(src[i + 2])) >= 0) {
+            dst[o++] = (char)(hi << 4 | lo);
+            i += 3;
+        } else
+            dst[o++] = src[i++];
+    }
+#endif
+
+    while (i < len) {
+        if (plus && src[i] == '+') {
+            dst[o++] = ' ';
+            i++;
+        } else if (src[i] == '%' && i + 2 < len &&
+                   (hi = __hex_value(src[i + 1])) >= 0 && (lo = __hex_value(src[i + 2])) >= 0) {
+            dst[o++] = (char)(hi << 4 | lo);
+            i += 3;
+        } else
+            dst[o++] = src[i++];
+    }
+
+    dst[o] = '\0';
+    return o;
+}
+
+static char *
+__request_decode(bh_request_t *request, const char *s, size_t len, int plus, size_t *out_len)
+{
+    char *decoded = bh_request_alloc(request, len + 1);
+
+    if (decoded != NULL)
+        *out_len = __percent_decode(decoded, s, len, plus);
+    return decoded;
+}
+
+static void
+__request_parse_url(bh_request_t *request)
+{
+    struct http_parser_url u;
+    const char *url = request->url;
+    size_t len;
+    int is_connect;
+
+    request->parsed |= BH_PARSED_URL;
+    if (url == NULL)
+        return;
+
+    http_parser_url_init(&u);
+    is_connect = request->method != NULL && strcmp(request->method, "CONNECT") == 0;
+    if (http_parser_parse_url(url, strlen(url), is_connect, &u) != 0)
+        return;
+
+    if (u.field_set & (1 << UF_PATH))
+        request->path = __request_decode(request, url + u.field_data[UF_PATH].off,
+                                         u.field_data[UF_PATH].len, 0, &len);
+    if (u.field_set & (1 << UF_QUERY))
+        request->query = __request_strndup(request, url + u.field_data[UF_QUERY].off,
+                                           u.field_data[UF_QUERY].len);
+    if (u.field_set & (1 << UF_FRAGMENT))
+        request->fragment = __request_strndup(request, url + u.field_data[UF_FRAGMENT].off,
+                                              u.field_data[UF_FRAGMENT].len);
+}
+
+/* Splits `s' at `sep' into name=value pairs appended to `params'. Names
+ * and values are trimmed of blanks if `trim' is set, and percent-decoded
+ * (form style) if `decode' is set.
+ */
+static int
+__request_parse_pairs(bh_request_t *request, const char *s, char sep, int trim, int decode,
+                      bh_param_t *params, int nparams)
+{
+    const char *end = s + strlen(s), *next, *eq, *name_end, *value;
+    size_t value_len;
+
+    for (; s < end; s = next + 1) {
+        next = memchr(s, sep, end - s);
+        if (next == NULL)
+            next = end;
+
+        if (trim) {
+            while (s < next && (*s == ' ' || *s == '\t'))
+                s++;
+        }
+        if (s == next)
+            continue;
+
+        eq = memchr(s, '=', next - s);
+        name_end = eq ? eq : next;
+        value = eq ? eq + 1 : next;
+        value_len = next - value;
+        if (trim) {
+            while (name_end > s && (name_end[-1] == ' ' || name_end[-1] == '\t'))
+                name_end--;
+            while (value_len > 0 && (*value == ' ' || *value == '\t')) {
+                value++;
+                value_len--;
+            }
+            while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t'))
+                value_len--;
+            /* cookie-value may be a quoted string */
+            if (value_len >= 2 && value[0] == '"' && value[value_len - 1] == '"') {
+                value++;
+                value_len -= 2;
+            }
+        }
+
+        if (decode) {
+            params[nparams].name = __request_decode(request, s, name_end - s, 1, &params[nparams].name_len);
+            params[nparams].value = __request_decode(request, value, value_len, 1, &params[nparams].value_len);
+        } else {
+            params[nparams].name = __request_strndup(request, s, name_end - s);
+            params[nparams].name_len = name_end - s;
+            params[nparams].value = __request_strndup(request, value, value_len);
+            params[nparams].value_len = value_len;
+        }
+        if (params[nparams].name == NULL || params[nparams].value == NULL)
+            break;
+        ++nparams;
+    }
+
+    return nparams;
+}
+
+static int
+__count_char(const char *s, char c)
+{
+    int n = 0;
+
+    while ((s = strchr(s, c)) != NULL) {
+        ++n;
+        ++s;
+    }
+    return n;
+}
+
+static void
+__request_parse_params(bh_request_t *request)
+{
+    const char *query = bh_request_query(request);
+
+    request->parsed |= BH_PARSED_PARAMS;
+    if (query == NULL)
+        return;
+
+    request->params = bh_request_alloc(request, (__count_char(query, '&') + 1) * sizeof(bh_param_t));
+    if (request->params != NULL)
+        request->nparams = __request_parse_pairs(request, query, '&', 0, 1, request->params, 0);
+}
+
+static void
+__request_parse_cookies(bh_request_t *request)
+{
+    bh_header_t *header;
+    int i, max = 0;
+
+    request->parsed |= BH_PARSED_COOKIES;
+    if (request->known[BH_HDR_COOKIE] == NULL)
+        return;
+
+    /* HTTP/1.1 clients send one Cookie header, but more are allowed */
+    for (i = 0; i < request->header_lines; i++) {
+        header = &request->headers[i];
+        if (header->value != NULL && __header_classify(header->field, header->field_len) == BH_HDR_COOKIE)
+            max += __count_char(header->value, ';') + 1;
+    }
+
+    request->cookies = bh_request_alloc(request, max * sizeof(bh_param_t));
+    if (request->cookies == NULL)
+        return;
+
+    for (i = 0; i < request->header_lines; i++) {
+        header = &request->headers[i];
+        if (header->value != NULL && __header_classify(header->field, header->field_len) == BH_HDR_COOKIE)
+            request->ncookies = __request_parse_pairs(request, header->value, ';', 1, 0,
+                                                      request->cookies, request->ncookies);
+    }
+}
+
+static const char *
+__param_lookup(const bh_param_t *params, int nparams, const char *name)
+{
+    size_t len = strlen(name);
+    int i;
+
+    for (i = 0; i < nparams; i++) {
+        if (params[i].name_len == len && memcmp(params[i].name, name, len) == 0)
+            return params[i].value;
+    }
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+
+
+/*---------------------------------------------------------------------------*/
+/* Exported functions                                                        */
+/*---------------------------------------------------------------------------*/
+static bee_server_t *
+__bh_server_attach(bee_server_t *server)
+{
+    bh_server_t * httpd;
+
+    if (!server)
+        return NULL;
+
+    httpd = calloc(1, sizeof(*httpd));
+    if (!httpd) {
+        bee_server_free(server);
+        return NULL;
+    }
+
+    httpd->parser_settings.on_message_begin = __on_message_begin;
+    httpd->parser_settings.on_url = __on_url;
+    httpd->parser_settings.on_header_field = __on_header_field;
+    httpd->parser_settings.on_header_value = __on_header_value;
+    httpd->parser_settings.on_headers_complete = __on_headers_complete;
+    httpd->parser_settings.on_body = __on_body;
+    httpd->parser_settings.on_message_complete = __on_message_complete;
+    TAILQ_INIT(&httpd->callbacks);
+    httpd->probes = BH_PROBE_HEALTH | BH_PROBE_READY;
+    httpd->ready_max_lag_ms = BH_READY_MAX_LAG_MS;
+
+    httpd->limits.max_headers = BH_DEFAULT_MAX_HEADERS;
+    httpd->limits.max_header_bytes = BH_DEFAULT_MAX_HEADER_BYTES;
+    httpd->limits.max_url = BH_DEFAULT_MAX_URL;
+    httpd->limits.max_body = BH_DEFAULT_MAX_BODY;
+
+    server->pdata = httpd;
+    server->on_recv = http_recv;
+    server->on_close = http_close;
+    server->on_drain = http_drain;
+    server->on_shutdown = http_shutdown;
+    server->sockopts.nodelay = 1;   /* replies are written whole, Nagle only delays them */
+
+    return server;
+}
+
+bee_server_t *
+bh_server_new(struct event_base *evbase, const char *baddr, uint16_t port, int backlog)
+{
+    return __bh_server_attach(bee_server_tcp_new(evbase, baddr, port, backlog));
+}
+
+/* Serves http on a listening socket inherited through bee_listener_recv(). */
+bee_server_t *
+bh_server_adopt(struct event_base *evbase, evutil_socket_t sfd)
+{
+    return __bh_server_attach(bee_server_tcp_adopt(evbase, sfd));
+}
+
+void
+bh_server_free(bee_server_t *server)
+{
+    bh_server_t *httpd = server->pdata;
+    bh_callback_t *callback, *tmp;
+
+    TAILQ_FOREACH_SAFE(callback, &httpd->callbacks, next, tmp) {
+        if (callback->path != NULL)
+            free(callback->path);
+
+        TAILQ_REMOVE(&httpd->callbacks, callback, next);
+        free(callback);
+    }
+
+    if (httpd->cq != NULL)
+        bee_pool_cq_free(httpd->cq);
+
+    free(httpd);
+    bee_server_free(server);
+}
+
+/* Replaces the request limits of `server'; max_headers is capped at
+ * MAX_HTTP_HEADERS, the size of bh_request_t.headers.
+ */
+void
+bh_server_set_limits(bee_server_t *server, const bh_limits_t *limits)
+{
+    bh_server_t *httpd = server->pdata;
+
+    httpd->limits = *limits;
+    if (httpd->limits.max_headers > MAX_HTTP_HEADERS || httpd->limits.max_headers < 0)
+        httpd->limits.max_headers = MAX_HTTP_HEADERS;
+}
+
+bh_callback_t *
+bh_server_set_cb(bee_server_t *server, const char *path, bh_callback_cb cb)
+{
+    bh_server_t *httpd = server->pdata;
+    bh_callback_t *callback;
+
+    callback = calloc(1, sizeof(*callback));
+    if (!callback)
+        return NULL;
+
+    callback->path = strdup(path);
+    callback->cb = cb;
+    TAILQ_INSERT_TAIL(&httpd->callbacks, callback, next);
+
+    return callback;
+}
+
+/* Like bh_server_set_cb(), but `cb' runs on a worker of `pool' so that a
+ * slow handler does not block the other connections of the event loop.
+ */
+bh_callback_t *
+bh_server_set_cb_pool(bee_server_t *server, const char *path, bh_callback_cb cb, bee_pool_t *pool)
+{
+    bh_server_t *httpd = server->pdata;
+    bh_callback_t *callback;
+
+    if (httpd->cq == NULL) {
+        httpd->cq = bee_pool_cq_new(server->evbase);
+        if (!httpd->cq)
+            return NULL;
+    }
+
+    callback = bh_server_set_cb(server, path, cb);
+    if (!callback)
+        return NULL;
+
+    callback->pool = pool;
+    return callback;
+}
+
+/* Limits the requests of each client address, HTTP/2 streams included;
+ * one over the limit is answered with 429. `rl' stays the caller's.
+ */
+void
+bh_server_set_ratelimit(bee_server_t *server, bee_ratelimit_t *rl)
+{
+    bh_server_t *httpd = server->pdata;
+
+    httpd->ratelimit = rl;
+}
+
+/* A limit of the route alone, checked after the server's. */
+void
+bh_callback_set_ratelimit(bh_callback_t *callback, bee_ratelimit_t *rl)
+{
+    callback->ratelimit = rl;
+}
+
+/* Chooses the built-in routes of `server' (BH_PROBE_*; /healthz and
+ * /readyz by default) and the average loop lag at which /readyz starts to
+ * fail, if the server has a bee_monitor_t. 0 turns that check off.
+ */
+void
+bh_server_set_probes(bee_server_t *server, unsigned int probes, int ready_max_lag_ms)
+{
+    bh_server_t *httpd = server->pdata;
+
+    httpd->probes = probes;
+    httpd->ready_max_lag_ms = ready_max_lag_ms;
+}
+
+/* A request not tied to a connection, e.g. to feed a handler in a test.
+ * Fill it by running http_parser_execute() with the server's
+ * parser_settings and `parser.data' set to the request.
+ */
+bh_request_t *
+bh_request_new(void)
+{
+    return __http_request_new();
+}
+
+void
+bh_request_free(bh_request_t *request)
+{
+    __http_request_free(request);
+}
+
+/* Allocates `size' bytes, aligned to 16, that stay valid until the request
+ * is freed after its response was queued. Handlers can use it as scratch
+ * memory for building the response; there is nothing to free.
+ */
+void *
+bh_request_alloc(bh_request_t *request, size_t size)
+{
+    struct bh_arena *chunk = request->arena;
+    size_t pad = 0;
+    char *p;
+
+    if (chunk != NULL)
+        pad = -(uintptr_t)(chunk->data + chunk->used) & (ARENA_ALIGN - 1);
+
+    if (chunk == NULL || chunk->size - chunk->used < size + pad) {
+        size_t chunk_size = ARENA_CHUNK_SIZE;
+
+        /* double with every chunk so that large requests take few */
+        if (chunk != NULL && chunk->size >= ARENA_CHUNK_SIZE)
+            chunk_size = chunk->size * 2;
+        if (chunk_size < size + ARENA_ALIGN)
+            chunk_size = size + ARENA_ALIGN;
+
+        chunk = malloc(sizeof(*chunk) + chunk_size);
+        if (!chunk)
+            return NULL;
+        chunk->next = request->arena;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        request->arena = chunk;
+        pad = -(uintptr_t)chunk->data & (ARENA_ALIGN - 1);
+    }
+
+    p = chunk->data + chunk->used + pad;
+    chunk->used += size + pad;
+    return p;
+}
+
+/* Returns the value of a well-known header, or NULL if the request did not
+ * carry it. With repeated headers this is the first one.
+ */
+const char *
+bh_request_get_header(const bh_request_t *request, enum BH_HEADER_ID id)
+{
+    if ((unsigned int)id >= BH_HDR_MAX || request->known[id] == NULL)
+        return NULL;
+
+    return request->known[id]->value;
+}
+
+/* Case-insensitive lookup of any header by name. */
+const char *
+bh_request_find_header(const bh_request_t *request, const char *field)
+{
+    size_t len = strlen(field);
+    enum BH_HEADER_ID id = __header_classify(field, len);
+    int i;
+
+    if (id != BH_HDR_MAX)
+        return bh_request_get_header(request, id);
+
+    for (i = 0; i < request->header_lines; i++) {
+        if (request->headers[i].field_len == len &&
+            strncasecmp(request->headers[i].field, field, len) == 0)
+            return request->headers[i].value;
+    }
+
+    return NULL;
+}
+
+/* The accessors below parse on first use and cache the result on the
+ * request; the strings live until the request is freed.
+ */
+
+/* Returns the percent-decoded path, or NULL if the URL has none. */
+const char *
+bh_request_path(bh_request_t *request)
+{
+    if (!(request->parsed & BH_PARSED_URL))
+        __request_parse_url(request);
+    return request->path;
+}
+
+/* Returns the raw query string without '?', or NULL. */
+const char *
+bh_request_query(bh_request_t *request)
+{
+    if (!(request->parsed & BH_PARSED_URL))
+        __request_parse_url(request);
+    return request->query;
+}
+
+const char *
+bh_request_fragment(bh_request_t *request)
+{
+    if (!(request->parsed & BH_PARSED_URL))
+        __request_parse_url(request);
+    return request->fragment;
+}
+
+/* Returns the decoded query parameters in order of appearance. */
+const bh_param_t *
+bh_request_params(bh_request_t *request, int *count)
+{
+    if (!(request->parsed & BH_PARSED_PARAMS))
+        __request_parse_params(request);
+    *count = request->nparams;
+    return request->params;
+}
+
+/* Returns the value of the first query parameter called `name', or NULL. */
+const char *
+bh_request_get_param(bh_request_t *request, const char *name)
+{
+    if (!(request->parsed & BH_PARSED_PARAMS))
+        __request_parse_params(request);
+    return __param_lookup(request->params, request->nparams, name);
+}
+
+const bh_param_t *
+bh_request_cookies(bh_request_t *request, int *count)
+{
+    if (!(request->parsed & BH_PARSED_COOKIES))
+        __request_parse_cookies(request);
+    *count = request->ncookies;
+    return request->cookies;
+}
+
+const char *
+bh_request_get_cookie(bh_request_t *request, const char *name)
+{
+    if (!(request->parsed & BH_PARSED_COOKIES))
+        __request_parse_cookies(request);
+    return __param_lookup(request->cookies, request->ncookies, name);
+}
+
+
+/* Starts a chunked 200 response on the connection of the request being
+ * handled, instead of bh_send_reply(). The connection stays open after
+ * the callback returns, and `on_drain' is called from the event loop
+ * whenever less than the low watermark is waiting to be sent: write more
+ * then, until bh_stream_write() returns 1, and finish with bh_stream_end().
+ * Only for HTTP/1.x requests whose callbacks run on the event loop, not
+ * on a pool.
+ */
+bh_stream_t *
+bh_stream_new(int sfd, const char *content_type, bh_stream_cb on_drain, void *arg)
+{
+    bee_connection_t *conn = http_current;
+    bh_stream_t *stream;
+    char head[256];
+    int len;
+
+    if (conn == NULL || conn->pdata != NULL || offload_current != NULL || conn->sfd != sfd) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: %s\r\n"
+                   "Transfer-Encoding: chunked\r\n"
+                   "\r\n", content_type);
+    if (len >= (int)sizeof(head)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    stream = calloc(1, sizeof(*stream));
+    if (!stream)
+        return NULL;
+    stream->kind = BH_CONN_STREAM;
+
+    if (bee_conn_write(conn, head, len) < 0) {
+        free(stream);
+        return NULL;
+    }
+
+    stream->conn = conn;
+    stream->low_wm = BH_STREAM_LOW_WATERMARK;
+    stream->high_wm = BH_STREAM_HIGH_WATERMARK;
+    stream->on_drain = on_drain;
+    stream->arg = arg;
+    stream->wrote = 1;
+
+    /* nothing more is read from the connection while it streams */
+    conn->pdata = stream;
+    bee_connection_pause(conn);
+    bee_conn_set_lowat(conn, stream->low_wm);
+    bee_conn_want_drain(conn);
+
+    return stream;
+}
+
+void
+bh_stream_set_watermarks(bh_stream_t *stream, size_t low, size_t high)
+{
+    stream->low_wm = low;
+    stream->high_wm = high > low ? high : low;
+    if (stream->conn != NULL)
+        bee_conn_set_lowat(stream->conn, low);
+}
+
+/* Queues `len' bytes of body. Small writes are coalesced into chunks of up
+ * to BH_STREAM_CHUNK_SIZE. Returns 0, 1 if the producer should stop until
+ * the next on_drain, or -1 if the connection is gone.
+ */
+int
+bh_stream_write(bh_stream_t *stream, const void *data, size_t len)
+{
+    struct bh_stream_block *block;
+    char line[sizeof(size_t) * 2 + 3];  /* any size in hex, CRLF and NUL */
+    struct iovec iov[3];
+    size_t take;
+
+    if (stream->conn == NULL || stream->ended)
+        return -1;
+    if (len == 0)
+        return 0;
+
+    stream->wrote = 1;
+
+    if (len >= BH_STREAM_CHUNK_SIZE) {
+        /* big enough to be a chunk of its own */
+        iov[0].iov_base = line;
+        iov[0].iov_len = snprintf(line, sizeof(line), "%zx\r\n", len);
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len = len;
+        iov[2].iov_base = "\r\n";
+        iov[2].iov_len = 2;
+
+        if (__stream_seal_pending(stream) < 0 || bee_conn_writev(stream->conn, iov, 3) < 0)
+            return -1;
+    } else {
+        while (len > 0) {
+            block = stream->pending;
+            if (block == NULL) {
+                block = __stream_block_new(STREAM_CHUNK_HDR + BH_STREAM_CHUNK_SIZE + 2);
+                if (!block)
+                    return -1;
+                stream->pending = block;
+            }
+
+            take = block->cap - 2 - block->len;
+            if (take > len)
+                take = len;
+            memcpy(block->data + block->len, data, take);
+            block->len += take;
+            data = (const char *)data + take;
+            len -= take;
+
+            if (block->len == block->cap - 2 && __stream_seal_pending(stream) < 0)
+                return -1;
+        }
+    }
+
+    bee_conn_want_drain(stream->conn);
+    return bee_conn_pending(stream->conn) >= stream->high_wm ? 1 : 0;
+}
+
+/* Finishes the response. The stream must not be used afterwards; it is
+ * released once the last chunk is sent, together with the connection.
+ */
+void
+bh_stream_end(bh_stream_t *stream)
+{
+    if (stream->ended)
+        return;
+
+    stream->ended = 1;
+    if (stream->conn == NULL) {
+        __stream_free(stream);
+        return;
+    }
+
+    /* the connection is closed from http_drain(), never under the caller */
+    if (__stream_seal_pending(stream) < 0 || bee_conn_write(stream->conn, "0\r\n\r\n", 5) < 0)
+        perror("bee_conn_write");
+    bee_conn_want_drain(stream->conn);
+}
+
+
+void bh_send_reply(int sfd, const char *content_type, const char *body, int body_len)
+{
+    int len = 0;
+    int total = body_len + 128;
+    char *buf = calloc(sizeof(char), total);
+
+    len += snprintf(buf+len, total-len, "HTTP/1.1 200 OK\r\n");
+    len += snprintf(buf+len, total-len, "Content-Type: %s\r\n", content_type);
+    len += snprintf(buf+len, total-len, "Content-Length: %d\r\n", body_len);
+    len += snprintf(buf+len, total-len, "\r\n");
+    memcpy(buf+len, body, body_len);    /* may be binary */
+    len += body_len;
+
+    __http_write(sfd, buf, len);
 
     free(buf);
 }
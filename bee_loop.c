@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include "bee.h"
+#include "bee_loop.h"
+
+
+typedef struct {
+    atomic_size_t               seq;
+    bee_loop_fn                 fn;
+    bee_loop_conn_fn            conn_fn;
+    void                      * arg;
+    bee_server_t              * server;     /* set for bee_connection_post() */
+    bee_conn_handle_t           handle;
+} bee_loop_cell_t;
+
+/* A bounded MPSC ring: producers claim cells with a CAS on `enqueue_pos',
+ * the loop thread consumes them in order. Each cell's sequence number
+ * tells whether it is free, published or still being written.
+ */
+struct bee_loop {
+    struct event_base         * evbase;
+    struct event              * ev;
+    int                         efd;
+    size_t                      mask;
+    bee_loop_cell_t           * cells;
+    atomic_int                  signaled;
+    atomic_size_t               enqueue_pos;
+    size_t                      dequeue_pos;
+};
+
+
+static int
+__loop_push(bee_loop_t *loop, bee_loop_fn fn, bee_loop_conn_fn conn_fn, void *arg,
+            bee_server_t *server, bee_conn_handle_t handle)
+{
+    bee_loop_cell_t *cell;
+    size_t pos, seq;
+    intptr_t dif;
+    uint64_t one = 1;
+
+    pos = atomic_load_explicit(&loop->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        cell = &loop->cells[pos & loop->mask];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&loop->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        else
+            pos = atomic_load_explicit(&loop->enqueue_pos, memory_order_relaxed);
+    }
+
+    cell->fn = fn;
+    cell->conn_fn = conn_fn;
+    cell->arg = arg;
+    cell->server = server;
+    cell->handle = handle;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    /* only the first post after the loop started draining wakes it up */
+    if (atomic_exchange(&loop->signaled, 1) == 0) {
+        if (write(loop->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("write");
+    }
+
+    return 0;
+}
+
+static void
+__loop_drain(bee_loop_t *loop)
+{
+    bee_loop_cell_t *cell;
+    bee_loop_cell_t msg;
+    size_t budget = loop->mask + 1;
+
+    atomic_store(&loop->signaled, 0);
+    while (budget-- > 0) {
+        cell = &loop->cells[loop->dequeue_pos & loop->mask];
+        if (atomic_load_explicit(&cell->seq, memory_order_acquire) != loop->dequeue_pos + 1)
+            return;
+
+        msg.fn = cell->fn;
+        msg.conn_fn = cell->conn_fn;
+        msg.arg = cell->arg;
+        msg.server = cell->server;
+        msg.handle = cell->handle;
+        atomic_store_explicit(&cell->seq, loop->dequeue_pos + loop->mask + 1, memory_order_release);
+        ++loop->dequeue_pos;
+
+        if (msg.server != NULL)
+            msg.conn_fn(bee_connection_lookup(msg.server, msg.handle), msg.arg);
+        else
+            msg.fn(msg.arg);
+    }
+
+    /* give the other events a turn, then continue with the rest */
+    if (atomic_exchange(&loop->signaled, 1) == 0)
+        event_active(loop->ev, EV_READ, 0);
+}
+
+static void
+__loop_read_cb(evutil_socket_t efd, short events, void *arg)
+{
+    bee_loop_t *loop = arg;
+    uint64_t val;
+
+    if (read(efd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+        perror("read");
+
+    __loop_drain(loop);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Exported functions                                                        */
+/*---------------------------------------------------------------------------*/
+bee_loop_t *
+bee_loop_new(struct event_base *evbase, unsigned int ring_size)
+{
+    bee_loop_t *loop;
+    size_t n = 2, i;
+
+    if (!evbase || ring_size == 0)
+        return NULL;
+
+    while (n < ring_size)
+        n <<= 1;
+
+    loop = calloc(1, sizeof(*loop));
+    if (!loop)
+        return NULL;
+
+    loop->cells = calloc(n, sizeof(bee_loop_cell_t));
+    if (!loop->cells)
+        goto err;
+    for (i = 0; i < n; i++)
+        atomic_init(&loop->cells[i].seq, i);
+    loop->mask = n - 1;
+
+    loop->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->efd < 0)
+        goto err;
+
+    loop->evbase = evbase;
+    loop->ev = event_new(evbase, loop->efd, EV_READ|EV_PERSIST, __loop_read_cb, loop);
+    if (!loop->ev) {
+        close(loop->efd);
+        goto err;
+    }
+
+    event_add(loop->ev, NULL);
+    return loop;
+
+  err:
+    free(loop->cells);
+    free(loop);
+    return NULL;
+}
+
+/* Messages still queued are dropped; stop all producers first. */
+void
+bee_loop_free(bee_loop_t *loop)
+{
+    if (!loop)
+        return;
+
+    event_free(loop->ev);
+    close(loop->efd);
+    free(loop->cells);
+    free(loop);
+}
+
+struct event_base *
+bee_loop_get_base(bee_loop_t *loop)
+{
+    return loop->evbase;
+}
+
+int
+bee_loop_post(bee_loop_t *loop, bee_loop_fn fn, void *arg)
+{
+    if (!loop || !fn) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return __loop_push(loop, fn, NULL, arg, NULL, 0);
+}
+
+/* `server' must be served by the event_base of `loop'. */
+int
+bee_connection_post(bee_loop_t *loop, bee_server_t *server, bee_conn_handle_t handle, bee_loop_conn_fn fn, void *arg)
+{
+    if (!loop || !server || !fn) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return __loop_push(loop, NULL, fn, arg, server, handle);
+}
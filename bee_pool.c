@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include "bee.h"
+#include "bee_pool.h"
+
+
+typedef struct bee_pool_job     bee_pool_job_t;
+typedef struct bee_pool_worker  bee_pool_worker_t;
+
+struct bee_pool_job {
+    bee_pool_fn                         work;
+    bee_pool_fn                         done;
+    void                              * arg;
+    bee_pool_cq_t                     * cq;
+    _Atomic(bee_pool_job_t *)           next;       /* completion queue link */
+};
+
+/* Every worker owns a bounded ring of jobs. The owner takes the oldest
+ * job from the head; idle workers steal the newest one from the tail.
+ */
+struct bee_pool_worker {
+    bee_pool_t                        * pool;
+    pthread_t                           tid;
+    pthread_mutex_t                     lock;
+    bee_pool_job_t                   ** ring;
+    unsigned int                        head;
+    unsigned int                        count;
+};
+
+struct bee_pool {
+    int                                 nthreads;
+    int                                 max_pending;
+    bee_pool_worker_t                 * workers;
+    sem_t                               ready;      /* one token per queued job */
+    atomic_int                          pending;
+    atomic_uint                         next;       /* round-robin submit cursor */
+    atomic_int                          stop;
+};
+
+/* Completions are handed back through an intrusive MPSC queue; the first
+ * producer after the loop drained the queue wakes it through the eventfd.
+ */
+struct bee_pool_cq {
+    struct event_base                 * evbase;
+    struct event                      * ev;
+    int                                 efd;
+    atomic_int                          signaled;
+    _Atomic(bee_pool_job_t *)           head;
+    bee_pool_job_t                    * tail;
+    bee_pool_job_t                      stub;
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Completion queue                                                          */
+/*---------------------------------------------------------------------------*/
+static void
+__cq_push(bee_pool_cq_t *cq, bee_pool_job_t *job)
+{
+    bee_pool_job_t *prev;
+
+    atomic_store(&job->next, NULL);
+    prev = atomic_exchange(&cq->head, job);
+    atomic_store(&prev->next, job);
+}
+
+/* Returns NULL when the queue is empty or a producer is half way through
+ * __cq_push(); in the latter case that producer signals the eventfd.
+ */
+static bee_pool_job_t *
+__cq_pop(bee_pool_cq_t *cq)
+{
+    bee_pool_job_t *tail = cq->tail;
+    bee_pool_job_t *next = atomic_load(&tail->next);
+
+    if (tail == &cq->stub) {
+        if (next == NULL)
+            return NULL;
+        cq->tail = next;
+        tail = next;
+        next = atomic_load(&next->next);
+    }
+
+    if (next != NULL) {
+        cq->tail = next;
+        return tail;
+    }
+
+    if (tail != atomic_load(&cq->head))
+        return NULL;
+
+    __cq_push(cq, &cq->stub);
+    next = atomic_load(&tail->next);
+    if (next != NULL) {
+        cq->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+static void
+__cq_signal(bee_pool_cq_t *cq)
+{
+    uint64_t one = 1;
+    ssize_t nr;
+
+    if (atomic_exchange(&cq->signaled, 1) == 0) {
+        nr = write(cq->efd, &one, sizeof(one));
+        if (nr < 0 && errno != EAGAIN)
+            perror("write");
+    }
+}
+
+static void
+__cq_drain(bee_pool_cq_t *cq)
+{
+    bee_pool_job_t *job;
+
+    atomic_store(&cq->signaled, 0);
+    while ((job = __cq_pop(cq)) != NULL) {
+        if (job->done != NULL)
+            job->done(job->arg);
+        free(job);
+    }
+}
+
+static void
+__cq_read_cb(evutil_socket_t efd, short events, void *arg)
+{
+    bee_pool_cq_t *cq = arg;
+    uint64_t val;
+
+    if (read(efd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+        perror("read");
+
+    __cq_drain(cq);
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Workers                                                                   */
+/*---------------------------------------------------------------------------*/
+static bee_pool_job_t *
+__worker_pop(bee_pool_worker_t *worker, int steal)
+{
+    bee_pool_t *pool = worker->pool;
+    bee_pool_job_t *job = NULL;
+    unsigned int idx;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count > 0) {
+        if (steal) {
+            idx = (worker->head + worker->count - 1) % pool->max_pending;
+        } else {
+            idx = worker->head;
+            worker->head = (worker->head + 1) % pool->max_pending;
+        }
+        job = worker->ring[idx];
+        --worker->count;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return job;
+}
+
+static int
+__worker_push(bee_pool_worker_t *worker, bee_pool_job_t *job)
+{
+    bee_pool_t *pool = worker->pool;
+    int ret = -1;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count < (unsigned int)pool->max_pending) {
+        worker->ring[(worker->head + worker->count) % pool->max_pending] = job;
+        ++worker->count;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return ret;
+}
+
+static bee_pool_job_t *
+__worker_take(bee_pool_worker_t *worker)
+{
+    bee_pool_t *pool = worker->pool;
+    bee_pool_job_t *job;
+    int self = worker - pool->workers;
+    int i;
+
+    job = __worker_pop(worker, 0);
+    for (i = 1; job == NULL && i < pool->nthreads; i++)
+        job = __worker_pop(&pool->workers[(self + i) % pool->nthreads], 1);
+
+    return job;
+}
+
+static void *
+__worker_main(void *arg)
+{
+    bee_pool_worker_t *worker = arg;
+    bee_pool_t *pool = worker->pool;
+    bee_pool_job_t *job;
+
+    for (;;) {
+        while (sem_wait(&pool->ready) < 0 && errno == EINTR)
+            ;
+
+        /* Holding a token guarantees a queued job unless we are stopping,
+         * but a single scan can race with other thieves.
+         */
+        while ((job = __worker_take(worker)) == NULL) {
+            if (atomic_load(&pool->stop))
+                return NULL;
+            sched_yield();
+        }
+
+        job->work(job->arg);
+        atomic_fetch_sub(&pool->pending, 1);
+
+        __cq_push(job->cq, job);
+        __cq_signal(job->cq);
+    }
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Exported functions                                                        */
+/*---------------------------------------------------------------------------*/
+bee_pool_t *
+bee_pool_new(int nthreads, int max_pending)
+{
+    bee_pool_t *pool;
+    int i, started = 0;
+
+    if (nthreads <= 0 || max_pending <= 0)
+        return NULL;
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pool->nthreads = nthreads;
+    pool->max_pending = max_pending;
+    if (sem_init(&pool->ready, 0, 0) < 0) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->workers = calloc(nthreads, sizeof(bee_pool_worker_t));
+    if (!pool->workers)
+        goto err;
+
+    for (i = 0; i < nthreads; i++) {
+        bee_pool_worker_t *worker = &pool->workers[i];
+
+        worker->pool = pool;
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->ring = calloc(max_pending, sizeof(bee_pool_job_t *));
+        if (!worker->ring)
+            goto err;
+    }
+
+    for (started = 0; started < nthreads; started++) {
+        if (pthread_create(&pool->workers[started].tid, NULL, __worker_main, &pool->workers[started]) != 0)
+            goto err;
+    }
+
+    return pool;
+
+  err:
+    atomic_store(&pool->stop, 1);
+    for (i = 0; i < started; i++)
+        sem_post(&pool->ready);
+    for (i = 0; i < started; i++)
+        pthread_join(pool->workers[i].tid, NULL);
+    if (pool->workers) {
+        for (i = 0; i < nthreads; i++) {
+            pthread_mutex_destroy(&pool->workers[i].lock);
+            free(pool->workers[i].ring);
+        }
+        free(pool->workers);
+    }
+    sem_destroy(&pool->ready);
+    free(pool);
+    return NULL;
+}
+
+/* Queued jobs still run before the workers exit; their `done' callbacks
+ * are delivered the next time the owning loops drain their queues.
+ */
+void
+bee_pool_free(bee_pool_t *pool)
+{
+    int i;
+
+    if (!pool)
+        return;
+
+    atomic_store(&pool->stop, 1);
+    for (i = 0; i < pool->nthreads; i++)
+        sem_post(&pool->ready);
+    for (i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->workers[i].tid, NULL);
+
+    for (i = 0; i < pool->nthreads; i++) {
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        free(pool->workers[i].ring);
+    }
+    free(pool->workers);
+    sem_destroy(&pool->ready);
+    free(pool);
+}
+
+int
+bee_pool_pending(bee_pool_t *pool)
+{
+    return atomic_load(&pool->pending);
+}
+
+int
+bee_pool_submit(bee_pool_t *pool, bee_pool_cq_t *cq, bee_pool_fn work, bee_pool_fn done, void *arg)
+{
+    bee_pool_job_t *job;
+    unsigned int start;
+    int i;
+
+    if (!pool || !cq || !work) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (atomic_fetch_add(&pool->pending, 1) >= pool->max_pending) {
+        atomic_fetch_sub(&pool->pending, 1);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    job = calloc(1, sizeof(*job));
+    if (!job) {
+        atomic_fetch_sub(&pool->pending, 1);
+        return -1;
+    }
+
+    job->work = work;
+    job->done = done;
+    job->arg = arg;
+    job->cq = cq;
+
+    start = atomic_fetch_add(&pool->next, 1);
+    for (i = 0; i < pool->nthreads; i++) {
+        if (__worker_push(&pool->workers[(start + i) % pool->nthreads], job) == 0)
+            break;
+    }
+    assert(i < pool->nthreads);
+
+    sem_post(&pool->ready);
+    return 0;
+}
+
+
+bee_pool_cq_t *
+bee_pool_cq_new(struct event_base *evbase)
+{
+    bee_pool_cq_t *cq;
+
+    if (!evbase)
+        return NULL;
+
+    cq = calloc(1, sizeof(*cq));
+    if (!cq)
+        return NULL;
+
+    cq->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (cq->efd < 0) {
+        free(cq);
+        return NULL;
+    }
+
+    atomic_store(&cq->head, &cq->stub);
+    cq->tail = &cq->stub;
+    cq->evbase = evbase;
+    cq->ev = event_new(evbase, cq->efd, EV_READ|EV_PERSIST, __cq_read_cb, cq);
+    if (!cq->ev) {
+        close(cq->efd);
+        free(cq);
+        return NULL;
+    }
+
+    event_add(cq->ev, NULL);
+    return cq;
+}
+
+/* Must only be called once no pool can still complete jobs onto `cq'. */
+void
+bee_pool_cq_free(bee_pool_cq_t *cq)
+{
+    if (!cq)
+        return;
+
+    __cq_drain(cq);
+    event_free(cq->ev);
+    close(cq->efd);
+    free(cq);
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include "bee_ratelimit.h"
+
+/* One client. `seq' is odd while the loop thread writes the entry, so a
+ * reader on another thread retries instead of taking a lock.
+ */
+struct bee_rl_entry {
+    atomic_uint                 seq;
+    float                       tokens;
+    uint64_t                    stamp_us;   /* last refill, 0 if the entry is free */
+    uint8_t                     addr[16];   /* IPv4 as v4-mapped IPv6 */
+};
+
+struct bee_ratelimit {
+    struct bee_rl_entry       * entries;    /* sets of BEE_RATELIMIT_WAYS */
+    uint32_t                    set_mask;
+    uint64_t                    seed;
+    double                      rate;       /* tokens per microsecond */
+    double                      burst;
+    atomic_uint_least64_t       allowed;
+    atomic_uint_least64_t       limited;
+    atomic_uint_least64_t       evicted;
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Buckets                                                                   */
+/*---------------------------------------------------------------------------*/
+static uint64_t
+__rl_now_us(void)
+{
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    /* never 0, which marks a free entry */
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + 1;
+}
+
+/* The key of `addr'; -1 for families other than IPv4 and IPv6. */
+static int
+__rl_key(const struct sockaddr *addr, uint8_t key[16])
+{
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+
+    if (addr->sa_family == AF_INET6) {
+        memcpy(key, &sin6->sin6_addr, 16);
+        return 0;
+    }
+    if (addr->sa_family != AF_INET)
+        return -1;
+
+    memset(key, 0, 10);
+    key[10] = key[11] = 0xff;
+    memcpy(key + 12, &sin->sin_addr, 4);
+    return 0;
+}
+
+/* Seeded, so that clients cannot pick addresses that share a set. */
+static uint32_t
+__rl_hash(const bee_ratelimit_t *rl, const uint8_t key[16])
+{
+    uint64_t a, b, h;
+
+    memcpy(&a, key, 8);
+    memcpy(&b, key + 8, 8);
+    h = (a ^ rl->seed) * 0x9e3779b97f4a7c15ull;
+    h = (h ^ (h >> 29) ^ b) * 0xbf58476d1ce4e5b9ull;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static struct bee_rl_entry *
+__rl_set(const bee_ratelimit_t *rl, const uint8_t key[16])
+{
+    return &rl->entries[(size_t)(__rl_hash(rl, key) & rl->set_mask) * BEE_RATELIMIT_WAYS];
+}
+
+static double
+__rl_refill(const bee_ratelimit_t *rl, double tokens, uint64_t stamp_us, uint64_t now)
+{
+    if (now > stamp_us)
+        tokens += (now - stamp_us) * rl->rate;
+    return tokens < rl->burst ? tokens : rl->burst;
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Exported functions                                                        */
+/*---------------------------------------------------------------------------*/
+bee_ratelimit_t *
+bee_ratelimit_new(uint32_t max_clients, double rate, double burst)
+{
+    bee_ratelimit_t *rl;
+    uint32_t nsets;
+
+    if (max_clients == 0 || max_clients > (1u << 30) || rate <= 0 || burst < 1)
+        return NULL;
+
+    rl = calloc(1, sizeof(*rl));
+    if (!rl)
+        return NULL;
+
+    for (nsets = 1; nsets * BEE_RATELIMIT_WAYS < max_clients; nsets *= 2)
+        ;
+    rl->entries = calloc((size_t)nsets * BEE_RATELIMIT_WAYS, sizeof(*rl->entries));
+    if (!rl->entries) {
+        free(rl);
+        return NULL;
+    }
+
+    rl->set_mask = nsets - 1;
+    rl->seed = (__rl_now_us() << 20) ^ (uint64_t)(uintptr_t)rl ^ (uint64_t)time(NULL);
+    rl->rate = rate / 1e6;
+    rl->burst = burst;
+    return rl;
+}
+
+void
+bee_ratelimit_free(bee_ratelimit_t *rl)
+{
+    if (!rl)
+        return;
+
+    free(rl->entries);
+    free(rl);
+}
+
+int
+bee_ratelimit_take(bee_ratelimit_t *rl, const struct sockaddr *addr)
+{
+    struct bee_rl_entry *set, *e, *victim;
+    uint8_t key[16];
+    uint64_t now = __rl_now_us();
+    unsigned int seq;
+    double tokens;
+    int i, ok;
+
+    if (__rl_key(addr, key) < 0)
+        return 0;
+
+    set = __rl_set(rl, key);
+    for (i = 0, e = NULL, victim = set; i < BEE_RATELIMIT_WAYS; i++) {
+        if (set[i].stamp_us != 0 && memcmp(set[i].addr, key, 16) == 0) {
+            e = &set[i];
+            break;
+        }
+        if (set[i].stamp_us < victim->stamp_us)
+            victim = &set[i];
+    }
+
+    if (e != NULL)
+        tokens = __rl_refill(rl, e->tokens, e->stamp_us, now);
+    else {
+        /* approximately the least recently used of the set makes room */
+        e = victim;
+        tokens = rl->burst;
+        if (e->stamp_us != 0)
+            atomic_fetch_add_explicit(&rl->evicted, 1, memory_order_relaxed);
+    }
+
+    ok = tokens >= 1;
+    if (ok)
+        tokens -= 1;
+
+    seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    atomic_store_explicit(&e->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(e->addr, key, 16);
+    e->tokens = (float)tokens;
+    e->stamp_us = now;
+    atomic_store_explicit(&e->seq, seq + 2, memory_order_release);
+
+    atomic_fetch_add_explicit(ok ? &rl->allowed : &rl->limited, 1, memory_order_relaxed);
+    return ok ? 0 : -1;
+}
+
+double
+bee_ratelimit_peek(const bee_ratelimit_t *rl, const struct sockaddr *addr)
+{
+    struct bee_rl_entry *set, *e;
+    uint8_t key[16], seen[16];
+    uint64_t stamp_us;
+    unsigned int seq;
+    float tokens;
+    int i;
+
+    if (__rl_key(addr, key) < 0)
+        return -1;
+
+    set = __rl_set(rl, key);
+    for (i = 0; i < BEE_RATELIMIT_WAYS; i++) {
+        e = &set[i];
+        do {
+            seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+            memcpy(seen, e->addr, 16);
+            tokens = e->tokens;
+            stamp_us = e->stamp_us;
+            atomic_thread_fence(memory_order_acquire);
+        } while ((seq & 1) || seq != atomic_load_explicit(&e->seq, memory_order_relaxed));
+
+        if (stamp_us != 0 && memcmp(seen, key, 16) == 0)
+            return __rl_refill(rl, tokens, stamp_us, __rl_now_us());
+    }
+
+    return -1;
+}
+
+void
+bee_ratelimit_stats(const bee_ratelimit_t *rl, uint64_t *allowed, uint64_t *limited, uint64_t *evicted)
+{
+    if (allowed != NULL)
+        *allowed = atomic_load_explicit(&rl->allowed, memory_order_relaxed);
+    if (limited != NULL)
+        *limited = atomic_load_explicit(&rl->limited, memory_order_relaxed);
+    if (evicted != NULL)
+        *evicted = atomic_load_explicit(&rl->evicted, memory_order_relaxed);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bee_seq.h"
+
+/* A datagram held until the ones before it arrive or are given up on */
+struct bee_seq_slot {
+    uint64_t                    seq;
+    int                         used;
+    int                         truncated;
+    int                         ifindex;
+    size_t                      len;
+    char                      * data;       /* slot_size bytes of the source's buffer */
+};
+
+struct bee_seq_source {
+    struct sockaddr_in          addr;
+    struct in_addr              group;
+    int                         started;    /* `next' is known */
+    uint64_t                    next;       /* the number delivered next */
+    uint32_t                    held;       /* used slots */
+    struct bee_seq_slot       * slots;      /* indexed by seq & mask */
+    bee_seq_stats_t             stats;
+};
+
+struct bee_seq {
+    uint32_t                    window;
+    uint32_t                    mask;
+    size_t                      slot_size;
+    int                         max_sources;
+    int                         nsources;
+    uint32_t                    nbuckets;   /* open addressing, at least 2 * max_sources */
+    struct bee_seq_source    ** table;
+    bee_seq_extract_cb          extract;
+    bee_seq_deliver_cb          deliver;
+    bee_seq_event_cb            on_event;
+    void                      * arg;
+    bee_seq_stats_t             stats;      /* of all sources */
+};
+
+#define SEQ_COUNT(seq, src, field, n)   \
+    do {                                \
+        (seq)->stats.field += (n);      \
+        (src)->stats.field += (n);      \
+    } while (0)
+
+
+/*---------------------------------------------------------------------------*/
+/* Sources                                                                   */
+/*---------------------------------------------------------------------------*/
+static uint32_t
+__source_hash(const struct sockaddr_in *addr, const struct in_addr *group)
+{
+    uint32_t h = addr->sin_addr.s_addr * 0x9e3779b1u;
+
+    h ^= ((uint32_t)addr->sin_port << 16 | addr->sin_port) * 0x85ebca6bu;
+    h ^= group->s_addr * 0xc2b2ae35u;
+    return h ^ (h >> 15);
+}
+
+/* The state of the sequence `msg' belongs to; NULL if it is new and the
+ * table is full.
+ */
+static struct bee_seq_source *
+__source_get(bee_seq_t *seq, const bee_mcast_msg_t *msg)
+{
+    struct bee_seq_source *src;
+    uint32_t i = __source_hash(&msg->source, &msg->group) & (seq->nbuckets - 1);
+    uint32_t n;
+    char *buf;
+
+    while ((src = seq->table[i]) != NULL) {
+        if (src->addr.sin_addr.s_addr == msg->source.sin_addr.s_addr &&
+            src->addr.sin_port == msg->source.sin_port &&
+            src->group.s_addr == msg->group.s_addr)
+            return src;
+        i = (i + 1) & (seq->nbuckets - 1);
+    }
+
+    if (seq->nsources >= seq->max_sources)
+        return NULL;
+
+    /* everything the source will ever need, in one go */
+    src = calloc(1, sizeof(*src) + seq->window * (sizeof(struct bee_seq_slot) + seq->slot_size));
+    if (!src)
+        return NULL;
+
+    src->addr = msg->source;
+    src->group = msg->group;
+    src->slots = (struct bee_seq_slot *)(src + 1);
+    buf = (char *)(src->slots + seq->window);
+    for (n = 0; n < seq->window; n++)
+        src->slots[n].data = buf + n * seq->slot_size;
+
+    seq->table[i] = src;
+    ++seq->nsources;
+    return src;
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Ordering                                                                  */
+/*---------------------------------------------------------------------------*/
+static void
+__seq_event(bee_seq_t *seq, struct bee_seq_source *src, enum BEE_SEQ_EVENT event,
+            uint64_t first, uint64_t count, const bee_mcast_msg_t *msg)
+{
+    if (event == BEE_SEQ_GAP) {
+        SEQ_COUNT(seq, src, gaps, 1);
+        SEQ_COUNT(seq, src, lost, count);
+    }
+    else
+        SEQ_COUNT(seq, src, duplicates, 1);
+
+    if (seq->on_event != NULL)
+        seq->on_event(msg, event, first, count, seq->arg);
+}
+
+static void
+__deliver_slot(bee_seq_t *seq, struct bee_seq_source *src, struct bee_seq_slot *slot)
+{
+    bee_mcast_msg_t msg;
+
+    msg.data = slot->data;
+    msg.len = slot->len;
+    msg.truncated = slot->truncated;
+    msg.source = src->addr;
+    msg.group = src->group;
+    msg.ifindex = slot->ifindex;
+
+    slot->used = 0;
+    --src->held;
+    SEQ_COUNT(seq, src, reordered, 1);
+    SEQ_COUNT(seq, src, delivered, 1);
+    seq->deliver(&msg, slot->seq, seq->arg);
+}
+
+/* Delivers the held datagrams that are next in line. */
+static void
+__drain(bee_seq_t *seq, struct bee_seq_source *src)
+{
+    struct bee_seq_slot *slot;
+
+    while (src->held > 0) {
+        slot = &src->slots[src->next & seq->mask];
+        if (!slot->used || slot->seq != src->next)
+            break;
+        ++src->next;
+        __deliver_slot(seq, src, slot);
+    }
+}
+
+/* Moves the source on to `upto', delivering what is held on the way and
+ * giving up on the numbers missing in between.
+ */
+static void
+__advance(bee_seq_t *seq, struct bee_seq_source *src, uint64_t upto, const bee_mcast_msg_t *msg)
+{
+    struct bee_seq_slot *slot;
+    uint64_t gap_first = 0, gap_len = 0;
+
+    while (src->next < upto) {
+        if (src->held == 0) {
+            /* nothing left to deliver: the rest is one gap */
+            if (gap_len == 0)
+                gap_first = src->next;
+            gap_len += upto - src->next;
+            src->next = upto;
+            break;
+        }
+
+        slot = &src->slots[src->next & seq->mask];
+        if (slot->used && slot->seq == src->next) {
+            if (gap_len > 0) {
+                __seq_event(seq, src, BEE_SEQ_GAP, gap_first, gap_len, msg);
+                gap_len = 0;
+            }
+            ++src->next;
+            __deliver_slot(seq, src, slot);
+            continue;
+        }
+
+        if (gap_len == 0)
+            gap_first = src->next;
+        ++gap_len;
+        ++src->next;
+    }
+
+    if (gap_len > 0)
+        __seq_event(seq, src, BEE_SEQ_GAP, gap_first, gap_len, msg);
+}
+
+static void
+__deliver_next(bee_seq_t *seq, struct bee_seq_source *src, const bee_mcast_msg_t *msg, uint64_t n)
+{
+    src->next = n + 1;
+    SEQ_COUNT(seq, src, delivered, 1);
+    seq->deliver(msg, n, seq->arg);
+    __drain(seq, src);
+}
+
+static void
+__seq_one(bee_seq_t *seq, const bee_mcast_msg_t *msg)
+{
+    struct bee_seq_source *src;
+    struct bee_seq_slot *slot;
+    uint64_t n;
+
+    ++seq->stats.received;
+    if (seq->extract(msg, &n, seq->arg) < 0 || (src = __source_get(seq, msg)) == NULL) {
+        ++seq->stats.unsequenced;
+        seq->deliver(msg, BEE_SEQ_NONE, seq->arg);
+        return;
+    }
+    ++src->stats.received;
+
+    if (!src->started) {
+        src->started = 1;
+        src->next = n;
+    }
+
+    if (n < src->next) {
+        __seq_event(seq, src, BEE_SEQ_DUP, n, 1, msg);
+        return;
+    }
+
+    /* too far ahead: make room in the window by giving up the oldest */
+    if (n - src->next >= seq->window)
+        __advance(seq, src, n - seq->window + 1, msg);
+
+    if (n == src->next) {
+        __deliver_next(seq, src, msg, n);
+        return;
+    }
+
+    slot = &src->slots[n & seq->mask];
+    if (slot->used) {
+        __seq_event(seq, src, BEE_SEQ_DUP, n, 1, msg);
+        return;
+    }
+
+    if (msg->len > seq->slot_size) {
+        /* cannot be held, so whatever is missing before it never will be */
+        SEQ_COUNT(seq, src, oversize, 1);
+        __advance(seq, src, n, msg);
+        __deliver_next(seq, src, msg, n);
+        return;
+    }
+
+    memcpy(slot->data, msg->data, msg->len);
+    slot->seq = n;
+    slot->len = msg->len;
+    slot->truncated = msg->truncated;
+    slot->ifindex = msg->ifindex;
+    slot->used = 1;
+    ++src->held;
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Exported functions                                                        */
+/*---------------------------------------------------------------------------*/
+/* Any of `window', `slot_size' and `max_sources' may be 0 for the default. */
+bee_seq_t *
+bee_seq_new(int window, size_t slot_size, int max_sources,
+            bee_seq_extract_cb extract, bee_seq_deliver_cb deliver,
+            bee_seq_event_cb on_event, void *arg)
+{
+    bee_seq_t *seq;
+
+    if (window == 0)
+        window = BEE_SEQ_WINDOW;
+    if (slot_size == 0)
+        slot_size = BEE_SEQ_SLOT_SIZE;
+    if (max_sources == 0)
+        max_sources = BEE_SEQ_MAX_SOURCES;
+
+    if (window < 0 || (window & (window - 1)) != 0 || max_sources < 0 || !extract || !deliver) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    seq = calloc(1, sizeof(*seq));
+    if (!seq)
+        return NULL;
+
+    seq->window = window;
+    seq->mask = window - 1;
+    seq->slot_size = slot_size;
+    seq->max_sources = max_sources;
+    for (seq->nbuckets = 4; seq->nbuckets < 2 * (uint32_t)max_sources; seq->nbuckets *= 2)
+        ;
+    seq->table = calloc(seq->nbuckets, sizeof(*seq->table));
+    if (!seq->table) {
+        free(seq);
+        return NULL;
+    }
+
+    seq->extract = extract;
+    seq->deliver = deliver;
+    seq->on_event = on_event;
+    seq->arg = arg;
+    return seq;
+}
+
+void
+bee_seq_free(bee_seq_t *seq)
+{
+    uint32_t i;
+
+    if (!seq)
+        return;
+
+    for (i = 0; i < seq->nbuckets; i++)
+        free(seq->table[i]);
+    free(seq->table);
+    free(seq);
+}
+
+void
+bee_seq_input(bee_seq_t *seq, const bee_mcast_msg_t *msgs, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        __seq_one(seq, &msgs[i]);
+}
+
+void
+bee_seq_mcast_cb(bee_server_t *server, const bee_mcast_msg_t *msgs, int count, void *arg)
+{
+    bee_seq_input(arg, msgs, count);
+}
+
+/* Gap events raised here carry a message without data, naming the source. */
+void
+bee_seq_flush(bee_seq_t *seq)
+{
+    struct bee_seq_source *src;
+    bee_mcast_msg_t msg;
+    uint64_t last;
+    uint32_t i, n;
+
+    for (i = 0; i < seq->nbuckets; i++) {
+        src = seq->table[i];
+        if (src == NULL || src->held == 0)
+            continue;
+
+        for (last = src->next, n = 0; n < seq->window; n++) {
+            if (src->slots[n].used && src->slots[n].seq > last)
+                last = src->slots[n].seq;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.source = src->addr;
+        msg.group = src->group;
+        __advance(seq, src, last, &msg);
+        __drain(seq, src);
+    }
+}
+
+const bee_seq_stats_t *
+bee_seq_get_stats(const bee_seq_t *seq)
+{
+    return &seq->stats;
+}
+
+/* Copies the counters of one sequence; -1 if it has not been seen. */
+int
+bee_seq_source_stats(const bee_seq_t *seq, const struct sockaddr_in *source,
+                     const struct in_addr *group, bee_seq_stats_t *stats)
+{
+    struct bee_seq_source *src;
+    uint32_t i = __source_hash(source, group) & (seq->nbuckets - 1);
+
+    while ((src = seq->table[i]) != NULL) {
+        if (src->addr.sin_addr.s_addr == source->sin_addr.s_addr &&
+            src->addr.sin_port == source->sin_port &&
+            src->group.s_addr == group->s_addr)
+        {
+            *stats = src->stats;
+            return 0;
+        }
+        i = (i + 1) & (seq->nbuckets - 1);
+    }
+
+    return -1;
+}
+/*---------------------------------------------------------------------------*/
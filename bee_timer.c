@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "bee_timer.h"
+
+#define WHEEL_BITS              8
+#define WHEEL_SIZE              (1 << WHEEL_BITS)
+#define WHEEL_MASK              (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS            4               /* 2^32 ticks */
+#define WHEEL_INDEX(j, level)   (((j) >> (WHEEL_BITS * ((level) + 1))) & WHEEL_MASK)
+
+/* Level 0 holds the timers of the next WHEEL_SIZE ticks, one slot per
+ * tick; each higher level covers WHEEL_SIZE times the span of the one
+ * below, and its slots are spread out ("cascaded") to the lower levels as
+ * `jiffies' reaches them. Slots are singly linked lists with a back
+ * pointer to the previous link, so a timer unlinks itself in O(1).
+ */
+struct bee_timer_wheel {
+    struct event_base         * evbase;
+    struct event              * tick_ev;
+    int                         armed;      /* tick_ev is pending */
+    clockid_t                   clock;
+    uint64_t                    res_ns;
+    uint64_t                    start_ns;
+    uint64_t                    jiffies;    /* the next tick to run */
+    uint64_t                    count;      /* pending timers */
+    bee_timer_t               * slots[WHEEL_LEVELS][WHEEL_SIZE];
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Wheel                                                                     */
+/*---------------------------------------------------------------------------*/
+static uint64_t
+__wheel_now(const bee_timer_wheel_t *wheel)
+{
+    struct timespec ts;
+
+    clock_gettime(wheel->clock, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec - wheel->start_ns) / wheel->res_ns;
+}
+
+static void
+__timer_link(bee_timer_wheel_t *wheel, bee_timer_t *timer)
+{
+    uint64_t expire = timer->expire;
+    uint64_t delta;
+    bee_timer_t **head;
+    int level;
+
+    if (expire < wheel->jiffies)
+        expire = wheel->jiffies;
+    delta = expire - wheel->jiffies;
+    if (delta > UINT32_MAX) {
+        delta = UINT32_MAX;
+        expire = wheel->jiffies + delta;
+        timer->expire = expire;
+    }
+
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < (1ull << (WHEEL_BITS * (level + 1))))
+            break;
+    }
+    head = &wheel->slots[level][(expire >> (WHEEL_BITS * level)) & WHEEL_MASK];
+
+    timer->next = *head;
+    if (timer->next != NULL)
+        timer->next->pprev = &timer->next;
+    *head = timer;
+    timer->pprev = head;
+}
+
+static void
+__timer_unlink(bee_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/* Moves the timers of a slot of `level' down to where they belong now. */
+static int
+__wheel_cascade(bee_timer_wheel_t *wheel, int level, int index)
+{
+    bee_timer_t *timer = wheel->slots[level][index], *next;
+
+    wheel->slots[level][index] = NULL;
+    for (; timer != NULL; timer = next) {
+        next = timer->next;
+        __timer_link(wheel, timer);
+    }
+
+    return index;
+}
+
+static void
+__wheel_tick_cb(evutil_socket_t fd, short events, void *arg)
+{
+    bee_timer_wheel_t *wheel = arg;
+    uint64_t now = __wheel_now(wheel);
+    bee_timer_t *expired, *timer;
+    int index;
+
+    while (wheel->jiffies <= now) {
+        if (wheel->count == 0) {
+            wheel->jiffies = now + 1;
+            break;
+        }
+
+        index = wheel->jiffies & WHEEL_MASK;
+        if (index == 0 &&
+            __wheel_cascade(wheel, 1, WHEEL_INDEX(wheel->jiffies, 0)) == 0 &&
+            __wheel_cascade(wheel, 2, WHEEL_INDEX(wheel->jiffies, 1)) == 0)
+            __wheel_cascade(wheel, 3, WHEEL_INDEX(wheel->jiffies, 2));
+        ++wheel->jiffies;
+
+        /* off the wheel first, the callbacks may add and cancel timers */
+        expired = wheel->slots[0][index];
+        wheel->slots[0][index] = NULL;
+        if (expired != NULL)
+            expired->pprev = &expired;
+
+        while ((timer = expired) != NULL) {
+            __timer_unlink(timer);
+            --wheel->count;
+            timer->cb(timer, timer->arg);
+        }
+    }
+
+    if (wheel->count == 0 && wheel->armed) {
+        event_del(wheel->tick_ev);
+        wheel->armed = 0;
+    }
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Exported functions                                                        */
+/*---------------------------------------------------------------------------*/
+bee_timer_wheel_t *
+bee_timer_wheel_new(struct event_base *evbase, unsigned int resolution_ms)
+{
+    bee_timer_wheel_t *wheel;
+    struct timespec ts;
+
+    if (!evbase || resolution_ms == 0)
+        return NULL;
+
+    wheel = calloc(1, sizeof(*wheel));
+    if (!wheel)
+        return NULL;
+
+    wheel->tick_ev = event_new(evbase, -1, EV_PERSIST, __wheel_tick_cb, wheel);
+    if (!wheel->tick_ev) {
+        free(wheel);
+        return NULL;
+    }
+
+    wheel->evbase = evbase;
+    wheel->res_ns = (uint64_t)resolution_ms * 1000000;
+    wheel->clock = CLOCK_MONOTONIC;
+#ifdef CLOCK_MONOTONIC_COARSE
+    if (resolution_ms >= BEE_TIMER_COARSE_MS)
+        wheel->clock = CLOCK_MONOTONIC_COARSE;
+#endif
+    clock_gettime(wheel->clock, &ts);
+    wheel->start_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    wheel->jiffies = 1;
+
+    return wheel;
+}
+
+void
+bee_timer_wheel_free(bee_timer_wheel_t *wheel)
+{
+    bee_timer_t *timer, *next;
+    int level, i;
+
+    if (!wheel)
+        return;
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        for (i = 0; i < WHEEL_SIZE; i++) {
+            for (timer = wheel->slots[level][i]; timer != NULL; timer = next) {
+                next = timer->next;
+                timer->next = NULL;
+                timer->pprev = NULL;
+            }
+        }
+    }
+
+    event_free(wheel->tick_ev);
+    free(wheel);
+}
+
+uint64_t
+bee_timer_wheel_count(const bee_timer_wheel_t *wheel)
+{
+    return wheel->count;
+}
+
+void
+bee_timer_init(bee_timer_t *timer, bee_timer_cb cb, void *arg)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->cb = cb;
+    timer->arg = arg;
+}
+
+/* The timer fires on the first tick that starts at least `ms' from now,
+ * so between `ms' and `ms' plus two ticks later.
+ */
+void
+bee_timer_add(bee_timer_wheel_t *wheel, bee_timer_t *timer, uint64_t ms)
+{
+    uint64_t ticks;
+    struct timeval tv;
+
+    if (timer->pprev != NULL)
+        bee_timer_cancel(timer);
+
+    /* an empty wheel skips the ticks it slept through */
+    if (wheel->count == 0)
+        wheel->jiffies = __wheel_now(wheel);
+
+    if (ms > UINT32_MAX * (wheel->res_ns / 1000000))
+        ms = UINT32_MAX * (wheel->res_ns / 1000000);
+    ticks = (ms * 1000000 + wheel->res_ns - 1) / wheel->res_ns;
+    timer->wheel = wheel;
+    timer->expire = __wheel_now(wheel) + ticks + 1;
+    __timer_link(wheel, timer);
+    ++wheel->count;
+
+    if (!wheel->armed) {
+        tv.tv_sec = wheel->res_ns / 1000000000;
+        tv.tv_usec = (wheel->res_ns % 1000000000) / 1000;
+        event_add(wheel->tick_ev, &tv);
+        wheel->armed = 1;
+    }
+}
+
+void
+bee_timer_cancel(bee_timer_t *timer)
+{
+    if (timer->pprev == NULL)
+        return;
+
+    __timer_unlink(timer);
+    --timer->wheel->count;
+}
+
+int
+bee_timer_pending(const bee_timer_t *timer)
+{
+    return timer->pprev != NULL;
+}
+/*---------------------------------------------------------------------------*/
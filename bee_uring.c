@@ -0,0 +1,820 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include "bee.h"
+#include "bee_uring.h"
+
+#define URING_BGID              (0)
+#define URING_ZC_MIN            (16384)     /* smaller sends are cheaper to copy */
+
+#define OP_ACCEPT               (1)
+#define OP_RECV                 (2)
+#define OP_SEND                 (3)
+
+#define UD(ptr, op)             ((uint64_t)(uintptr_t)(ptr) | (op))
+#define UD_OP(ud)               ((int)((ud) & 7))
+#define UD_PTR(ud)              ((void *)(uintptr_t)((ud) & ~(uint64_t)7))
+
+#define load_acquire(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+typedef struct bee_uring_listener   bee_uring_listener_t;
+typedef struct bee_uring_send       bee_uring_send_t;
+
+struct bee_uring_listener {
+    bee_uring_t                       * ring;
+    int                                 sfd;
+    bee_uring_hook_t                    on_accept;
+    bee_uring_hook_t                    on_recv;
+    void                              * pdata;
+    TAILQ_ENTRY(bee_uring_listener)     next;
+};
+
+/* One bee_uring_send() call. Data that lives in the provided buffer being
+ * delivered is sent from there (the buffer is held), anything else is copied.
+ */
+struct bee_uring_send {
+    bee_uring_conn_t                  * conn;
+    const char                        * data;
+    size_t                              len;
+    size_t                              off;
+    char                              * owned;
+    int                                 bid;
+    int                                 notifs;     /* pending zero-copy notifications */
+    int                                 done;
+    struct bee_uring_send             * qnext;      /* conn->sendq */
+    TAILQ_ENTRY(bee_uring_send)         next;
+};
+
+struct bee_uring {
+    struct event_base                 * evbase;
+    struct event                      * ev;
+    int                                 efd;
+    int                                 fd;
+
+    void                              * sq_ptr;
+    void                              * cq_ptr;
+    size_t                              sq_sz;
+    size_t                              cq_sz;
+    unsigned int                      * sq_head;
+    unsigned int                      * sq_tail;
+    unsigned int                      * sq_mask;
+    unsigned int                      * sq_array;
+    unsigned int                      * sq_flags;
+    unsigned int                        sq_entries;
+    unsigned int                        sqe_tail;
+    unsigned int                        sqe_submitted;
+    struct io_uring_sqe               * sqes;
+    unsigned int                      * cq_head;
+    unsigned int                      * cq_tail;
+    unsigned int                      * cq_mask;
+    struct io_uring_cqe               * cqes;
+
+    struct io_uring_buf_ring          * br;
+    size_t                              br_sz;
+    char                              * bufs;
+    uint16_t                          * buf_refs;
+    unsigned int                        nbufs;
+    unsigned int                        nbufs_free;
+    unsigned int                        buf_size;
+    uint16_t                            br_tail;
+    int                                 cur_bid;    /* buffer on_recv is looking at */
+
+    int                                 zc;         /* IORING_OP_SEND_ZC supported */
+    bee_uring_conn_t                  * starved;
+    struct bee_uring_stats              stats;
+    TAILQ_HEAD(, bee_uring_listener)    listeners;
+    TAILQ_HEAD(, bee_uring_conn)        conns;
+    TAILQ_HEAD(, bee_uring_send)        sends;
+};
+
+
+/*---------------------------------------------------------------------------*/
+/* Ring plumbing                                                             */
+/*---------------------------------------------------------------------------*/
+static int
+__sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+__sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int
+__sys_io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* One io_uring_enter() for everything queued since the last one. */
+static void
+__uring_submit(bee_uring_t *ring)
+{
+    unsigned int n = ring->sqe_tail - ring->sqe_submitted;
+    unsigned int flags = 0;
+    int ret;
+
+    if (load_acquire(ring->sq_flags) & IORING_SQ_CQ_OVERFLOW)
+        flags |= IORING_ENTER_GETEVENTS;
+
+    if (n == 0 && flags == 0)
+        return;
+
+    store_release(ring->sq_tail, ring->sqe_tail);
+    ret = __sys_io_uring_enter(ring->fd, n, 0, flags);
+    ++ring->stats.enters;
+    if (ret < 0) {
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            perror("io_uring_enter");
+        return;
+    }
+    ring->sqe_submitted += ret;
+}
+
+static struct io_uring_sqe *
+__uring_get_sqe(bee_uring_t *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int idx;
+
+    if (ring->sqe_tail - load_acquire(ring->sq_head) >= ring->sq_entries) {
+        __uring_submit(ring);
+        if (ring->sqe_tail - load_acquire(ring->sq_head) >= ring->sq_entries)
+            return NULL;
+    }
+
+    idx = ring->sqe_tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ++ring->sqe_tail;
+
+    return sqe;
+}
+
+static void
+__buf_recycle(bee_uring_t *ring, int bid)
+{
+    struct io_uring_buf *buf = &ring->br->bufs[ring->br_tail & (ring->nbufs - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(ring->bufs + (size_t)bid * ring->buf_size);
+    buf->len = ring->buf_size;
+    buf->bid = bid;
+    ++ring->br_tail;
+    ++ring->nbufs_free;
+    store_release(&ring->br->tail, ring->br_tail);
+}
+
+static void
+__buf_put(bee_uring_t *ring, int bid)
+{
+    if (--ring->buf_refs[bid] == 0)
+        __buf_recycle(ring, bid);
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Connections                                                               */
+/*---------------------------------------------------------------------------*/
+static void
+__send_release(bee_uring_t *ring, bee_uring_send_t *op)
+{
+    if (op->bid >= 0)
+        __buf_put(ring, op->bid);
+    free(op->owned);
+    TAILQ_REMOVE(&ring->sends, op, next);
+    free(op);
+}
+
+static void
+__conn_maybe_free(bee_uring_conn_t *conn)
+{
+    bee_uring_t *ring = conn->ring;
+    bee_uring_send_t *op, *next;
+
+    if (!conn->shut || conn->inflight > 0 || conn->starved)
+        return;
+
+    for (op = conn->sendq; op != NULL; op = next) {
+        next = op->qnext;
+        if (op->notifs == 0)
+            __send_release(ring, op);
+        else
+            op->done = 1;
+    }
+
+    TAILQ_REMOVE(&ring->conns, conn, next);
+    close(conn->sfd);
+    free(conn);
+}
+
+static void
+__conn_shutdown(bee_uring_conn_t *conn)
+{
+    conn->closing = 1;
+    if (!conn->shut) {
+        conn->shut = 1;
+        shutdown(conn->sfd, SHUT_RDWR);
+    }
+}
+
+static void
+__conn_arm_recv(bee_uring_conn_t *conn)
+{
+    struct io_uring_sqe *sqe = __uring_get_sqe(conn->ring);
+
+    if (!sqe) {
+        __conn_shutdown(conn);
+        return;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->sfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = UD(conn, OP_RECV);
+    conn->recv_armed = 1;
+    ++conn->inflight;
+}
+
+static void
+__conn_submit_send(bee_uring_conn_t *conn, bee_uring_send_t *op)
+{
+    bee_uring_t *ring = conn->ring;
+    struct io_uring_sqe *sqe = __uring_get_sqe(ring);
+    size_t left = op->len - op->off;
+
+    if (!sqe) {
+        __conn_shutdown(conn);
+        return;
+    }
+
+    if (ring->zc && left >= URING_ZC_MIN) {
+        sqe->opcode = IORING_OP_SEND_ZC;
+        ++ring->stats.zc_sends;
+    } else {
+        sqe->opcode = IORING_OP_SEND;
+        ++ring->stats.copied_sends;
+    }
+    sqe->fd = conn->sfd;
+    sqe->addr = (uint64_t)(uintptr_t)(op->data + op->off);
+    sqe->len = left;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = UD(op, OP_SEND);
+    ++conn->inflight;
+}
+
+static void
+__conn_send_done(bee_uring_conn_t *conn, bee_uring_send_t *op)
+{
+    op->done = 1;
+    conn->sendq = op->qnext;
+    if (conn->sendq == NULL)
+        conn->sendq_tail = NULL;
+    if (op->notifs == 0)
+        __send_release(conn->ring, op);
+
+    if (conn->sendq != NULL && !conn->shut)
+        __conn_submit_send(conn, conn->sendq);
+    else if (conn->sendq == NULL && conn->closing)
+        __conn_shutdown(conn);
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Completions                                                               */
+/*---------------------------------------------------------------------------*/
+static void
+__listener_arm(bee_uring_listener_t *l)
+{
+    struct io_uring_sqe *sqe = __uring_get_sqe(l->ring);
+
+    if (!sqe) {
+        fprintf(stderr, "io_uring: no sqe to re-arm accept\n");
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = l->sfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = UD(l, OP_ACCEPT);
+}
+
+static void
+__on_accept_cqe(bee_uring_t *ring, bee_uring_listener_t *l, struct io_uring_cqe *cqe)
+{
+    bee_uring_conn_t *conn;
+    socklen_t len;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        __listener_arm(l);
+
+    if (cqe->res < 0) {
+        fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+        return;
+    }
+
+    conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+        close(cqe->res);
+        return;
+    }
+
+    conn->ring = ring;
+    conn->sfd = cqe->res;
+    conn->server_pdata = l->pdata;
+    conn->on_recv = l->on_recv;
+    len = sizeof(conn->saddr);
+    getpeername(conn->sfd, (struct sockaddr *)&conn->saddr, &len);
+    TAILQ_INSERT_TAIL(&ring->conns, conn, next);
+
+    ++conn->inflight;
+    __conn_arm_recv(conn);
+    if (l->on_accept != NULL && !conn->closing)
+        l->on_accept(conn, NULL, 0);
+    --conn->inflight;
+
+    __conn_maybe_free(conn);
+}
+
+static void
+__on_recv_cqe(bee_uring_t *ring, bee_uring_conn_t *conn, struct io_uring_cqe *cqe)
+{
+    enum BEE_HOOK_RESULT status = BEE_HOOK_OK;
+    int more = cqe->flags & IORING_CQE_F_MORE;
+    int bid;
+
+    if (!more) {
+        conn->recv_armed = 0;
+        --conn->inflight;
+    }
+
+    /* pin the connection while calling out */
+    ++conn->inflight;
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        --ring->nbufs_free;
+        ring->buf_refs[bid] = 1;
+        if (!conn->closing) {
+            ring->cur_bid = bid;
+            status = conn->on_recv(conn, ring->bufs + (size_t)bid * ring->buf_size, cqe->res);
+            ring->cur_bid = -1;
+        }
+        __buf_put(ring, bid);
+
+        if (status == BEE_HOOK_CLOSED ||
+            status == BEE_HOOK_PEER_CLOSED ||
+            status == BEE_HOOK_ERR)
+            bee_uring_close(conn);
+        else if (!more && !conn->closing)
+            __conn_arm_recv(conn);
+    }
+    else if (cqe->res == -ENOBUFS) {
+        ++ring->stats.nobufs;
+        if (!more && !conn->closing && !conn->starved) {
+            conn->starved = 1;
+            conn->next_starved = ring->starved;
+            ring->starved = conn;
+        }
+    }
+    else {
+        /* 0 is an orderly shutdown by the peer, < 0 an error */
+        if (!conn->closing)
+            conn->on_recv(conn, NULL, 0);
+        __conn_shutdown(conn);
+    }
+
+    --conn->inflight;
+    __conn_maybe_free(conn);
+}
+
+static void
+__on_send_cqe(bee_uring_t *ring, bee_uring_send_t *op, struct io_uring_cqe *cqe)
+{
+    bee_uring_conn_t *conn = op->conn;
+
+    if (cqe->flags & IORING_CQE_F_NOTIF) {
+        /* the kernel is done with the zero-copy pages */
+        --conn->inflight;
+        if (--op->notifs == 0 && op->done)
+            __send_release(ring, op);
+        __conn_maybe_free(conn);
+        return;
+    }
+
+    /* the notification, if any, keeps the sqe's reference */
+    if (cqe->flags & IORING_CQE_F_MORE)
+        ++op->notifs;
+    else
+        --conn->inflight;
+
+    ++conn->inflight;
+    if (cqe->res < 0) {
+        if ((cqe->res == -EAGAIN || cqe->res == -EINTR) && !conn->shut)
+            __conn_submit_send(conn, op);
+        else {
+            __conn_shutdown(conn);
+            __conn_send_done(conn, op);
+        }
+    }
+    else {
+        op->off += cqe->res;
+        if (op->off < op->len && !conn->shut)
+            __conn_submit_send(conn, op);
+        else
+            __conn_send_done(conn, op);
+    }
+    --conn->inflight;
+
+    __conn_maybe_free(conn);
+}
+
+static void
+__uring_process(bee_uring_t *ring)
+{
+    struct io_uring_cqe cqe;
+    bee_uring_conn_t *conn;
+    unsigned int head, tail;
+    int rounds = 4;
+
+    while (rounds-- > 0) {
+        head = *ring->cq_head;
+        tail = load_acquire(ring->cq_tail);
+        if (head == tail)
+            break;
+
+        for (; head != tail; head++) {
+            cqe = ring->cqes[head & *ring->cq_mask];
+            store_release(ring->cq_head, head + 1);
+            ++ring->stats.cqes;
+
+            switch (UD_OP(cqe.user_data)) {
+            case OP_ACCEPT:
+                __on_accept_cqe(ring, UD_PTR(cqe.user_data), &cqe);
+                break;
+            case OP_RECV:
+                __on_recv_cqe(ring, UD_PTR(cqe.user_data), &cqe);
+                break;
+            case OP_SEND:
+                __on_send_cqe(ring, UD_PTR(cqe.user_data), &cqe);
+                break;
+            }
+        }
+
+        /* buffers came back while handling the batch */
+        while (ring->starved != NULL && ring->nbufs_free > 0) {
+            conn = ring->starved;
+            ring->starved = conn->next_starved;
+            conn->starved = 0;
+            if (conn->shut)
+                __conn_maybe_free(conn);
+            else
+                __conn_arm_recv(conn);
+        }
+
+        __uring_submit(ring);
+    }
+}
+
+static void
+__uring_event_cb(evutil_socket_t efd, short events, void *arg)
+{
+    /* edge-triggered: every completion posted after this re-fires the
+     * event, so the eventfd counter never needs to be read.
+     */
+    __uring_process(arg);
+}
+/*---------------------------------------------------------------------------*/
+
+
+
+
+/*---------------------------------------------------------------------------*/
+/* Exported functions                                                        */
+/*---------------------------------------------------------------------------*/
+/* Returns NULL if the kernel lacks io_uring, multishot receive or provided
+ * buffer rings; callers then fall back to the libevent servers in bee.c.
+ * `nbufs' must be a power of two.
+ */
+bee_uring_t *
+bee_uring_new(struct event_base *evbase, unsigned int entries, unsigned int nbufs, unsigned int buf_size)
+{
+    bee_uring_t *ring;
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    struct io_uring_probe *probe;
+    size_t probe_sz;
+    unsigned int i;
+
+    if (!evbase || entries == 0 || nbufs == 0 || nbufs > 32768 || (nbufs & (nbufs - 1)) != 0)
+        return NULL;
+
+    ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+
+    ring->fd = -1;
+    ring->efd = -1;
+    ring->cur_bid = -1;
+    ring->nbufs = nbufs;
+    ring->buf_size = buf_size;
+    TAILQ_INIT(&ring->listeners);
+    TAILQ_INIT(&ring->conns);
+    TAILQ_INIT(&ring->sends);
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+    ring->fd = __sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0)
+        goto err;
+
+    ring->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_sz > ring->sq_sz)
+            ring->sq_sz = ring->cq_sz;
+        ring->cq_sz = ring->sq_sz;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto err;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ptr = ring->sq_ptr;
+    else {
+        ring->cq_ptr = mmap(NULL, ring->cq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+            goto err;
+    }
+
+    ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto err;
+
+    ring->sq_head = (unsigned int *)((char *)ring->sq_ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned int *)((char *)ring->sq_ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_flags = (unsigned int *)((char *)ring->sq_ptr + p.sq_off.flags);
+    ring->sq_array = (unsigned int *)((char *)ring->sq_ptr + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sqe_tail = ring->sqe_submitted = *ring->sq_tail;
+    ring->cq_head = (unsigned int *)((char *)ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned int *)((char *)ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + p.cq_off.cqes);
+
+    /* provided buffer ring for multishot receive */
+    ring->br_sz = nbufs * sizeof(struct io_uring_buf);
+    ring->br = mmap(NULL, ring->br_sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (ring->br == MAP_FAILED) {
+        ring->br = NULL;
+        goto err;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->br;
+    reg.ring_entries = nbufs;
+    reg.bgid = URING_BGID;
+    if (__sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        goto err;
+
+    ring->bufs = malloc((size_t)nbufs * buf_size);
+    ring->buf_refs = calloc(nbufs, sizeof(uint16_t));
+    if (!ring->bufs || !ring->buf_refs)
+        goto err;
+    for (i = 0; i < nbufs; i++)
+        __buf_recycle(ring, i);
+
+    probe_sz = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+    probe = calloc(1, probe_sz);
+    if (probe != NULL) {
+        if (__sys_io_uring_register(ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+            probe->ops_len > IORING_OP_SEND_ZC &&
+            (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED))
+            ring->zc = 1;
+        free(probe);
+    }
+
+    /* completions wake the libevent loop through an eventfd */
+    ring->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->efd < 0)
+        goto err;
+    if (__sys_io_uring_register(ring->fd, IORING_REGISTER_EVENTFD, &ring->efd, 1) < 0)
+        goto err;
+
+    ring->evbase = evbase;
+    ring->ev = event_new(evbase, ring->efd, EV_READ|EV_PERSIST|EV_ET, __uring_event_cb, ring);
+    if (!ring->ev)
+        goto err;
+
+    event_add(ring->ev, NULL);
+    return ring;
+
+  err:
+    bee_uring_free(ring);
+    return NULL;
+}
+
+void
+bee_uring_free(bee_uring_t *ring)
+{
+    bee_uring_listener_t *l;
+    bee_uring_conn_t *conn;
+    bee_uring_send_t *op;
+
+    if (!ring)
+        return;
+
+    if (ring->ev != NULL)
+        event_free(ring->ev);
+
+    /* closing the ring cancels everything still in flight */
+    if (ring->fd >= 0)
+        close(ring->fd);
+    if (ring->efd >= 0)
+        close(ring->efd);
+
+    while ((l = TAILQ_FIRST(&ring->listeners)) != NULL) {
+        TAILQ_REMOVE(&ring->listeners, l, next);
+        close(l->sfd);
+        free(l);
+    }
+    while ((conn = TAILQ_FIRST(&ring->conns)) != NULL) {
+        TAILQ_REMOVE(&ring->conns, conn, next);
+        close(conn->sfd);
+        free(conn);
+    }
+    while ((op = TAILQ_FIRST(&ring->sends)) != NULL) {
+        TAILQ_REMOVE(&ring->sends, op, next);
+        free(op->owned);
+        free(op);
+    }
+
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+    if (ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_sz);
+    if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED)
+        munmap(ring->sq_ptr, ring->sq_sz);
+    if (ring->br != NULL)
+        munmap(ring->br, ring->br_sz);
+    free(ring->bufs);
+    free(ring->buf_refs);
+    free(ring);
+}
+
+int
+bee_uring_tcp_listen(bee_uring_t *ring, const char *baddr, uint16_t port, int backlog,
+                     bee_uring_hook_t on_accept, bee_uring_hook_t on_recv, void *pdata)
+{
+    bee_uring_listener_t *l;
+    struct sockaddr_in lsock;
+    int sfd;
+
+    if (!ring || !on_recv || backlog == 0)
+        return -1;
+
+    sfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sfd < 0)
+        return -1;
+
+    if (evutil_make_listen_socket_reuseable(sfd) < 0)
+        goto err;
+
+    memset(&lsock, 0, sizeof(lsock));
+    lsock.sin_family = AF_INET;
+    lsock.sin_addr.s_addr = baddr ? inet_addr(baddr) : INADDR_ANY;
+    lsock.sin_port = htons(port);
+
+    if (bind(sfd, (struct sockaddr *)&lsock, sizeof(lsock)) < 0)
+        goto err;
+
+    if (listen(sfd, backlog > 0 ? backlog : 128) < 0)
+        goto err;
+
+    l = calloc(1, sizeof(*l));
+    if (!l)
+        goto err;
+
+    l->ring = ring;
+    l->sfd = sfd;
+    l->on_accept = on_accept;
+    l->on_recv = on_recv;
+    l->pdata = pdata;
+    TAILQ_INSERT_TAIL(&ring->listeners, l, next);
+
+    __listener_arm(l);
+    __uring_submit(ring);
+    return 0;
+
+  err:
+    close(sfd);
+    return -1;
+}
+
+/* Queues `data' behind earlier sends of `conn'. The submission itself is
+ * batched with everything else at the end of the current completion run.
+ */
+int
+bee_uring_send(bee_uring_conn_t *conn, const void *data, size_t len)
+{
+    bee_uring_t *ring = conn->ring;
+    bee_uring_send_t *op;
+    const char *cur;
+
+    if (conn->closing)
+        return -1;
+
+    if (len == 0)
+        return 0;
+
+    op = calloc(1, sizeof(*op));
+    if (!op)
+        return -1;
+
+    op->conn = conn;
+    op->len = len;
+    op->bid = -1;
+
+    cur = ring->cur_bid >= 0 ? ring->bufs + (size_t)ring->cur_bid * ring->buf_size : NULL;
+    if (cur != NULL && (const char *)data >= cur && (const char *)data + len <= cur + ring->buf_size) {
+        op->bid = ring->cur_bid;
+        ++ring->buf_refs[op->bid];
+        op->data = data;
+    } else {
+        op->owned = malloc(len);
+        if (!op->owned) {
+            free(op);
+            return -1;
+        }
+        memcpy(op->owned, data, len);
+        op->data = op->owned;
+    }
+
+    TAILQ_INSERT_TAIL(&ring->sends, op, next);
+    if (conn->sendq_tail != NULL)
+        conn->sendq_tail->qnext = op;
+    else
+        conn->sendq = op;
+    conn->sendq_tail = op;
+
+    if (conn->sendq == op) {
+        ++conn->inflight;
+        __conn_submit_send(conn, op);
+        --conn->inflight;
+        __conn_maybe_free(conn);
+    }
+
+    return 0;
+}
+
+/* Sends already queued are flushed first; the connection is freed once
+ * the kernel returned all its requests.
+ */
+void
+bee_uring_close(bee_uring_conn_t *conn)
+{
+    if (conn->closing)
+        return;
+
+    conn->closing = 1;
+    if (conn->sendq == NULL)
+        __conn_shutdown(conn);
+    __conn_maybe_free(conn);
+}
+
+void
+bee_uring_get_stats(bee_uring_t *ring, struct bee_uring_stats *stats)
+{
+    *stats = ring->stats;
+}
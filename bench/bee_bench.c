@@ -0,0 +1,664 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/* Load generator for the bee examples (tcp_echo, udp_echo, httpd, telnetd)
+ * and anything speaking the same protocols. Every thread drives its share
+ * of the connections from one epoll loop; results are printed as JSON.
+ */
+
+#define HIST_SUB_BITS       5
+#define HIST_SUB            (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS        (64 * HIST_SUB)
+#define MAX_DEPTH           256
+#define RBUF_SIZE           65536
+#define UDP_TIMEOUT_NS      1000000000ull
+
+enum bench_mode {
+    MODE_TCP,
+    MODE_UDP,
+    MODE_HTTP,
+    MODE_TELNET
+};
+
+struct options {
+    enum bench_mode     mode;
+    const char        * host;
+    uint16_t            port;
+    int                 conns;
+    int                 threads;
+    int                 duration;
+    int                 warmup;
+    int                 depth;
+    size_t              payload;
+    double              rate;           /* requests/s over all threads, 0: closed loop */
+    const char        * path;           /* http path or telnet command */
+    const char        * prompt;
+    int                 keepalive;      /* http: reuse connections */
+};
+
+typedef struct {
+    uint64_t            buckets[HIST_BUCKETS];
+    uint64_t            count;
+    uint64_t            max;
+} hist_t;
+
+typedef struct bench_conn {
+    int                 fd;
+    int                 connected;
+    int                 greeted;        /* telnet: initial prompt seen */
+    int                 outstanding;
+    int                 last;           /* http: no more requests on this connection */
+    uint64_t            sent_at[MAX_DEPTH];
+    int                 head;
+    size_t              rx_done;        /* tcp: bytes of the current echo */
+    size_t              match;          /* telnet: prompt bytes matched */
+    char              * hbuf;           /* http: response being parsed */
+    size_t              hlen;
+    long                body_left;      /* http: -1 until headers parsed */
+    char              * wbuf;           /* unsent request bytes */
+    size_t              wlen;
+    size_t              woff;
+} bench_conn_t;
+
+typedef struct {
+    pthread_t           tid;
+    int                 index;
+    int                 epfd;
+    int                 nconns;
+    bench_conn_t      * conns;
+    hist_t              hist;
+    uint64_t            requests;
+    uint64_t            errors;
+    uint64_t            reconnects;
+    uint64_t            bytes;
+    uint64_t            next_send;      /* open loop schedule */
+    uint64_t            interval;
+} bench_thread_t;
+
+static struct options opt = {
+    MODE_TCP, "127.0.0.1", 8000, 16, 2, 10, 1, 1, 64, 0, "/", "bee> ", 0
+};
+static struct sockaddr_in target;
+static char *request;
+static size_t request_len;
+static atomic_int measuring;
+static atomic_int stopping;
+
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Latency histogram (log-linear, ~3% resolution)                            */
+/*---------------------------------------------------------------------------*/
+static int
+hist_index(uint64_t v)
+{
+    int msb;
+
+    if (v < HIST_SUB)
+        return (int)v;
+    msb = 63 - __builtin_clzll(v);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + (int)((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static uint64_t
+hist_value(int idx)
+{
+    int shift;
+
+    if (idx < HIST_SUB)
+        return idx;
+    shift = idx / HIST_SUB - 1;
+    return ((uint64_t)(HIST_SUB + idx % HIST_SUB) << shift) + ((1ull << shift) >> 1);
+}
+
+static void
+hist_add(hist_t *h, uint64_t v)
+{
+    ++h->buckets[hist_index(v)];
+    ++h->count;
+    if (v > h->max)
+        h->max = v;
+}
+
+static uint64_t
+hist_percentile(const hist_t *h, double p)
+{
+    uint64_t want = (uint64_t)(h->count * p), seen = 0;
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > want)
+            return hist_value(i);
+    }
+    return h->max;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Connections                                                               */
+/*---------------------------------------------------------------------------*/
+static void
+conn_complete(bench_thread_t *t, bench_conn_t *c, uint64_t now)
+{
+    uint64_t sent = c->sent_at[c->head];
+
+    c->head = (c->head + 1) % MAX_DEPTH;
+    --c->outstanding;
+    if (atomic_load(&measuring)) {
+        hist_add(&t->hist, now - sent);
+        ++t->requests;
+    }
+}
+
+static int
+conn_open(bench_thread_t *t, bench_conn_t *c)
+{
+    struct epoll_event ev;
+    int type = opt.mode == MODE_UDP ? SOCK_DGRAM : SOCK_STREAM;
+    int one = 1;
+
+    c->fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0)
+        return -1;
+
+    if (type == SOCK_STREAM)
+        setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(c->fd, (struct sockaddr *)&target, sizeof(target)) < 0 && errno != EINPROGRESS) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+
+    c->connected = (type == SOCK_DGRAM);
+    c->greeted = (opt.mode != MODE_TELNET);
+    c->outstanding = 0;
+    c->last = 0;
+    c->head = 0;
+    c->rx_done = 0;
+    c->match = 0;
+    c->hlen = 0;
+    c->body_left = -1;
+    c->wlen = c->woff = 0;
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = c;
+    return epoll_ctl(t->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+static void
+conn_reset(bench_thread_t *t, bench_conn_t *c, int failed)
+{
+    if (failed && atomic_load(&measuring))
+        t->errors += c->outstanding ? c->outstanding : 1;
+
+    close(c->fd);
+    c->fd = -1;
+    if (!atomic_load(&stopping)) {
+        ++t->reconnects;
+        if (conn_open(t, c) < 0)
+            ++t->errors;
+    }
+}
+
+static int
+conn_flush(bench_conn_t *c)
+{
+    ssize_t nr;
+
+    while (c->woff < c->wlen) {
+        nr = send(c->fd, c->wbuf + c->woff, c->wlen - c->woff, MSG_NOSIGNAL);
+        if (nr < 0)
+            return errno == EAGAIN ? 0 : -1;
+        c->woff += nr;
+    }
+    c->wlen = c->woff = 0;
+    return 0;
+}
+
+static int
+conn_send(bench_thread_t *t, bench_conn_t *c, uint64_t scheduled)
+{
+    if (!c->connected || !c->greeted || c->last || c->outstanding >= opt.depth)
+        return 0;
+
+    /* a partially written request must go out before the next one */
+    if (c->wlen > 0)
+        return 0;
+
+    /* without keep-alive the server closes after one response, and a
+     * second request written before that would be answered with a reset
+     */
+    if (opt.mode == MODE_HTTP && !opt.keepalive)
+        c->last = 1;
+
+    c->sent_at[(c->head + c->outstanding) % MAX_DEPTH] = scheduled;
+    ++c->outstanding;
+
+    if (opt.mode == MODE_UDP) {
+        if (send(c->fd, request, request_len, 0) < 0 && errno != EAGAIN && errno != ECONNREFUSED)
+            return -1;
+        return 1;
+    }
+
+    memcpy(c->wbuf, request, request_len);
+    c->wlen = request_len;
+    c->woff = 0;
+    return conn_flush(c) < 0 ? -1 : 1;
+}
+
+/* Feeds received bytes into the protocol's framing; returns -1 if the
+ * connection must be re-established.
+ */
+static int
+conn_consume(bench_thread_t *t, bench_conn_t *c, const char *buf, size_t len, uint64_t now)
+{
+    size_t plen = strlen(opt.prompt), i;
+
+    switch (opt.mode) {
+    case MODE_UDP:
+        if (c->outstanding > 0)
+            conn_complete(t, c, now);
+        break;
+
+    case MODE_TCP:
+        c->rx_done += len;
+        while (c->outstanding > 0 && c->rx_done >= opt.payload) {
+            c->rx_done -= opt.payload;
+            conn_complete(t, c, now);
+        }
+        break;
+
+    case MODE_TELNET:
+        for (i = 0; i < len; i++) {
+            c->match = (buf[i] == opt.prompt[c->match]) ? c->match + 1 : (buf[i] == opt.prompt[0]);
+            if (c->match == plen) {
+                c->match = 0;
+                if (!c->greeted)
+                    c->greeted = 1;
+                else if (c->outstanding > 0)
+                    conn_complete(t, c, now);
+            }
+        }
+        break;
+
+    case MODE_HTTP:
+        while (len > 0) {
+            if (c->body_left < 0) {
+                size_t take = len < RBUF_SIZE - 1 - c->hlen ? len : RBUF_SIZE - 1 - c->hlen;
+                char *end, *cl;
+
+                memcpy(c->hbuf + c->hlen, buf, take);
+                c->hlen += take;
+                c->hbuf[c->hlen] = '\0';
+                end = strstr(c->hbuf, "\r\n\r\n");
+                if (!end) {
+                    if (c->hlen == RBUF_SIZE - 1)
+                        return -1;
+                    return 0;
+                }
+                cl = strcasestr(c->hbuf, "\r\nContent-Length:");
+                c->body_left = cl ? strtol(cl + 17, NULL, 10) : 0;
+                /* what followed the header block belongs to the body */
+                take -= (c->hlen - (end + 4 - c->hbuf));
+                buf += take;
+                len -= take;
+                c->hlen = 0;
+            }
+            if ((size_t)c->body_left <= len) {
+                buf += c->body_left;
+                len -= c->body_left;
+                c->body_left = -1;
+                conn_complete(t, c, now);
+            } else {
+                c->body_left -= len;
+                len = 0;
+            }
+        }
+        break;
+    }
+
+    return 0;
+}
+
+static void
+conn_event(bench_thread_t *t, bench_conn_t *c, uint32_t events)
+{
+    char buf[RBUF_SIZE];
+    uint64_t now;
+    ssize_t nr;
+    int err = 0;
+    socklen_t elen = sizeof(err);
+
+    if (!c->connected && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &elen);
+        if (err != 0) {
+            conn_reset(t, c, 1);
+            return;
+        }
+        c->connected = 1;
+    }
+
+    if ((events & EPOLLOUT) && c->wlen > 0 && conn_flush(c) < 0) {
+        conn_reset(t, c, 1);
+        return;
+    }
+
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        return;
+
+    for (;;) {
+        nr = recv(c->fd, buf, sizeof(buf), 0);
+        if (nr < 0) {
+            if (errno == EAGAIN)
+                return;
+            if (opt.mode == MODE_UDP)
+                return;
+            conn_reset(t, c, 1);
+            return;
+        }
+        if (nr == 0) {
+            /* httpd closes after every response: that is not an error */
+            conn_reset(t, c, c->outstanding > 0);
+            return;
+        }
+
+        now = now_ns();
+        if (atomic_load(&measuring))
+            t->bytes += nr;
+        if (conn_consume(t, c, buf, nr, now) < 0) {
+            conn_reset(t, c, 1);
+            return;
+        }
+    }
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Threads                                                                   */
+/*---------------------------------------------------------------------------*/
+static void
+expire_udp(bench_thread_t *t, uint64_t now)
+{
+    int i;
+
+    for (i = 0; i < t->nconns; i++) {
+        bench_conn_t *c = &t->conns[i];
+
+        while (c->outstanding > 0 && now - c->sent_at[c->head] > UDP_TIMEOUT_NS) {
+            c->head = (c->head + 1) % MAX_DEPTH;
+            --c->outstanding;
+            if (atomic_load(&measuring))
+                ++t->errors;
+        }
+    }
+}
+
+static void
+issue(bench_thread_t *t, uint64_t now)
+{
+    int i, start, sent;
+
+    if (opt.rate <= 0) {
+        /* closed loop: keep every connection `depth' requests deep */
+        for (i = 0; i < t->nconns; i++) {
+            bench_conn_t *c = &t->conns[i];
+
+            while (c->fd >= 0 && (sent = conn_send(t, c, now)) > 0)
+                ;
+            if (c->fd >= 0 && sent < 0)
+                conn_reset(t, c, 1);
+        }
+        return;
+    }
+
+    /* open loop: requests are due on a fixed schedule, and the latency is
+     * measured from when they were due, not from when a slot was free
+     */
+    start = 0;
+    while (t->next_send <= now) {
+        for (i = 0; i < t->nconns; i++) {
+            bench_conn_t *c = &t->conns[(start + i) % t->nconns];
+
+            if (c->fd >= 0 && (sent = conn_send(t, c, t->next_send)) != 0)
+                break;
+        }
+        if (i == t->nconns)
+            return;     /* every connection is saturated: fall behind */
+        start = (start + i + 1) % t->nconns;
+        t->next_send += t->interval;
+    }
+}
+
+static void *
+thread_main(void *arg)
+{
+    bench_thread_t *t = arg;
+    struct epoll_event events[256];
+    uint64_t now;
+    int i, n, timeout;
+
+    for (i = 0; i < t->nconns; i++) {
+        t->conns[i].wbuf = malloc(request_len);
+        t->conns[i].hbuf = malloc(RBUF_SIZE);
+        if (conn_open(t, &t->conns[i]) < 0)
+            perror("connect");
+    }
+
+    t->next_send = now_ns();
+    while (!atomic_load(&stopping)) {
+        now = now_ns();
+        issue(t, now);
+
+        timeout = 10;
+        if (opt.rate > 0 && t->next_send > now)
+            timeout = (t->next_send - now) / 1000000;
+
+        n = epoll_wait(t->epfd, events, 256, timeout);
+        for (i = 0; i < n; i++)
+            conn_event(t, events[i].data.ptr, events[i].events);
+
+        if (opt.mode == MODE_UDP)
+            expire_udp(t, now_ns());
+    }
+
+    for (i = 0; i < t->nconns; i++) {
+        if (t->conns[i].fd >= 0)
+            close(t->conns[i].fd);
+        free(t->conns[i].wbuf);
+        free(t->conns[i].hbuf);
+    }
+    return NULL;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Main                                                                      */
+/*---------------------------------------------------------------------------*/
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [OPTION]...\n"
+        "  -m MODE     tcp, udp, http or telnet (default tcp)\n"
+        "  -H HOST     server address (default 127.0.0.1)\n"
+        "  -p PORT     server port (default 8000)\n"
+        "  -c CONNS    connections (default 16)\n"
+        "  -t THREADS  client threads (default 2)\n"
+        "  -d SECONDS  measured duration (default 10)\n"
+        "  -w SECONDS  warmup before measuring (default 1)\n"
+        "  -P DEPTH    requests in flight per connection (default 1)\n"
+        "  -s BYTES    payload size; http sends a POST body if > 0 (default 64, http 0)\n"
+        "  -r RATE     open loop at RATE requests/s in total (default closed loop)\n"
+        "  -u PATH     http path or telnet command (default / or test)\n"
+        "  -T PROMPT   telnet prompt (default \"bee> \")\n"
+        "  -k          http keep-alive; otherwise one request per connection\n", prog);
+}
+
+static void
+build_request(void)
+{
+    size_t cap = opt.payload + strlen(opt.path) + strlen(opt.host) + 128;
+    size_t i;
+
+    request = malloc(cap);
+    switch (opt.mode) {
+    case MODE_TCP:
+    case MODE_UDP:
+        for (i = 0; i < opt.payload; i++)
+            request[i] = 'a' + i % 26;
+        request_len = opt.payload;
+        break;
+    case MODE_HTTP:
+        if (opt.payload > 0) {
+            request_len = snprintf(request, cap, "POST %s HTTP/1.1\r\nHost: %s\r\n%sContent-Length: %zu\r\n\r\n",
+                                   opt.path, opt.host, opt.keepalive ? "" : "Connection: close\r\n", opt.payload);
+            memset(request + request_len, 'a', opt.payload);
+            request_len += opt.payload;
+        } else
+            request_len = snprintf(request, cap, "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n",
+                                   opt.path, opt.host, opt.keepalive ? "" : "Connection: close\r\n");
+        break;
+    case MODE_TELNET:
+        request_len = snprintf(request, cap, "%s\r\n", opt.path);
+        break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const char *mode_names[] = { "tcp", "udp", "http", "telnet" };
+    bench_thread_t *threads;
+    hist_t *total;
+    uint64_t requests = 0, errors = 0, reconnects = 0, bytes = 0;
+    int ch, i, j, path_set = 0, payload_set = 0;
+
+    while ((ch = getopt(argc, argv, "m:H:p:c:t:d:w:P:s:r:u:T:kh")) != -1) {
+        switch (ch) {
+        case 'm':
+            for (i = 0; i < 4 && strcmp(optarg, mode_names[i]) != 0; i++)
+                ;
+            if (i == 4) {
+                usage(argv[0]);
+                return 1;
+            }
+            opt.mode = i;
+            break;
+        case 'H': opt.host = optarg; break;
+        case 'p': opt.port = atoi(optarg); break;
+        case 'c': opt.conns = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'd': opt.duration = atoi(optarg); break;
+        case 'w': opt.warmup = atoi(optarg); break;
+        case 'P': opt.depth = atoi(optarg); break;
+        case 's': opt.payload = strtoul(optarg, NULL, 10); payload_set = 1; break;
+        case 'r': opt.rate = atof(optarg); break;
+        case 'u': opt.path = optarg; path_set = 1; break;
+        case 'T': opt.prompt = optarg; break;
+        case 'k': opt.keepalive = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (opt.mode == MODE_TELNET && !path_set)
+        opt.path = "test";
+    if (opt.mode == MODE_HTTP && !payload_set)
+        opt.payload = 0;
+    if (opt.mode == MODE_HTTP && !opt.keepalive)
+        opt.depth = 1;
+    if (opt.threads < 1 || opt.conns < opt.threads || opt.depth < 1 || opt.depth > MAX_DEPTH ||
+        (opt.payload == 0 && (opt.mode == MODE_TCP || opt.mode == MODE_UDP)) || !*opt.prompt) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&target, 0, sizeof(target));
+    target.sin_family = AF_INET;
+    target.sin_port = htons(opt.port);
+    if (inet_pton(AF_INET, opt.host, &target.sin_addr) != 1) {
+        fprintf(stderr, "bad host address: %s\n", opt.host);
+        return 1;
+    }
+    build_request();
+
+    threads = calloc(opt.threads, sizeof(bench_thread_t));
+    for (i = 0; i < opt.threads; i++) {
+        bench_thread_t *t = &threads[i];
+
+        t->index = i;
+        t->epfd = epoll_create1(EPOLL_CLOEXEC);
+        t->nconns = opt.conns / opt.threads + (i < opt.conns % opt.threads);
+        t->conns = calloc(t->nconns, sizeof(bench_conn_t));
+        if (opt.rate > 0)
+            t->interval = (uint64_t)(1e9 * opt.threads / opt.rate);
+        pthread_create(&t->tid, NULL, thread_main, t);
+    }
+
+    sleep(opt.warmup);
+    atomic_store(&measuring, 1);
+    sleep(opt.duration);
+    atomic_store(&measuring, 0);
+    atomic_store(&stopping, 1);
+
+    total = calloc(1, sizeof(hist_t));
+    for (i = 0; i < opt.threads; i++) {
+        pthread_join(threads[i].tid, NULL);
+        for (j = 0; j < HIST_BUCKETS; j++)
+            total->buckets[j] += threads[i].hist.buckets[j];
+        total->count += threads[i].hist.count;
+        if (threads[i].hist.max > total->max)
+            total->max = threads[i].hist.max;
+        requests += threads[i].requests;
+        errors += threads[i].errors;
+        reconnects += threads[i].reconnects;
+        bytes += threads[i].bytes;
+        close(threads[i].epfd);
+        free(threads[i].conns);
+    }
+
+    printf("{\"mode\":\"%s\",\"host\":\"%s\",\"port\":%u,\"connections\":%d,\"threads\":%d,"
+           "\"depth\":%d,\"payload\":%zu,\"rate\":%.0f,\"duration_s\":%d,"
+           "\"requests\":%llu,\"errors\":%llu,\"reconnects\":%llu,"
+           "\"throughput_rps\":%.1f,\"rx_mbps\":%.2f,"
+           "\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n",
+           mode_names[opt.mode], opt.host, opt.port, opt.conns, opt.threads,
+           opt.depth, opt.payload, opt.rate, opt.duration,
+           (unsigned long long)requests, (unsigned long long)errors, (unsigned long long)reconnects,
+           requests / (double)opt.duration, bytes * 8 / 1e6 / opt.duration,
+           hist_percentile(total, 0.50) / 1e3, hist_percentile(total, 0.90) / 1e3,
+           hist_percentile(total, 0.99) / 1e3, hist_percentile(total, 0.999) / 1e3,
+           total->max / 1e3);
+
+    free(total);
+    free(threads);
+    free(request);
+    return 0;
+}
@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "bee.h"
+#include "bee_http.h"
+
+/* Feeds canned requests through bee_http.c in-process. recv()/send() on
+ * BENCH_SFD never reach the kernel, and the heap functions are wrapped at
+ * link time (-Wl,--wrap) so that every stage reports, per request:
+ *
+ *   ns          wall time
+ *   allocs      malloc/calloc/realloc calls
+ *   alloc_bytes bytes allocated: bh_request_t and every field copied out
+ *               of the receive buffer
+ *   sent        bytes handed to send()
+ *
+ * Stages:
+ *   parser      http_parser_execute() with no-op callbacks (the floor)
+ *   request     bee's parser callbacks and the bh_request_t lifecycle
+ *   route_N     http_recv() to the last of N routes, callback does nothing
+ *   reply       bh_send_reply() formatting alone
+ *   full        http_recv() to a callback replying with bh_send_reply()
+ */
+
+#define BENCH_SFD       1000000
+
+/* the tcp hook of bh_server_new(), not part of bee_http.h */
+enum BEE_HOOK_RESULT http_recv(int sfd, void *arg);
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+ssize_t __real_recv(int sfd, void *buf, size_t len, int flags);
+ssize_t __real_send(int sfd, const void *buf, size_t len, int flags);
+
+static struct {
+    uint64_t        allocs;
+    uint64_t        frees;
+    uint64_t        alloc_bytes;
+    uint64_t        sent_bytes;
+} counters;
+
+static const char *feed;
+static size_t feed_len;
+static FILE *out;
+static long iterations = 50000;
+
+
+/*---------------------------------------------------------------------------*/
+/* Link-time wrappers                                                        */
+/*---------------------------------------------------------------------------*/
+void *
+__wrap_malloc(size_t size)
+{
+    ++counters.allocs;
+    counters.alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+    ++counters.allocs;
+    counters.alloc_bytes += nmemb * size;
+    return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+    ++counters.allocs;
+    counters.alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+void
+__wrap_free(void *ptr)
+{
+    if (ptr != NULL)
+        ++counters.frees;
+    __real_free(ptr);
+}
+
+ssize_t
+__wrap_recv(int sfd, void *buf, size_t len, int flags)
+{
+    if (sfd != BENCH_SFD)
+        return __real_recv(sfd, buf, len, flags);
+
+    if (len > feed_len)
+        len = feed_len;
+    memcpy(buf, feed, len);
+    return len;
+}
+
+ssize_t
+__wrap_send(int sfd, const void *buf, size_t len, int flags)
+{
+    if (sfd != BENCH_SFD)
+        return __real_send(sfd, buf, len, flags);
+
+    counters.sent_bytes += len;
+    return len;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Canned requests                                                           */
+/*---------------------------------------------------------------------------*/
+typedef struct {
+    const char    * name;
+    char          * data;
+    size_t          len;
+} scenario_t;
+
+static char *
+make_header_heavy(void)
+{
+    size_t cap = 8192, len = 0;
+    char *buf = malloc(cap);
+    int i;
+
+    len += snprintf(buf + len, cap - len, "GET /route HTTP/1.1\r\nHost: bench.local\r\n");
+    for (i = 0; i < 40; i++)
+        len += snprintf(buf + len, cap - len, "X-Bench-Header-%02d: value-%d-abcdefghijklmnopqrstuvwxyz\r\n", i, i);
+    snprintf(buf + len, cap - len, "\r\n");
+    return buf;
+}
+
+static char *
+make_large_post(size_t body_len)
+{
+    size_t cap = body_len + 256;
+    char *buf = malloc(cap);
+    int len;
+
+    len = snprintf(buf, cap, "POST /route HTTP/1.1\r\nHost: bench.local\r\n"
+                   "Content-Type: application/octet-stream\r\nContent-Length: %zu\r\n\r\n", body_len);
+    memset(buf + len, 'p', body_len);
+    buf[len + body_len] = '\0';
+    return buf;
+}
+
+static char *
+make_pipelined(int depth)
+{
+    static const char one[] = "GET /route HTTP/1.1\r\nHost: bench.local\r\n\r\n";
+    char *buf = malloc(sizeof(one) * depth);
+    int i;
+
+    for (i = 0; i < depth; i++)
+        memcpy(buf + i * (sizeof(one) - 1), one, sizeof(one) - 1);
+    buf[depth * (sizeof(one) - 1)] = '\0';
+    return buf;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Stages                                                                    */
+/*---------------------------------------------------------------------------*/
+static int
+__noop_cb(http_parser *p)
+{
+    return 0;
+}
+
+static int
+__noop_data_cb(http_parser *p, const char *at, size_t len)
+{
+    return 0;
+}
+
+static http_parser_settings noop_settings = {
+    .on_message_begin = __noop_cb,
+    .on_headers_complete = __noop_cb,
+    .on_message_complete = __noop_cb,
+    .on_header_field = __noop_data_cb,
+    .on_header_value = __noop_data_cb,
+    .on_url = __noop_data_cb,
+    .on_status = __noop_data_cb,
+    .on_body = __noop_data_cb
+};
+
+static void
+noop_route(int sfd, bh_request_t *request)
+{
+}
+
+static void
+reply_route(int sfd, bh_request_t *request)
+{
+    bh_send_reply(sfd, "text/plain", "Hello, World!\n", 14);
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+report(const char *scenario, const char *stage, uint64_t t0, uint64_t t1, long n)
+{
+    fprintf(out, "%s_%s_ns: %.1f\n", scenario, stage, (double)(t1 - t0) / n);
+    fprintf(out, "%s_%s_allocs: %.2f\n", scenario, stage, (double)counters.allocs / n);
+    fprintf(out, "%s_%s_alloc_bytes: %.1f\n", scenario, stage, (double)counters.alloc_bytes / n);
+    fprintf(out, "%s_%s_sent: %.1f\n", scenario, stage, (double)counters.sent_bytes / n);
+    if ((counters.allocs - counters.frees) * 100 >= (uint64_t)n)
+        fprintf(out, "%s_%s_leaked: %.2f\n", scenario, stage,
+                ((double)counters.allocs - counters.frees) / n);
+}
+
+static void
+bench_parser(const scenario_t *s)
+{
+    http_parser parser;
+    uint64_t t0;
+    long i;
+
+    memset(&counters, 0, sizeof(counters));
+    t0 = now_ns();
+    for (i = 0; i < iterations; i++) {
+        http_parser_init(&parser, HTTP_REQUEST);
+        http_parser_execute(&parser, &noop_settings, s->data, s->len);
+    }
+    report(s->name, "parser", t0, now_ns(), iterations);
+}
+
+/* Same as the parse inside http_recv(): bee's callbacks filling in a
+ * bh_request_t, then releasing it.
+ */
+static void
+bench_request(const scenario_t *s, bh_server_t *httpd)
+{
+    http_parser parser;
+    bh_request_t *request;
+    uint64_t t0;
+    long i;
+
+    memset(&counters, 0, sizeof(counters));
+    t0 = now_ns();
+    for (i = 0; i < iterations; i++) {
+        request = bh_request_new();
+        http_parser_init(&parser, HTTP_REQUEST);
+        parser.data = request;
+        http_parser_execute(&parser, &httpd->parser_settings, s->data, s->len);
+        bh_request_free(request);
+    }
+    report(s->name, "request", t0, now_ns(), iterations);
+}
+
+static void
+bench_recv(const scenario_t *s, bee_connection_t *conn, const char *stage)
+{
+    uint64_t t0;
+    long i;
+
+    feed = s->data;
+    feed_len = s->len;
+    memset(&counters, 0, sizeof(counters));
+    t0 = now_ns();
+    for (i = 0; i < iterations; i++)
+        http_recv(BENCH_SFD, conn);
+    report(s->name, stage, t0, now_ns(), iterations);
+}
+
+static void
+bench_reply(void)
+{
+    uint64_t t0;
+    long i;
+
+    memset(&counters, 0, sizeof(counters));
+    t0 = now_ns();
+    for (i = 0; i < iterations; i++)
+        bh_send_reply(BENCH_SFD, "text/plain", "Hello, World!\n", 14);
+    report("hello", "reply", t0, now_ns(), iterations);
+}
+
+static bee_server_t *
+server_with_routes(struct event_base *evbase, int nroutes, bh_callback_cb last)
+{
+    bee_server_t *server = bh_server_new(evbase, "127.0.0.1", 0, -1);
+    char path[32];
+    int i;
+
+    if (!server)
+        return NULL;
+
+    /* the requested path is registered last, behind nroutes - 1 others */
+    for (i = 0; i < nroutes - 1; i++) {
+        snprintf(path, sizeof(path), "/unused%d", i);
+        bh_server_set_cb(server, path, noop_route);
+    }
+    bh_server_set_cb(server, "/route", last);
+    return server;
+}
+
+
+int main(int argc, char **argv)
+{
+    static const int route_counts[] = { 1, 16, 64 };
+    struct event_base *evbase = event_base_new();
+    bee_server_t *server;
+    bee_connection_t conn;
+    scenario_t scenarios[4];
+    char stage[32];
+    int i, j, devnull;
+
+    if (argc > 1)
+        iterations = atol(argv[1]);
+
+    scenarios[0].name = "small_get";
+    scenarios[0].data = strdup("GET /route HTTP/1.1\r\nHost: bench.local\r\n\r\n");
+    scenarios[1].name = "header_heavy";
+    scenarios[1].data = make_header_heavy();
+    scenarios[2].name = "large_post";
+    scenarios[2].data = make_large_post(32768);
+    scenarios[3].name = "pipelined4";
+    scenarios[3].data = make_pipelined(4);
+    for (i = 0; i < 4; i++)
+        scenarios[i].len = strlen(scenarios[i].data);
+
+    /* bee_http.c prints every request; keep that cost but not the text */
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    fprintf(out, "iterations: %ld\n", iterations);
+    for (i = 0; i < 4; i++) {
+        fprintf(out, "%s_bytes: %zu\n", scenarios[i].name, scenarios[i].len);
+
+        bench_parser(&scenarios[i]);
+
+        server = server_with_routes(evbase, 1, noop_route);
+        if (!server) {
+            perror("bh_server_new");
+            return 1;
+        }
+        bench_request(&scenarios[i], server->pdata);
+        bh_server_free(server);
+
+        for (j = 0; j < 3; j++) {
+            server = server_with_routes(evbase, route_counts[j], noop_route);
+            memset(&conn, 0, sizeof(conn));
+            conn.server = server;
+            conn.sfd = BENCH_SFD;
+            snprintf(stage, sizeof(stage), "route_%d", route_counts[j]);
+            bench_recv(&scenarios[i], &conn, stage);
+            bh_server_free(server);
+        }
+
+        server = server_with_routes(evbase, 1, reply_route);
+        memset(&conn, 0, sizeof(conn));
+        conn.server = server;
+        conn.sfd = BENCH_SFD;
+        bench_recv(&scenarios[i], &conn, "full");
+        bh_server_free(server);
+    }
+    bench_reply();
+
+    for (i = 0; i < 4; i++)
+        free(scenarios[i].data);
+    fclose(out);
+    event_base_free(evbase);
+    return 0;
+}
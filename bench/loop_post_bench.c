@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "bee.h"
+#include "bee_loop.h"
+
+#define RING_SIZE       4096
+#define PINGS           10000
+
+static bee_loop_t *loop;
+static int nproducers = 4;
+static long posts_per_producer = 1000000;
+
+static long received = 0;
+static uint64_t *latencies;
+static atomic_long retries;
+static atomic_int pong;
+
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+report(const char *name, uint64_t *v, long n)
+{
+    qsort(v, n, sizeof(uint64_t), cmp_u64);
+    printf("%s_p50_ns: %llu\n", name, (unsigned long long)v[n / 2]);
+    printf("%s_p99_ns: %llu\n", name, (unsigned long long)v[n * 99 / 100]);
+    printf("%s_p999_ns: %llu\n", name, (unsigned long long)v[n * 999 / 1000]);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Throughput: producers post as fast as the ring accepts                    */
+/*---------------------------------------------------------------------------*/
+static void
+on_post(void *arg)
+{
+    latencies[received] = now_ns() - (uint64_t)(uintptr_t)arg;
+    if (++received == nproducers * posts_per_producer)
+        event_base_loopbreak(bee_loop_get_base(loop));
+}
+
+static void *
+producer(void *arg)
+{
+    long i;
+
+    for (i = 0; i < posts_per_producer; i++) {
+        while (bee_loop_post(loop, on_post, (void *)(uintptr_t)now_ns()) < 0) {
+            atomic_fetch_add(&retries, 1);
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Wakeup latency: one message at a time into an idle loop                   */
+/*---------------------------------------------------------------------------*/
+static void
+on_ping(void *arg)
+{
+    *(uint64_t *)arg = now_ns() - *(uint64_t *)arg;
+    atomic_store(&pong, 1);
+}
+
+static void
+on_stop(void *arg)
+{
+    event_base_loopbreak(bee_loop_get_base(loop));
+}
+
+static void *
+pinger(void *arg)
+{
+    uint64_t *v = arg;
+    struct timespec idle = { 0, 20000 };
+    int i;
+
+    for (i = 0; i < PINGS; i++) {
+        nanosleep(&idle, NULL);
+        atomic_store(&pong, 0);
+        v[i] = now_ns();
+        while (bee_loop_post(loop, on_ping, &v[i]) < 0)
+            sched_yield();
+        while (!atomic_load(&pong))
+            ;
+    }
+
+    while (bee_loop_post(loop, on_stop, NULL) < 0)
+        sched_yield();
+    return NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct event_base *evbase = event_base_new();
+    pthread_t *tids;
+    uint64_t start, elapsed;
+    long total;
+    int i;
+
+    if (argc > 1)
+        nproducers = atoi(argv[1]);
+    if (argc > 2)
+        posts_per_producer = atol(argv[2]);
+
+    loop = bee_loop_new(evbase, RING_SIZE);
+    total = nproducers * posts_per_producer;
+    latencies = calloc(total > PINGS ? total : PINGS, sizeof(uint64_t));
+    tids = calloc(nproducers, sizeof(pthread_t));
+
+    start = now_ns();
+    for (i = 0; i < nproducers; i++)
+        pthread_create(&tids[i], NULL, producer, NULL);
+    event_base_loop(evbase, 0);
+    elapsed = now_ns() - start;
+    for (i = 0; i < nproducers; i++)
+        pthread_join(tids[i], NULL);
+
+    printf("producers: %d\n", nproducers);
+    printf("posts: %ld\n", total);
+    printf("posts_per_sec: %.0f\n", total / (elapsed / 1e9));
+    printf("ring_full_retries: %ld\n", atomic_load(&retries));
+    report("queue_latency", latencies, total);
+
+    memset(latencies, 0, PINGS * sizeof(uint64_t));
+    pthread_create(&tids[0], NULL, pinger, latencies);
+    event_base_loop(evbase, 0);
+    pthread_join(tids[0], NULL);
+    report("wakeup_latency", latencies, PINGS);
+
+    bee_loop_free(loop);
+    event_base_free(evbase);
+    free(latencies);
+    free(tids);
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "bee_timer.h"
+
+/* Arms, cancels and expires `ntimers' timers with random delays, once on
+ * a bee_timer wheel and once as one libevent timer event each:
+ *
+ *   add_ns      per timer armed
+ *   cancel_ns   per timer cancelled
+ *   late_ms     how long after its delay a timer fired, p50/p99/max
+ */
+
+#define MAX_DELAY_MS    2000
+
+typedef struct {
+    bee_timer_t         timer;
+    struct event      * ev;
+    uint64_t            due_ns;
+} bench_timer_t;
+
+static long ntimers = 1000000;
+static unsigned int resolution_ms = 1;
+static bench_timer_t *timers;
+static uint32_t *delays;
+static uint64_t *late;
+static long fired;
+static struct event_base *evbase;
+
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+report(const char *name, uint64_t add_ns, uint64_t cancel_ns)
+{
+    qsort(late, ntimers, sizeof(uint64_t), cmp_u64);
+    printf("%s_add_ns: %.1f\n", name, (double)add_ns / ntimers);
+    printf("%s_cancel_ns: %.1f\n", name, (double)cancel_ns / ntimers);
+    printf("%s_late_p50_ms: %.2f\n", name, late[ntimers / 2] / 1e6);
+    printf("%s_late_p99_ms: %.2f\n", name, late[ntimers * 99 / 100] / 1e6);
+    printf("%s_late_max_ms: %.2f\n", name, late[ntimers - 1] / 1e6);
+}
+
+static void
+on_fire(bench_timer_t *t)
+{
+    uint64_t now = now_ns();
+
+    late[fired] = now > t->due_ns ? now - t->due_ns : 0;
+    if (++fired == ntimers)
+        event_base_loopbreak(evbase);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* bee_timer                                                                 */
+/*---------------------------------------------------------------------------*/
+static void
+wheel_cb(bee_timer_t *timer, void *arg)
+{
+    on_fire(arg);
+}
+
+static void
+run_wheel(void)
+{
+    bee_timer_wheel_t *wheel = bee_timer_wheel_new(evbase, resolution_ms);
+    uint64_t start, add_ns, cancel_ns;
+    long i;
+
+    for (i = 0; i < ntimers; i++)
+        bee_timer_init(&timers[i].timer, wheel_cb, &timers[i]);
+
+    start = now_ns();
+    for (i = 0; i < ntimers; i++)
+        bee_timer_add(wheel, &timers[i].timer, delays[i]);
+    add_ns = now_ns() - start;
+
+    start = now_ns();
+    for (i = 0; i < ntimers; i++)
+        bee_timer_cancel(&timers[i].timer);
+    cancel_ns = now_ns() - start;
+
+    fired = 0;
+    for (i = 0; i < ntimers; i++) {
+        timers[i].due_ns = now_ns() + delays[i] * 1000000ull;
+        bee_timer_add(wheel, &timers[i].timer, delays[i]);
+    }
+    event_base_loop(evbase, 0);
+
+    report("wheel", add_ns, cancel_ns);
+    bee_timer_wheel_free(wheel);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* One libevent timer per timer                                              */
+/*---------------------------------------------------------------------------*/
+static void
+event_cb(evutil_socket_t fd, short events, void *arg)
+{
+    on_fire(arg);
+}
+
+static void
+run_events(void)
+{
+    uint64_t start, add_ns, cancel_ns;
+    struct timeval tv;
+    long i;
+
+    start = now_ns();
+    for (i = 0; i < ntimers; i++) {
+        timers[i].ev = evtimer_new(evbase, event_cb, &timers[i]);
+        tv.tv_sec = delays[i] / 1000;
+        tv.tv_usec = (delays[i] % 1000) * 1000;
+        evtimer_add(timers[i].ev, &tv);
+    }
+    add_ns = now_ns() - start;
+
+    start = now_ns();
+    for (i = 0; i < ntimers; i++)
+        event_free(timers[i].ev);
+    cancel_ns = now_ns() - start;
+
+    fired = 0;
+    for (i = 0; i < ntimers; i++) {
+        timers[i].due_ns = now_ns() + delays[i] * 1000000ull;
+        timers[i].ev = evtimer_new(evbase, event_cb, &timers[i]);
+        tv.tv_sec = delays[i] / 1000;
+        tv.tv_usec = (delays[i] % 1000) * 1000;
+        evtimer_add(timers[i].ev, &tv);
+    }
+    event_base_loop(evbase, 0);
+
+    report("event", add_ns, cancel_ns);
+    for (i = 0; i < ntimers; i++)
+        event_free(timers[i].ev);
+}
+
+
+int main(int argc, char **argv)
+{
+    long i;
+
+    if (argc > 1)
+        ntimers = atol(argv[1]);
+    if (argc > 2)
+        resolution_ms = (unsigned int)atoi(argv[2]);
+    if (ntimers <= 0 || resolution_ms == 0) {
+        fprintf(stderr, "usage: %s [timers] [resolution ms]\n", argv[0]);
+        return 1;
+    }
+
+    evbase = event_base_new();
+    timers = calloc(ntimers, sizeof(*timers));
+    delays = calloc(ntimers, sizeof(*delays));
+    late = calloc(ntimers, sizeof(*late));
+
+    srand(1);
+    for (i = 0; i < ntimers; i++)
+        delays[i] = 1 + rand() % MAX_DELAY_MS;
+
+    printf("timers: %ld\n", ntimers);
+    printf("resolution_ms: %u\n", resolution_ms);
+    run_wheel();
+    run_events();
+
+    event_base_free(evbase);
+    free(timers);
+    free(delays);
+    free(late);
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include "bee.h"
+
+/* One sender thread blasts datagrams over loopback at a session-mode udp
+ * server, with and without UDP_SEGMENT on the sending side and UDP_GRO on
+ * the receiving one. Loopback keeps GSO datagrams whole up to a GRO socket,
+ * so the four runs show what each side saves in per-datagram kernel work.
+ */
+
+#define RX_PORT         9200
+#define TX_PORT         9201
+#define RX_RCVBUF       (8 * 1024 * 1024)
+
+static size_t segsize = 1200;
+static long megabytes = 1024;
+
+static struct sockaddr_in dst;
+static atomic_int sender_done;
+static uint64_t send_ns;
+static uint64_t sent;
+
+static uint64_t received;
+static uint64_t received_bytes;
+static uint64_t first_ns, last_ns;
+static uint64_t seen_at_tick;
+
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static enum BEE_HOOK_RESULT
+on_dgram(bee_udp_session_t *sess, const char *data, size_t len, char *reply, size_t *reply_len, void *arg)
+{
+    if (received++ == 0)
+        first_ns = now_ns();
+    received_bytes += len;
+    return BEE_HOOK_OK;
+}
+
+/* stops the receiving loop once the sender is done and nothing came in */
+static void
+on_tick(evutil_socket_t fd, short events, void *arg)
+{
+    if (atomic_load(&sender_done) && received == seen_at_tick)
+        event_base_loopbreak(arg);
+    if (received != seen_at_tick)
+        last_ns = now_ns();
+    seen_at_tick = received;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Sender                                                                    */
+/*---------------------------------------------------------------------------*/
+static void *
+sender(void *arg)
+{
+    int gso = *(int *)arg;
+    struct event_base *evbase = event_base_new();
+    bee_server_t *server = bee_server_udp_new(evbase, "127.0.0.1", TX_PORT);
+    size_t chunk = segsize * (BEE_UDP_GSO_MAX / segsize < BEE_UDP_GSO_SEGS ? BEE_UDP_GSO_MAX / segsize : BEE_UDP_GSO_SEGS);
+    char *buf = calloc(1, chunk);
+    uint64_t total = (uint64_t)megabytes * 1024 * 1024, off, start;
+    size_t s;
+    int rc;
+
+    start = now_ns();
+    for (off = 0; off < total; off += chunk) {
+        for (;;) {
+            if (gso) {
+                rc = bee_server_sendto_gso(server, buf, chunk, segsize, (struct sockaddr *)&dst, sizeof(dst));
+            }
+            else {
+                for (rc = 0, s = 0; rc == 0 && s < chunk; s += segsize)
+                    rc = bee_server_sendto(server, buf + s, segsize, (struct sockaddr *)&dst, sizeof(dst));
+            }
+            if (rc == 0 || errno != ENOBUFS)
+                break;
+            event_base_loop(evbase, EVLOOP_ONCE);   /* let the queue drain */
+        }
+        sent += chunk / segsize;
+    }
+    while (server->outq != NULL)
+        event_base_loop(evbase, EVLOOP_ONCE);
+    send_ns = now_ns() - start;
+
+    if (gso && (server->udp_flags & BEE_UDP_F_NO_GSO))
+        printf("  (no UDP_SEGMENT here, sent datagram by datagram)\n");
+
+    atomic_store(&sender_done, 1);
+    bee_server_free(server);
+    event_base_free(evbase);
+    free(buf);
+    return NULL;
+}
+
+
+static void
+run(int gso, int gro)
+{
+    struct event_base *evbase = event_base_new();
+    bee_server_t *server = bee_server_udp_new(evbase, "0.0.0.0", RX_PORT);
+    struct timeval tick = { 0, 50000 };
+    struct event *timer;
+    int rcvbuf = RX_RCVBUF;
+    pthread_t tid;
+    double secs;
+
+    sent = received = received_bytes = seen_at_tick = 0;
+    first_ns = last_ns = 0;
+    atomic_store(&sender_done, 0);
+
+    setsockopt(event_get_fd(server->listen_ev), SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    bee_udp_set_sessions(server, 16, 60000, on_dgram, NULL, NULL, NULL);
+    if (gro && bee_udp_set_gro(server, 1) < 0)
+        perror("  bee_udp_set_gro");
+
+    timer = event_new(evbase, -1, EV_PERSIST, on_tick, evbase);
+    event_add(timer, &tick);
+    pthread_create(&tid, NULL, sender, &gso);
+    event_base_loop(evbase, 0);
+    pthread_join(tid, NULL);
+
+    secs = last_ns > first_ns ? (last_ns - first_ns) / 1e9 : 1e-9;
+    printf("%s_%s_sent_pps: %.0f\n", gso ? "gso" : "plain", gro ? "gro" : "nogro", sent / (send_ns / 1e9));
+    printf("%s_%s_recv_pps: %.0f\n", gso ? "gso" : "plain", gro ? "gro" : "nogro", received / secs);
+    printf("%s_%s_recv_mbps: %.1f\n", gso ? "gso" : "plain", gro ? "gro" : "nogro",
+           received_bytes * 8 / secs / 1e6);
+    printf("%s_%s_loss_pct: %.2f\n", gso ? "gso" : "plain", gro ? "gro" : "nogro",
+           sent > 0 ? 100.0 * (sent - (received < sent ? received : sent)) / sent : 0.0);
+
+    event_free(timer);
+    bee_server_free(server);
+    event_base_free(evbase);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        segsize = (size_t)atol(argv[1]);
+    if (argc > 2)
+        megabytes = atol(argv[2]);
+    if (segsize == 0 || segsize > BEE_UDP_DGRAM_SIZE) {
+        fprintf(stderr, "usage: %s [segment size, up to %d] [megabytes]\n", argv[0], BEE_UDP_DGRAM_SIZE);
+        return 1;
+    }
+
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(RX_PORT);
+    dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    printf("segment: %zu\n", segsize);
+    printf("megabytes: %ld\n", megabytes);
+    run(0, 0);
+    run(1, 0);
+    run(0, 1);
+    run(1, 1);
+
+    return 0;
+}
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "bee.h"
+#include "bee_uring.h"
+
+/* Runs a tcp echo server on the libevent core and on the io_uring backend
+ * in turn and drives both with the same closed-loop ping-pong clients.
+ */
+
+#define BUF_SIZE        4096
+#define MAX_SAMPLES     (1 << 20)
+
+static int nconns = 16;
+static int seconds = 5;
+static size_t payload = 64;
+
+static atomic_int stop;
+static struct event_base *server_base;
+
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Servers                                                                   */
+/*---------------------------------------------------------------------------*/
+static enum BEE_HOOK_RESULT
+libevent_echo(int sfd, void *arg)
+{
+    char buf[BUF_SIZE];
+    ssize_t nr;
+
+    nr = recv(sfd, buf, sizeof(buf), 0);
+    if (nr < 0)
+        return errno == EAGAIN ? BEE_HOOK_EAGAIN : BEE_HOOK_CLOSED;
+    if (nr == 0)
+        return BEE_HOOK_PEER_CLOSED;
+
+    if (send(sfd, buf, nr, MSG_NOSIGNAL) < 0)
+        return BEE_HOOK_CLOSED;
+
+    return BEE_HOOK_OK;
+}
+
+static enum BEE_HOOK_RESULT
+uring_echo(bee_uring_conn_t *conn, const char *data, size_t len)
+{
+    if (len == 0)
+        return BEE_HOOK_PEER_CLOSED;
+
+    /* sent straight from the provided buffer, no copy */
+    return bee_uring_send(conn, data, len) < 0 ? BEE_HOOK_ERR : BEE_HOOK_OK;
+}
+
+static void
+stop_check(evutil_socket_t fd, short events, void *arg)
+{
+    if (atomic_load(&stop))
+        event_base_loopbreak(server_base);
+}
+
+static void *
+server_main(void *arg)
+{
+    struct timeval tick = { 0, 50000 };
+    struct event *ev = event_new(server_base, -1, EV_PERSIST, stop_check, NULL);
+
+    event_add(ev, &tick);
+    event_base_loop(server_base, 0);
+    event_free(ev);
+    return NULL;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Clients                                                                   */
+/*---------------------------------------------------------------------------*/
+typedef struct {
+    uint16_t    port;
+    long        requests;
+    uint64_t  * samples;
+    long        nsamples;
+} client_t;
+
+static void *
+client_main(void *arg)
+{
+    client_t *c = arg;
+    struct sockaddr_in addr;
+    char *out = malloc(payload), *in = malloc(payload);
+    int sfd, one = 1;
+    size_t got;
+    ssize_t nr;
+    uint64_t t0;
+
+    memset(out, 'b', payload);
+    sfd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(c->port);
+    if (connect(sfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        goto out;
+    }
+
+    while (!atomic_load(&stop)) {
+        t0 = now_ns();
+        if (send(sfd, out, payload, 0) < 0)
+            break;
+        for (got = 0; got < payload; got += nr) {
+            nr = recv(sfd, in + got, payload - got, 0);
+            if (nr <= 0)
+                goto out;
+        }
+        if (c->nsamples < MAX_SAMPLES / nconns)
+            c->samples[c->nsamples++] = now_ns() - t0;
+        ++c->requests;
+    }
+
+  out:
+    close(sfd);
+    free(out);
+    free(in);
+    return NULL;
+}
+
+static void
+run(const char *name, uint16_t port, bee_uring_t *ring)
+{
+    pthread_t server_tid, *tids = calloc(nconns, sizeof(pthread_t));
+    client_t *clients = calloc(nconns, sizeof(client_t));
+    uint64_t *all = calloc(MAX_SAMPLES, sizeof(uint64_t));
+    struct bee_uring_stats st0, st1;
+    struct rusage ru0, ru1;
+    long requests = 0, n = 0, i, j;
+    double cpu;
+
+    if (ring != NULL)
+        bee_uring_get_stats(ring, &st0);
+    getrusage(RUSAGE_SELF, &ru0);
+
+    atomic_store(&stop, 0);
+    pthread_create(&server_tid, NULL, server_main, NULL);
+    for (i = 0; i < nconns; i++) {
+        clients[i].port = port;
+        clients[i].samples = calloc(MAX_SAMPLES / nconns, sizeof(uint64_t));
+        pthread_create(&tids[i], NULL, client_main, &clients[i]);
+    }
+
+    sleep(seconds);
+    atomic_store(&stop, 1);
+    for (i = 0; i < nconns; i++)
+        pthread_join(tids[i], NULL);
+    pthread_join(server_tid, NULL);
+    getrusage(RUSAGE_SELF, &ru1);
+
+    for (i = 0; i < nconns; i++) {
+        requests += clients[i].requests;
+        for (j = 0; j < clients[i].nsamples; j++)
+            all[n++] = clients[i].samples[j];
+        free(clients[i].samples);
+    }
+    qsort(all, n, sizeof(uint64_t), cmp_u64);
+    cpu = (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec) + (ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec)
+        + ((ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec) + (ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec)) / 1e6;
+
+    printf("%s_requests_per_sec: %.0f\n", name, requests / (double)seconds);
+    if (n > 0) {
+        printf("%s_p50_us: %.1f\n", name, all[n / 2] / 1e3);
+        printf("%s_p99_us: %.1f\n", name, all[n * 99 / 100] / 1e3);
+        printf("%s_p999_us: %.1f\n", name, all[n * 999 / 1000] / 1e3);
+    }
+    printf("%s_cpu_us_per_request: %.2f\n", name, requests ? cpu * 1e6 / requests : 0);
+    if (ring != NULL && requests > 0) {
+        bee_uring_get_stats(ring, &st1);
+        printf("%s_enters_per_request: %.3f\n", name, (double)(st1.enters - st0.enters) / requests);
+        printf("%s_cqes_per_request: %.3f\n", name, (double)(st1.cqes - st0.cqes) / requests);
+    }
+
+    free(all);
+    free(clients);
+    free(tids);
+}
+
+
+int main(int argc, char **argv)
+{
+    bee_server_t *server;
+    bee_uring_t *ring;
+
+    if (argc > 1)
+        nconns = atoi(argv[1]);
+    if (argc > 2)
+        seconds = atoi(argv[2]);
+    if (argc > 3)
+        payload = atoi(argv[3]);
+
+    printf("connections: %d\n", nconns);
+    printf("payload_bytes: %zu\n", payload);
+
+    server_base = event_base_new();
+    server = bee_server_tcp_new(server_base, "127.0.0.1", 18000, -1);
+    server->on_recv = libevent_echo;
+    run("libevent", 18000, NULL);
+    bee_server_free(server);
+    event_base_free(server_base);
+
+    server_base = event_base_new();
+    ring = bee_uring_new(server_base, 1024, 4096, BUF_SIZE);
+    if (!ring || bee_uring_tcp_listen(ring, "127.0.0.1", 18001, -1, NULL, uring_echo, NULL) < 0) {
+        fprintf(stderr, "io_uring backend unavailable\n");
+        return 1;
+    }
+    run("io_uring", 18001, ring);
+    bee_uring_free(ring);
+    event_base_free(server_base);
+
+    return 0;
+}
@@ -1,7 +1,13 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
 #include "bee.h"
 #include "bee_http.h"
 
+#define HANDOFF_PATH    "/tmp/bee-httpd.sock"
+
 void test_cb(int sfd, bh_request_t *request)
 {
     bh_send_reply(sfd, "text/plain", "Hello, World!\n", 14);
@@ -12,15 +18,124 @@ void test2_cb(int sfd, bh_request_t *request)
     bh_send_reply(sfd, "application/json; charset=utf-8", "{\"Hello\":\"World!\"}", 18);
 }
 
+void agent_cb(int sfd, bh_request_t *request)
+{
+    const char *agent = bh_request_get_header(request, BH_HDR_USER_AGENT);
+    char body[256];
+    int len;
+
+    len = snprintf(body, sizeof(body), "%s\n", agent ? agent : "unknown");
+    if (len >= (int)sizeof(body))
+        len = sizeof(body) - 1;
+    bh_send_reply(sfd, "text/plain", body, len);
+}
+
+/* /greet?name=... */
+void greet_cb(int sfd, bh_request_t *request)
+{
+    const char *name = bh_request_get_param(request, "name");
+    char body[256];
+    int len;
+
+    len = snprintf(body, sizeof(body), "Hello, %s!\n", name ? name : "stranger");
+    if (len >= (int)sizeof(body))
+        len = sizeof(body) - 1;
+    bh_send_reply(sfd, "text/plain", body, len);
+}
+
+/* /count?n=...: streams the numbers 1..n, one per line, in constant memory */
+struct counter {
+    long        next;
+    long        last;
+};
+
+void count_more(bh_stream_t *stream, void *arg)
+{
+    struct counter *counter = arg;
+    char line[32];
+    int len, rc = 0;
+
+    while (rc == 0 && counter->next <= counter->last) {
+        len = snprintf(line, sizeof(line), "%ld\n", counter->next++);
+        rc = bh_stream_write(stream, line, len);
+    }
+
+    if (rc < 0 || counter->next > counter->last) {
+        bh_stream_end(stream);
+        free(counter);
+    }
+}
+
+void count_cb(int sfd, bh_request_t *request)
+{
+    const char *n = bh_request_get_param(request, "n");
+    struct counter *counter = calloc(1, sizeof(*counter));
+
+    counter->next = 1;
+    counter->last = n ? atol(n) : 10;
+    if (bh_stream_new(sfd, "text/plain", count_more, counter) == NULL) {
+        free(counter);
+        bh_send_reply(sfd, "text/plain", "stream failed\n", 14);
+    }
+}
+
+/* runs on a pool worker, other connections are served meanwhile */
+void slow_cb(int sfd, bh_request_t *request)
+{
+    sleep(1);
+    bh_send_reply(sfd, "text/plain", "Sorry for the wait.\n", 20);
+}
+
+void on_drained(bee_server_t *server, void *arg)
+{
+    event_base_loopbreak(server->evbase);
+}
+
+/* SIGTERM: finish in-flight requests and exit.
+ * SIGUSR2: hand the listener to a new `httpd --takeover' first.
+ */
+void on_signal(evutil_socket_t sig, short events, void *arg)
+{
+    bee_server_t *server = arg;
+    struct timeval deadline = { 10, 0 };
+
+    if (sig == SIGUSR2 && bee_server_send_listener(server, HANDOFF_PATH) < 0) {
+        perror("handoff");
+        return;
+    }
+
+    printf("Draining http server\n");
+    bee_server_drain(server, &deadline, on_drained, NULL);
+}
+
 int main(int argc, char **argv)
 {
     struct event_base *evbase = event_base_new();
-    bee_server_t *server = bh_server_new(evbase, "0.0.0.0", 8000, -1);
+    bee_server_t *server;
+    bee_pool_t *pool = bee_pool_new(4, 256);
+    struct event *term_ev, *usr2_ev;
+
+    if (argc > 1 && strcmp(argv[1], "--takeover") == 0)
+        server = bh_server_adopt(evbase, bee_listener_recv(HANDOFF_PATH));
+    else
+        server = bh_server_new(evbase, "0.0.0.0", 8000, -1);
+
+    term_ev = evsignal_new(evbase, SIGTERM, on_signal, server);
+    usr2_ev = evsignal_new(evbase, SIGUSR2, on_signal, server);
+    event_add(term_ev, NULL);
+    event_add(usr2_ev, NULL);
 
     bh_server_set_cb(server, "/", test_cb);
     bh_server_set_cb(server, "/hello", test2_cb);
+    bh_server_set_cb(server, "/agent", agent_cb);
+    bh_server_set_cb(server, "/greet", greet_cb);
+    bh_server_set_cb(server, "/count", count_cb);
+    bh_server_set_cb_pool(server, "/slow", slow_cb, pool);
     printf("Start http server with port 8000\n");
     event_base_loop(evbase, 0);
+    event_free(term_ev);
+    event_free(usr2_ev);
+    bee_pool_free(pool);
     bh_server_free(server);
     event_base_free(evbase);
 
@@ -2,42 +2,46 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
 #include <errno.h>
 #include "bee.h"
 
-#define BUF_SIZE 4096
-
-enum BEE_HOOK_RESULT mcast_receive(int sfd, void *arg)
+/* Every datagram of a batch, prefixed with the group it was sent to. */
+void mcast_receive(bee_server_t *server, const bee_mcast_msg_t *msgs, int count, void *arg)
 {
-    bee_server_t * server = arg;
-    char buf[BUF_SIZE];
-    ssize_t recv_nr;
-    struct sockaddr_in cli_sock;
-    socklen_t cli_len = sizeof(cli_sock);
+    char group[INET_ADDRSTRLEN];
+    int i;
 
-    memset(buf, 0, sizeof(buf));
-    recv_nr = recvfrom(sfd, buf, sizeof(buf), 0, (struct sockaddr *)&cli_sock, &cli_len);
-    if (recv_nr < 0) {
-        if (errno == EAGAIN)
-            return BEE_HOOK_EAGAIN;
-        perror("recvfrom");
-        return BEE_HOOK_ERR;
+    for (i = 0; i < count; i++) {
+        inet_ntop(AF_INET, &msgs[i].group, group, sizeof(group));
+        printf("%s: %.*s\n", group, (int)msgs[i].len, msgs[i].data);
     }
-
-    printf("%s\n", (char *)buf);
-    return BEE_HOOK_OK;
 }
 
 int main(int argc, char **argv)
 {
     struct event_base *evbase = event_base_new();
-    bee_server_t *server = bee_server_mcast_new(evbase, "127.0.0.1", "224.1.1.1", 4444);
+    bee_server_t *server = bee_server_mcast_open(evbase, 4444);
+    int i;
+
+    if (!server) {
+        perror("bee_server_mcast_open");
+        return 1;
+    }
 
-    server->on_recv = mcast_receive;
-    printf("Start multicast listener with group address 244.1.1.1 and port 4444\n");
+    /* the groups to join on the loopback interface, 224.1.1.1 by default */
+    if (argc < 2 && bee_mcast_join(server, "224.1.1.1", "127.0.0.1", NULL) < 0)
+        perror("bee_mcast_join");
+    for (i = 1; i < argc; i++) {
+        if (bee_mcast_join(server, argv[i], "127.0.0.1", NULL) < 0)
+            perror(argv[i]);
+    }
+
+    bee_mcast_set_loop(server, 1);
+    bee_mcast_set_cb(server, mcast_receive, NULL);
+    printf("Start multicast listener on port 4444\n");
     event_base_loop(evbase, 0);
     bee_server_free(server);
     event_base_free(evbase);
     return 0;
 }
-
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include "bee.h"
+#include "bee_seq.h"
+
+/* Datagrams of the form "<seq> <text>"; anything else is unsequenced. */
+int mcast_seq_extract(const bee_mcast_msg_t *msg, uint64_t *seq, void *arg)
+{
+    char num[21];
+    char *end;
+    size_t i;
+
+    for (i = 0; i < msg->len && i < sizeof(num) - 1 && msg->data[i] != ' '; i++)
+        num[i] = msg->data[i];
+    num[i] = '\0';
+
+    *seq = strtoull(num, &end, 10);
+    return (i == 0 || *end != '\0') ? -1 : 0;
+}
+
+void mcast_seq_deliver(const bee_mcast_msg_t *msg, uint64_t seq, void *arg)
+{
+    printf("%s: %.*s\n", inet_ntoa(msg->source.sin_addr), (int)msg->len, msg->data);
+}
+
+void mcast_seq_event(const bee_mcast_msg_t *msg, enum BEE_SEQ_EVENT event,
+                     uint64_t first, uint64_t count, void *arg)
+{
+    if (event == BEE_SEQ_GAP)
+        printf("%s: lost %llu from %llu\n", inet_ntoa(msg->source.sin_addr),
+               (unsigned long long)count, (unsigned long long)first);
+    else
+        printf("%s: duplicate %llu\n", inet_ntoa(msg->source.sin_addr), (unsigned long long)first);
+}
+
+/* A lost datagram holds back the ones after it for at most a tick. */
+void mcast_seq_tick(evutil_socket_t fd, short events, void *arg)
+{
+    bee_seq_flush(arg);
+}
+
+int main(int argc, char **argv)
+{
+    struct event_base *evbase = event_base_new();
+    bee_server_t *server = bee_server_mcast_new(evbase, "127.0.0.1", "224.1.1.1", 4444);
+    struct timeval tick = { 0, 100000 };
+    struct event *timer;
+    const bee_seq_stats_t *stats;
+    bee_seq_t *seq;
+
+    if (!server) {
+        perror("bee_server_mcast_new");
+        return 1;
+    }
+
+    seq = bee_seq_new(0, 0, 0, mcast_seq_extract, mcast_seq_deliver, mcast_seq_event, NULL);
+    bee_mcast_set_cb(server, bee_seq_mcast_cb, seq);
+    timer = event_new(evbase, -1, EV_PERSIST, mcast_seq_tick, seq);
+    event_add(timer, &tick);
+
+    printf("Start sequenced multicast listener on port 4444\n");
+    event_base_loop(evbase, 0);
+
+    stats = bee_seq_get_stats(seq);
+    printf("received %llu, delivered %llu, lost %llu\n", (unsigned long long)stats->received,
+           (unsigned long long)stats->delivered, (unsigned long long)stats->lost);
+    event_free(timer);
+    bee_seq_free(seq);
+    bee_server_free(server);
+    event_base_free(evbase);
+    return 0;
+}
@@ -7,12 +7,13 @@
 #include "bee.h"
 
 #define BUF_SIZE 4096
+#define MAX_PENDING (256 * 1024)    /* stop reading a client that does not read */
 
 enum BEE_HOOK_RESULT tcp_echo_recv(int sfd, void * arg)
 {
     bee_connection_t * conn = arg;
     char buf[BUF_SIZE];
-    ssize_t recv_nr, send_nr;
+    ssize_t recv_nr;
 
     memset(buf, 0, sizeof(buf));
     recv_nr = recv(sfd, buf, sizeof(buf), 0);
@@ -25,12 +26,24 @@ enum BEE_HOOK_RESULT tcp_echo_recv(int sfd, void * arg)
     else if (recv_nr == 0)
         return BEE_HOOK_PEER_CLOSED;
 
-    send_nr = send(sfd, buf, (size_t)recv_nr, 0);
-    if (send_nr < 0) {
-        perror("send");
-        return BEE_HOOK_ERR;
+    if (bee_conn_write(conn, buf, (size_t)recv_nr) < 0) {
+        perror("bee_conn_write");
+        return BEE_HOOK_CLOSED;
     }
 
+    if (bee_conn_pending(conn) > MAX_PENDING)
+        bee_connection_pause(conn);
+
+    return BEE_HOOK_OK;
+}
+
+enum BEE_HOOK_RESULT tcp_echo_drain(int sfd, void * arg)
+{
+    bee_connection_t * conn = arg;
+
+    if (conn->flags & BEE_CONN_F_PAUSED)
+        bee_connection_resume(conn);
+
     return BEE_HOOK_OK;
 }
 
@@ -40,6 +53,7 @@ int main(int argc, char **argv)
     bee_server_t *server = bee_server_tcp_new(evbase, "0.0.0.0", 8000, -1);
 
     server->on_recv = tcp_echo_recv;
+    server->on_drain = tcp_echo_drain;
     printf("Start tcp echo server with port 8000\n");
     event_base_loop(evbase, 0);
     bee_server_free(server);
@@ -12,7 +12,7 @@ enum BEE_HOOK_RESULT udp_echo_recv(int sfd, void *arg)
 {
     bee_server_t * server = arg;
     char buf[BUF_SIZE];
-    ssize_t recv_nr, send_nr;
+    ssize_t recv_nr;
     struct sockaddr_in cli_sock;
     socklen_t cli_len = sizeof(cli_sock);
 
@@ -25,11 +25,9 @@ enum BEE_HOOK_RESULT udp_echo_recv(int sfd, void *arg)
         return BEE_HOOK_ERR;
     }
 
-    send_nr = sendto(sfd, buf, (size_t)recv_nr, 0, (struct sockaddr *)&cli_sock, cli_len);
-    if (send_nr < 0) {
-        perror("send");
-        return BEE_HOOK_ERR;
-    }
+    /* queued if the socket is full, dropped if even the queue is */
+    if (bee_server_sendto(server, buf, (size_t)recv_nr, (struct sockaddr *)&cli_sock, cli_len) < 0)
+        perror("bee_server_sendto");
 
     return BEE_HOOK_OK;
 }
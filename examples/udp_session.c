@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "bee.h"
+
+#define MAX_SESSIONS    65536
+#define IDLE_MS         10000
+
+/* Per-peer state: how many datagrams it sent. */
+int udp_session_open(bee_udp_session_t *sess, void *arg)
+{
+    sess->pdata = calloc(1, sizeof(unsigned long));
+    return sess->pdata != NULL ? 0 : -1;
+}
+
+int udp_session_close(bee_udp_session_t *sess, void *arg)
+{
+    struct sockaddr_in *peer = (struct sockaddr_in *)&sess->peer;
+
+    printf("%s:%d left after %lu datagrams\n", inet_ntoa(peer->sin_addr), ntohs(peer->sin_port),
+           *(unsigned long *)sess->pdata);
+    free(sess->pdata);
+    return 0;
+}
+
+/* Echoes every datagram; "bye" ends the session. */
+enum BEE_HOOK_RESULT udp_session_recv(bee_udp_session_t *sess, const char *data, size_t len,
+                                      char *reply, size_t *reply_len, void *arg)
+{
+    ++*(unsigned long *)sess->pdata;
+
+    memcpy(reply, data, len);
+    *reply_len = len;
+
+    if (len == 3 && memcmp(data, "bye", 3) == 0)
+        return BEE_HOOK_CLOSED;
+    return BEE_HOOK_OK;
+}
+
+int main(int argc, char **argv)
+{
+    struct event_base *evbase = event_base_new();
+    bee_server_t *server = bee_server_udp_new(evbase, "0.0.0.0", 8000);
+
+    if (bee_udp_set_sessions(server, MAX_SESSIONS, IDLE_MS, udp_session_recv,
+                             udp_session_open, udp_session_close, NULL) < 0) {
+        perror("bee_udp_set_sessions");
+        return 1;
+    }
+
+    printf("Start udp session server with port 8000\n");
+    event_base_loop(evbase, 0);
+    bee_server_free(server);
+    event_base_free(evbase);
+
+    return 0;
+}
@@ -464,6 +464,175 @@ do {                                                                 \
 #endif
 
 
+/* Fast paths for the two hot loops of a request: runs of URL characters
+ * and header values. Both only skip bytes the state machine would have
+ * consumed without a state change; whatever they stop at is handed back to
+ * the byte-by-byte parser, so callbacks and errors stay exactly the same.
+ *
+ * On x86 the widest available implementation is picked once at startup
+ * (AVX2 with 32-byte strides, SSE4.2 with 16-byte strides); everything
+ * else, or a build with -DHTTP_PARSER_NO_SIMD, uses the scalar versions.
+ */
+#if !defined(HTTP_PARSER_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+# define HTTP_PARSER_SIMD 1
+# include <immintrin.h>
+#else
+# define HTTP_PARSER_SIMD 0
+#endif
+
+/* Returns the first byte in [p, end) that is not in 0x21-0x7e or equals
+ * `stop1' or `stop2', or `end'. Pass ' ' for an unused stop character.
+ */
+typedef const char *(*url_run_fn)(const char *p, const char *end,
+                                  char stop1, char stop2);
+
+/* Returns the first CR or LF in [p, end), or NULL. */
+typedef const char *(*find_eol_fn)(const char *p, const char *end);
+
+static const char *
+url_run_scalar(const char *p, const char *end, char stop1, char stop2)
+{
+  for (; p != end; p++) {
+    unsigned char ch = (unsigned char) *p;
+    if (ch <= 0x20 || ch >= 0x7f || ch == (unsigned char) stop1 ||
+        ch == (unsigned char) stop2)
+      break;
+  }
+  return p;
+}
+
+static const char *
+find_eol_scalar(const char *p, const char *end)
+{
+  const char *p_cr = (const char *) memchr(p, CR, end - p);
+  const char *p_lf = (const char *) memchr(p, LF, end - p);
+
+  if (p_cr != NULL && (p_lf == NULL || p_cr < p_lf))
+    return p_cr;
+  return p_lf;
+}
+
+#if HTTP_PARSER_SIMD
+__attribute__((target("sse4.2")))
+static const char *
+url_run_sse42(const char *p, const char *end, char stop1, char stop2)
+{
+  /* byte ranges allowed to continue the run, split around the stops */
+  static const char ranges_path[16] = "\x21\x22\x24\x3e\x40\x7e";
+  static const char ranges_query[16] = "\x21\x22\x24\x7e";
+  static const char ranges_any[16] = "\x21\x7e";
+  const char *table;
+  int table_len;
+  __m128i ranges;
+
+  if (stop1 == '?' && stop2 == '#') {
+    table = ranges_path;
+    table_len = 6;
+  } else if (stop1 == '#' && stop2 == '#') {
+    table = ranges_query;
+    table_len = 4;
+  } else if (stop1 == ' ' && stop2 == ' ') {
+    table = ranges_any;
+    table_len = 2;
+  } else {
+    return url_run_scalar(p, end, stop1, stop2);
+  }
+
+  ranges = _mm_loadu_si128((const __m128i *) table);
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    int idx = _mm_cmpestri(ranges, table_len, v, 16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                           _SIDD_NEGATIVE_POLARITY |
+                           _SIDD_LEAST_SIGNIFICANT);
+    if (idx != 16)
+      return p + idx;
+  }
+  return url_run_scalar(p, end, stop1, stop2);
+}
+
+__attribute__((target("sse4.2")))
+static const char *
+find_eol_sse42(const char *p, const char *end)
+{
+  const __m128i crlf = _mm_setr_epi8(CR, LF, 0, 0, 0, 0, 0, 0,
+                                     0, 0, 0, 0, 0, 0, 0, 0);
+
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    int idx = _mm_cmpestri(crlf, 2, v, 16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY |
+                           _SIDD_LEAST_SIGNIFICANT);
+    if (idx != 16)
+      return p + idx;
+  }
+  return find_eol_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *
+url_run_avx2(const char *p, const char *end, char stop1, char stop2)
+{
+  const __m256i lo = _mm256_set1_epi8(0x20);
+  const __m256i hi = _mm256_set1_epi8(0x7f);
+  const __m256i s1 = _mm256_set1_epi8(stop1);
+  const __m256i s2 = _mm256_set1_epi8(stop2);
+
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    /* signed compares: bytes >= 0x80 are negative and fail `> 0x20' */
+    __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo),
+                                  _mm256_cmpgt_epi8(hi, v));
+    __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(v, s1),
+                                   _mm256_cmpeq_epi8(v, s2));
+    unsigned int mask = ~(unsigned int) _mm256_movemask_epi8(
+                            _mm256_andnot_si256(stop, ok));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+  }
+  return url_run_scalar(p, end, stop1, stop2);
+}
+
+__attribute__((target("avx2")))
+static const char *
+find_eol_avx2(const char *p, const char *end)
+{
+  const __m256i cr = _mm256_set1_epi8(CR);
+  const __m256i lf = _mm256_set1_epi8(LF);
+
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+                          _mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+                                          _mm256_cmpeq_epi8(v, lf)));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+  }
+  return find_eol_scalar(p, end);
+}
+#endif
+
+static url_run_fn url_run = url_run_scalar;
+static find_eol_fn find_eol = find_eol_scalar;
+
+#if HTTP_PARSER_SIMD
+__attribute__((constructor))
+static void
+http_parser_simd_init(void)
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    url_run = url_run_avx2;
+    find_eol = find_eol_avx2;
+  } else if (__builtin_cpu_supports("sse4.2")) {
+    url_run = url_run_sse42;
+    find_eol = find_eol_sse42;
+  }
+}
+#endif
+
+
 /* Map errno values to strings for human-readable output */
 #define HTTP_STRERROR_GEN(n, s) { "HPE_" #n, s },
 static struct {
@@ -1082,6 +1251,27 @@ reexecute:
               SET_ERRNO(HPE_INVALID_URL);
               goto error;
             }
+
+            /* skip the rest of a path, query or fragment run at once */
+            {
+              const char* run_end = p + 1;
+
+              switch (CURRENT_STATE()) {
+                case s_req_path:
+                  run_end = url_run(p + 1, data + len, '?', '#');
+                  break;
+                case s_req_query_string:
+                  run_end = url_run(p + 1, data + len, '#', '#');
+                  break;
+                case s_req_fragment:
+                  run_end = url_run(p + 1, data + len, ' ', ' ');
+                  break;
+                default:
+                  break;
+              }
+              COUNT_HEADER_SIZE(run_end - (p + 1));
+              p = run_end - 1;
+            }
         }
         break;
       }
@@ -1497,21 +1687,14 @@ reexecute:
           switch (h_state) {
             case h_general:
             {
-              const char* p_cr;
-              const char* p_lf;
+              const char* p_eol;
               size_t limit = data + len - p;
 
               limit = MIN(limit, max_header_size);
 
-              p_cr = (const char*) memchr(p, CR, limit);
-              p_lf = (const char*) memchr(p, LF, limit);
-              if (p_cr != NULL) {
-                if (p_lf != NULL && p_cr >= p_lf)
-                  p = p_lf;
-                else
-                  p = p_cr;
-              } else if (UNLIKELY(p_lf != NULL)) {
-                p = p_lf;
+              p_eol = find_eol(p, p + limit);
+              if (p_eol != NULL) {
+                p = p_eol;
               } else {
                 p = data + len;
               }
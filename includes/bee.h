@@ -1,5 +1,10 @@
 #ifndef __BEE_H__
 #define __BEE_H__
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
 #include <event2/event.h>
 
 enum BEE_SERVER_TYPE {
@@ -8,6 +13,41 @@ enum BEE_SERVER_TYPE {
     BEE_SERVER_MCAST_UDP
 };
 
+enum BEE_DRAIN_STATE {
+    BEE_DRAIN_NONE,
+    BEE_DRAIN_RUNNING,
+    BEE_DRAIN_DONE
+};
+
+#define BEE_MCAST_BATCH         32          /* datagrams per recvmmsg() */
+#define BEE_MCAST_DGRAM_SIZE    9216        /* longer datagrams are truncated */
+#define BEE_UDP_BATCH           32          /* datagrams per recvmmsg()/sendmmsg() */
+#define BEE_UDP_DGRAM_SIZE      9216        /* receive and reply buffer of a session datagram */
+#define BEE_UDP_GRO_SIZE        65536       /* receive buffer of a coalesced datagram */
+#define BEE_UDP_GSO_SEGS        64          /* datagrams per UDP_SEGMENT send, a kernel limit */
+#define BEE_UDP_GSO_MAX         65507       /* bytes per UDP_SEGMENT send */
+
+/* Priority classes of an event_base from bee_event_base_new(); libevent
+ * runs the active events of a class only once no higher one has any.
+ */
+enum BEE_PRIORITY {
+    BEE_PRIO_DEFAULT = -1,      /* tcp listeners high, everything else normal */
+    BEE_PRIO_HIGH,              /* control plane: admin cli, health checks */
+    BEE_PRIO_NORMAL,
+    BEE_PRIO_LOW,               /* bulk transfers */
+    BEE_PRIORITIES
+};
+
+#define BEE_CONN_F_PAUSED       (1 << 0)    /* bee_connection_pause() */
+#define BEE_CONN_F_WRITING      (1 << 1)    /* write_ev is armed */
+#define BEE_CONN_F_WANT_DRAIN   (1 << 2)    /* bee_conn_want_drain() */
+#define BEE_CONN_F_CLOSING      (1 << 3)    /* closes once the output is sent */
+#define BEE_CONN_F_CORKED       (1 << 4)    /* bee_conn_cork() */
+#define BEE_CONN_F_BUSY         (1 << 5)    /* bee_conn_set_busy(), drain waits for it */
+
+#define BEE_UDP_F_GRO           (1 << 0)    /* bee_udp_set_gro() */
+#define BEE_UDP_F_NO_GSO        (1 << 1)    /* UDP_SEGMENT failed, send datagram by datagram */
+
 enum BEE_HOOK_RESULT {
     BEE_HOOK_OK,
     BEE_HOOK_CLOSED,
@@ -19,30 +59,159 @@ enum BEE_HOOK_RESULT {
 
 struct bee_server;
 struct bee_connection;
+struct bee_conn_slot;
+struct bee_outbuf;
+struct bee_sockopts;
+struct bee_mcast;
+struct bee_mcast_msg;
+struct bee_udp_session;
+struct bee_udp_sessions;
+struct bee_ratelimit;
+struct bee_monitor;
+struct bee_loop_stats;
 
 typedef struct bee_server            bee_server_t;
 typedef struct bee_connection        bee_connection_t;
+typedef struct bee_sockopts          bee_sockopts_t;
+typedef struct bee_mcast_msg         bee_mcast_msg_t;
+typedef struct bee_udp_session       bee_udp_session_t;
+typedef struct bee_monitor           bee_monitor_t;
+typedef struct bee_loop_stats        bee_loop_stats_t;
+
+/* Identifies a tcp connection of a server: the slot index in the low and
+ * the slot generation in the high 32 bits. A handle of a closed connection
+ * never resolves again, even if its slot is reused. 0 is never valid.
+ */
+typedef uint64_t                     bee_conn_handle_t;
 
 /* If the server type is TCP, the `arg' is bee_connection_t structure.
  * If the server type is UDP or MCAST_UDP, the `arg' is bee_server_t structure.
+ * The result of on_drain is handled like the one of on_recv.
+ * Work deferred past the hook must keep the connection's `handle' rather
+ * than `sfd' or `arg', and resolve it again with bee_connection_lookup().
  */
 typedef enum BEE_HOOK_RESULT (* bee_server_hook_t)(int sfd, void * arg);
 
+typedef void (* bee_conn_iter_fn)(bee_connection_t *conn, void *arg);
+typedef void (* bee_server_drain_cb)(bee_server_t *server, void *arg);
+
+/* A batch of datagrams of a multicast server, see bee_mcast_set_cb(). The
+ * data is only valid during the call, which must not free the server.
+ */
+typedef void (* bee_mcast_cb)(bee_server_t *server, const bee_mcast_msg_t *msgs, int count, void *arg);
+
+/* A datagram of a udp server in session mode, see bee_udp_set_sessions().
+ * Up to BEE_UDP_DGRAM_SIZE bytes written to `reply', with `*reply_len' set
+ * to their length, are sent back to the peer once the batch is done.
+ * BEE_HOOK_CLOSED ends the session after the reply.
+ */
+typedef enum BEE_HOOK_RESULT (* bee_udp_recv_cb)(bee_udp_session_t *sess, const char *data, size_t len,
+                                                 char *reply, size_t *reply_len, void *arg);
+
+/* A new peer (-1 drops its datagram, no session is made), or one that was
+ * idle for too long or is closed.
+ */
+typedef int (* bee_udp_sess_cb)(bee_udp_session_t *sess, void *arg);
+
+/* Socket options of a tcp server; a field left 0 keeps the system default. */
+struct bee_sockopts {
+    int                         nodelay;        /* TCP_NODELAY, accepted sockets */
+    int                         quickack;       /* TCP_QUICKACK, accepted sockets */
+    int                         sndbuf;         /* SO_SNDBUF, bytes */
+    int                         rcvbuf;         /* SO_RCVBUF, bytes */
+    int                         defer_accept;   /* TCP_DEFER_ACCEPT, seconds, listener */
+    int                         fastopen;       /* TCP_FASTOPEN queue length, listener */
+};
+
+/* A datagram received by a multicast server */
+struct bee_mcast_msg {
+    const char                * data;
+    size_t                      len;
+    int                         truncated;      /* longer than BEE_MCAST_DGRAM_SIZE */
+    struct sockaddr_in          source;
+    struct in_addr              group;          /* the destination, from IP_PKTINFO */
+    int                         ifindex;        /* the interface it came in on */
+};
+
+/* What a bee_monitor_t saw of its event_base. The lag is how much later
+ * than scheduled its probe timer ran, i.e. how long a ready event waits.
+ * Hooks are the on_* callbacks of the servers attached to the monitor; a
+ * pass runs the hooks of every event that was ready when its first one
+ * ran, over several loop iterations if libevent caps their callbacks.
+ */
+struct bee_loop_stats {
+    uint64_t                    probes;
+    uint64_t                    lag_us;         /* of the latest probe */
+    uint64_t                    lag_avg_us;     /* moving average, 1/8 weight */
+    uint64_t                    lag_max_us;
+    uint64_t                    passes;
+    uint64_t                    hooks;
+    uint64_t                    hooks_max;      /* in one pass */
+    uint64_t                    hook_ns;        /* spent in hooks */
+    uint64_t                    hook_max_ns;    /* the longest one */
+};
+
+/* A peer of a udp server in session mode. Only valid during the callbacks,
+ * keep the state that outlives them in `pdata'.
+ */
+struct bee_udp_session {
+    bee_server_t              * server;
+    struct sockaddr_storage     peer;
+    socklen_t                   peerlen;
+    void                      * pdata;      /* user-defined data */
+    uint64_t                    last_ms;    /* when the peer was last heard from */
+    uint32_t                    hash;
+    uint32_t                    prev;       /* idle order, oldest first */
+    uint32_t                    next;
+};
+
 struct bee_server {
     enum BEE_SERVER_TYPE        type;
     struct event_base         * evbase;
     struct event              * listen_ev;
     bee_server_hook_t           on_accept;
     bee_server_hook_t           on_recv;
+    bee_server_hook_t           on_close;   /* tcp only, before the fd is closed */
+    bee_server_hook_t           on_drain;   /* queued output went out, see bee_conn_write() */
+    bee_server_hook_t           on_shutdown;/* tcp only, bee_server_drain() began */
     void                      * pdata;      /* user-defined data */
+    struct bee_conn_slot      * slots;      /* handle -> index into `conns' */
+    uint32_t                    nslots;
+    uint32_t                    free_slot;
+    bee_connection_t         ** conns;      /* open tcp connections, dense */
+    uint32_t                    nconns;
+    enum BEE_DRAIN_STATE        drain_state;
+    struct event              * drain_ev;
+    uint64_t                    drain_deadline; /* CLOCK_MONOTONIC ns, 0 for none */
+    bee_server_drain_cb         on_drained;
+    void                      * drain_arg;
+    struct event              * write_ev;   /* udp only, armed while `outq' is not empty */
+    struct bee_outbuf         * outq;       /* datagrams bee_server_sendto() could not send */
+    struct bee_outbuf         * outq_tail;
+    size_t                      outq_len;   /* bytes in outq */
+    bee_sockopts_t              sockopts;   /* bee_server_set_sockopts() */
+    struct bee_mcast          * mcast;      /* bee_mcast_set_cb() */
+    struct bee_udp_sessions   * sessions;   /* bee_udp_set_sessions() */
+    unsigned int                udp_flags;  /* BEE_UDP_F_* */
+    struct bee_ratelimit      * ratelimit;  /* of new connections, bee_server_set_ratelimit() */
+    bee_monitor_t             * monitor;    /* bee_server_set_monitor() */
+    int                         priority;   /* BEE_PRIO_*, bee_server_set_priority() */
 };
 
 /* only for tcp connection */
 struct bee_connection {
     bee_server_t              * server;
+    bee_conn_handle_t           handle;
+    unsigned int                flags;      /* BEE_CONN_F_* */
     struct event              * accept_ev;
     struct sockaddr             saddr;      /* the client come from where */
     void                      * pdata;      /* user-defined data */
+    evutil_socket_t             sfd;
+    struct event              * write_ev;   /* armed while `outq' is not empty */
+    struct bee_outbuf         * outq;       /* unsent output, oldest first */
+    struct bee_outbuf         * outq_tail;
+    size_t                      outq_len;   /* bytes in outq */
+    size_t                      lowat;      /* on_drain once outq_len is down to this */
 };
 
 
@@ -50,7 +219,50 @@ struct bee_connection {
 bee_server_t * bee_server_tcp_new(struct event_base *evbase, const char *baddr, uint16_t port, int backlog);
 bee_server_t * bee_server_udp_new(struct event_base *evbase, const char *baddr, uint16_t port);
 bee_server_t * bee_server_mcast_new(struct event_base *evbase, const char *laddr, const char *gaddr, uint16_t port);
+bee_server_t * bee_server_mcast_open(struct event_base *evbase, uint16_t port);
+bee_server_t * bee_server_tcp_adopt(struct event_base *evbase, evutil_socket_t sfd);
 void bee_server_free(bee_server_t *server);
+int bee_server_set_sockopts(bee_server_t *server, const bee_sockopts_t *opts);
+void bee_server_set_ratelimit(bee_server_t *server, struct bee_ratelimit *rl);
+struct event_base * bee_event_base_new(int max_callbacks, int max_interval_ms);
+bee_monitor_t * bee_monitor_new(struct event_base *evbase, int probe_ms);
+void bee_monitor_free(bee_monitor_t *mon);
+void bee_monitor_get_stats(const bee_monitor_t *mon, bee_loop_stats_t *stats);
+void bee_monitor_reset(bee_monitor_t *mon);
+void bee_server_set_monitor(bee_server_t *server, bee_monitor_t *mon);
+int bee_server_set_priority(bee_server_t *server, int priority);
+int bee_server_drain(bee_server_t *server, const struct timeval *timeout, bee_server_drain_cb cb, void *arg);
+int bee_server_is_draining(bee_server_t *server);
+int bee_server_send_listener(bee_server_t *server, const char *path);
+evutil_socket_t bee_listener_recv(const char *path);
+bee_connection_t * bee_connection_lookup(bee_server_t *server, bee_conn_handle_t handle);
+uint32_t bee_server_conn_count(bee_server_t *server);
+void bee_server_foreach_conn(bee_server_t *server, bee_conn_iter_fn fn, void *arg);
+void bee_connection_close(bee_connection_t *conn);
+void bee_connection_pause(bee_connection_t *conn);
+void bee_connection_resume(bee_connection_t *conn);
+int bee_conn_write(bee_connection_t *conn, const void *data, size_t len);
+int bee_conn_writev(bee_connection_t *conn, const struct iovec *iov, int iovcnt);
+size_t bee_conn_pending(const bee_connection_t *conn);
+void bee_conn_set_lowat(bee_connection_t *conn, size_t lowat);
+void bee_conn_want_drain(bee_connection_t *conn);
+void bee_conn_set_busy(bee_connection_t *conn, int busy);
+void bee_conn_cork(bee_connection_t *conn);
+int bee_conn_uncork(bee_connection_t *conn);
+void bee_outbuf_stats(int *used, int *pooled);
+int bee_server_sendto(bee_server_t *server, const void *data, size_t len,
+                      const struct sockaddr *addr, socklen_t addrlen);
+int bee_mcast_join(bee_server_t *server, const char *gaddr, const char *laddr, const char *saddr);
+int bee_mcast_leave(bee_server_t *server, const char *gaddr, const char *laddr, const char *saddr);
+int bee_mcast_set_loop(bee_server_t *server, int on);
+int bee_mcast_set_cb(bee_server_t *server, bee_mcast_cb cb, void *arg);
+int bee_udp_set_sessions(bee_server_t *server, uint32_t max_sessions, int idle_ms, bee_udp_recv_cb on_recv,
+                         bee_udp_sess_cb on_open, bee_udp_sess_cb on_close, void *arg);
+void bee_udp_session_close(bee_udp_session_t *sess);
+uint32_t bee_udp_session_count(bee_server_t *server);
+int bee_udp_set_gro(bee_server_t *server, int on);
+int bee_server_sendto_gso(bee_server_t *server, const void *data, size_t len, size_t segsize,
+                          const struct sockaddr *addr, socklen_t addrlen);
 
 
 #endif
@@ -0,0 +1,52 @@
+#ifndef __BEE_HPACK_H__
+#define __BEE_HPACK_H__
+#include <stdint.h>
+#include <stddef.h>
+
+/* Default dynamic table size of a connection (RFC 7541, RFC 9113). */
+#define BEE_HPACK_TABLE_SIZE        4096
+
+/* How bee_hpack_encode() may store a field in the peer's dynamic table. */
+#define BEE_HPACK_INDEX             0       /* add it, later fields cost a byte */
+#define BEE_HPACK_NO_INDEX          1       /* one-off values */
+#define BEE_HPACK_NEVER_INDEX       2       /* secrets, not even by proxies */
+
+struct bee_hpack;
+
+typedef struct bee_hpack        bee_hpack_t;
+
+/* Called for every decoded field. The strings are only valid during the
+ * call; a non-zero return stops decoding.
+ */
+typedef int (* bee_hpack_field_cb)(void *arg, const char *name, size_t name_len,
+                                   const char *value, size_t value_len);
+
+
+/* bee_hpack.c */
+/* One bee_hpack_t holds one direction's dynamic table: a decoder for the
+ * header blocks a peer sends, or an encoder for the ones sent to it.
+ */
+bee_hpack_t * bee_hpack_new(size_t max_size);
+void bee_hpack_free(bee_hpack_t *hpack);
+
+/* Decodes a complete header block. Returns 0, or -1 if it is malformed,
+ * which is a connection error (COMPRESSION_ERROR) for HTTP/2.
+ */
+int bee_hpack_decode(bee_hpack_t *hpack, const uint8_t *in, size_t len, bee_hpack_field_cb cb, void *arg);
+
+/* The peer's SETTINGS_HEADER_TABLE_SIZE; the encoder shrinks its table and
+ * announces the new size at the start of the next header block.
+ */
+void bee_hpack_set_max_size(bee_hpack_t *hpack, size_t max_size);
+
+/* Encoding writes into `out' and returns the bytes used, or -1 if `cap' is
+ * too small. Begin every header block with bee_hpack_encode_begin(); a
+ * field takes at most bee_hpack_encode_bound() bytes.
+ */
+int bee_hpack_encode_begin(bee_hpack_t *hpack, uint8_t *out, size_t cap);
+int bee_hpack_encode(bee_hpack_t *hpack, uint8_t *out, size_t cap, const char *name, size_t name_len,
+                     const char *value, size_t value_len, int mode);
+size_t bee_hpack_encode_bound(size_t name_len, size_t value_len);
+
+
+#endif
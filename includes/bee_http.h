@@ -2,24 +2,83 @@
 #define __BEE_HTTP_H__
 #include <sys/queue.h>
 #include "bee.h"
+#include "bee_pool.h"
+#include "bee_ratelimit.h"
 #include "http_parser.h"
 
 #define MAX_HTTP_HEADERS        (128)
 
+/* bh_limits_t defaults */
+#define BH_DEFAULT_MAX_HEADERS          (64)
+#define BH_DEFAULT_MAX_HEADER_BYTES     (16 * 1024)
+#define BH_DEFAULT_MAX_URL              (8 * 1024)
+#define BH_DEFAULT_MAX_BODY             (1024 * 1024)
+
+/* HTTP/2, per connection */
+#define BH_H2_MAX_STREAMS               (128)           /* concurrent streams */
+#define BH_H2_WINDOW_SIZE               (256 * 1024)    /* receive window */
+
+/* Built-in routes, answered before the callbacks (bh_server_set_probes()) */
+#define BH_PROBE_HEALTH                 (1 << 0)        /* /healthz: the loop runs */
+#define BH_PROBE_READY                  (1 << 1)        /* /readyz: not draining, loop lag low */
+#define BH_PROBE_DEBUG                  (1 << 2)        /* /debug/bee: counters as JSON */
+#define BH_READY_MAX_LAG_MS             (100)           /* of the server's bee_monitor_t */
+
+/* bh_stream_t defaults */
+#define BH_STREAM_CHUNK_SIZE        (16 * 1024)
+#define BH_STREAM_LOW_WATERMARK     (16 * 1024)
+#define BH_STREAM_HIGH_WATERMARK    (64 * 1024)
+
 
 struct bh_header;
+struct bh_limits;
+struct bh_param;
+struct bh_arena;
 struct bh_request;
 struct bh_callback;
 struct bh_server;
+struct bh_stream;
 
 
 typedef struct bh_header      bh_header_t;
+typedef struct bh_limits      bh_limits_t;
+typedef struct bh_param       bh_param_t;
 typedef struct bh_request     bh_request_t;
 typedef struct bh_callback    bh_callback_t;
 typedef struct bh_server      bh_server_t;
+typedef struct bh_stream      bh_stream_t;
 
 
 typedef void (* bh_callback_cb)(int sfd, bh_request_t *req);
+typedef void (* bh_stream_cb)(bh_stream_t *stream, void *arg);
+
+
+/* Headers the parser recognizes while reading the request, so that they
+ * can be looked up without scanning bh_request_t.headers.
+ */
+enum BH_HEADER_ID {
+    BH_HDR_HOST = 0,
+    BH_HDR_CONTENT_TYPE,
+    BH_HDR_CONTENT_LENGTH,
+    BH_HDR_CONNECTION,
+    BH_HDR_AUTHORIZATION,
+    BH_HDR_USER_AGENT,
+    BH_HDR_ACCEPT,
+    BH_HDR_ACCEPT_ENCODING,
+    BH_HDR_ACCEPT_LANGUAGE,
+    BH_HDR_COOKIE,
+    BH_HDR_TRANSFER_ENCODING,
+    BH_HDR_EXPECT,
+    BH_HDR_UPGRADE,
+    BH_HDR_IF_NONE_MATCH,
+    BH_HDR_IF_MODIFIED_SINCE,
+    BH_HDR_REFERER,
+    BH_HDR_ORIGIN,
+    BH_HDR_CACHE_CONTROL,
+    BH_HDR_RANGE,
+    BH_HDR_X_FORWARDED_FOR,
+    BH_HDR_MAX
+};
 
 
 struct bh_header {
@@ -29,31 +88,104 @@ struct bh_header {
     size_t      value_len;
 };
 
+/* Per-server request limits. A request over one of them is answered with
+ * 431 (headers), 414 (url) or 413 (body) as soon as the parser reaches
+ * the offending part, and its connection is closed.
+ */
+struct bh_limits {
+    int                 max_headers;        /* at most MAX_HTTP_HEADERS */
+    size_t              max_header_bytes;   /* url, names and values together */
+    size_t              max_url;
+    size_t              max_body;
+};
+
+/* A query parameter or cookie; both strings are NUL-terminated. */
+struct bh_param {
+    const char        * name;
+    const char        * value;
+    size_t              name_len;
+    size_t              value_len;
+};
+
 struct bh_request {
     char              * url;
     char              * method;
     int                 header_lines;
     bh_header_t         headers[MAX_HTTP_HEADERS];
+    bh_header_t       * known[BH_HDR_MAX];  /* first occurrence in `headers' */
     char              * body;
     size_t              body_len;
+    size_t              body_cap;           /* room at `body', NUL included */
+
+    struct bh_arena   * arena;              /* backs every string above */
+    const bh_limits_t * limits;             /* of the server, or NULL */
+    size_t              header_bytes;
+    int                 reject;             /* 4xx if a limit was hit, 500 on OOM */
+
+    /* computed on first use by the bh_request_* accessors, don't read
+     * these directly
+     */
+    unsigned int        parsed;             /* BH_PARSED_* */
+    char              * path;
+    char              * query;
+    char              * fragment;
+    bh_param_t        * params;
+    int                 nparams;
+    bh_param_t        * cookies;
+    int                 ncookies;
 };
 
 struct bh_callback {
     char                      * path;
     bh_callback_cb              cb;
+    bee_pool_t                * pool;       /* run `cb' on this pool if set */
+    bee_ratelimit_t           * ratelimit;  /* per client, on top of the server's */
+    uint64_t                    requests;   /* routed here */
+    uint64_t                    limited;    /* of them, answered 429 by `ratelimit' */
     TAILQ_ENTRY(bh_callback)    next;
 };
 
 struct bh_server {
     http_parser_settings          parser_settings;
     TAILQ_HEAD(, bh_callback)     callbacks;
+    bee_pool_cq_t               * cq;       /* completions of offloaded callbacks */
+    bh_limits_t                   limits;
+    bee_ratelimit_t             * ratelimit;    /* requests per client */
+    unsigned int                  probes;       /* BH_PROBE_* */
+    int                           ready_max_lag_ms;
+    uint64_t                      probed;       /* requests for a built-in route */
+    uint64_t                      not_found;
+    uint64_t                      limited;      /* answered 429 by `ratelimit' */
 };
 
 
 bee_server_t * bh_server_new(struct event_base *evbase, const char *baddr, uint16_t port, int backlog);
+bee_server_t * bh_server_adopt(struct event_base *evbase, evutil_socket_t sfd);
 void bh_server_free(bee_server_t *server);
+void bh_server_set_limits(bee_server_t *server, const bh_limits_t *limits);
 bh_callback_t * bh_server_set_cb(bee_server_t *server, const char *path, bh_callback_cb cb);
+bh_callback_t * bh_server_set_cb_pool(bee_server_t *server, const char *path, bh_callback_cb cb, bee_pool_t *pool);
+void bh_server_set_ratelimit(bee_server_t *server, bee_ratelimit_t *rl);
+void bh_callback_set_ratelimit(bh_callback_t *callback, bee_ratelimit_t *rl);
+void bh_server_set_probes(bee_server_t *server, unsigned int probes, int ready_max_lag_ms);
+
+bh_request_t * bh_request_new(void);
+void bh_request_free(bh_request_t *request);
+void * bh_request_alloc(bh_request_t *request, size_t size);
+const char * bh_request_get_header(const bh_request_t *request, enum BH_HEADER_ID id);
+const char * bh_request_find_header(const bh_request_t *request, const char *field);
+const char * bh_request_path(bh_request_t *request);
+const char * bh_request_query(bh_request_t *request);
+const char * bh_request_fragment(bh_request_t *request);
+const bh_param_t * bh_request_params(bh_request_t *request, int *count);
+const char * bh_request_get_param(bh_request_t *request, const char *name);
+const bh_param_t * bh_request_cookies(bh_request_t *request, int *count);
+const char * bh_request_get_cookie(bh_request_t *request, const char *name);
 
 void bh_send_reply(int sfd, const char *content_type, const char *body, int body_len);
+bh_stream_t * bh_stream_new(int sfd, const char *content_type, bh_stream_cb on_drain, void *arg);
+void bh_stream_set_watermarks(bh_stream_t *stream, size_t low, size_t high);
+int bh_stream_write(bh_stream_t *stream, const void *data, size_t len);
+void bh_stream_end(bh_stream_t *stream);
 #endif
 
@@ -0,0 +1,30 @@
+#ifndef __BEE_LOOP_H__
+#define __BEE_LOOP_H__
+#include <event2/event.h>
+#include "bee.h"
+
+struct bee_loop;
+
+typedef struct bee_loop         bee_loop_t;
+
+typedef void (* bee_loop_fn)(void *arg);
+
+/* `conn' is NULL if the target connection was closed before the message
+ * was delivered, so that the receiver can still release `arg'.
+ */
+typedef void (* bee_loop_conn_fn)(bee_connection_t *conn, void *arg);
+
+
+/* bee_loop.c */
+bee_loop_t * bee_loop_new(struct event_base *evbase, unsigned int ring_size);
+void bee_loop_free(bee_loop_t *loop);
+struct event_base * bee_loop_get_base(bee_loop_t *loop);
+
+/* Callable from any thread. `fn' runs on the thread dispatching the loop's
+ * event_base. Returns 0, or -1 with errno set to EAGAIN if the ring is full.
+ */
+int bee_loop_post(bee_loop_t *loop, bee_loop_fn fn, void *arg);
+int bee_connection_post(bee_loop_t *loop, bee_server_t *server, bee_conn_handle_t handle, bee_loop_conn_fn fn, void *arg);
+
+
+#endif
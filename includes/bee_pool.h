@@ -0,0 +1,31 @@
+#ifndef __BEE_POOL_H__
+#define __BEE_POOL_H__
+#include <event2/event.h>
+
+struct bee_pool;
+struct bee_pool_cq;
+
+typedef struct bee_pool         bee_pool_t;
+typedef struct bee_pool_cq      bee_pool_cq_t;
+
+/* `work' runs on a pool worker thread, `done' runs afterwards on the
+ * event loop that owns the completion queue the job was submitted with.
+ */
+typedef void (* bee_pool_fn)(void *arg);
+
+
+/* bee_pool.c */
+bee_pool_t * bee_pool_new(int nthreads, int max_pending);
+void bee_pool_free(bee_pool_t *pool);
+int bee_pool_pending(bee_pool_t *pool);
+
+bee_pool_cq_t * bee_pool_cq_new(struct event_base *evbase);
+void bee_pool_cq_free(bee_pool_cq_t *cq);
+
+/* Returns 0 on success, or -1 with errno set to EAGAIN when the pool
+ * already holds `max_pending' queued jobs.
+ */
+int bee_pool_submit(bee_pool_t *pool, bee_pool_cq_t *cq, bee_pool_fn work, bee_pool_fn done, void *arg);
+
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef __BEE_RATELIMIT_H__
+#define __BEE_RATELIMIT_H__
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* Entries per set of the table; a new client evicts the one of its set
+ * that was seen least recently.
+ */
+#define BEE_RATELIMIT_WAYS          4
+
+struct bee_ratelimit;
+
+typedef struct bee_ratelimit    bee_ratelimit_t;
+
+
+/* bee_ratelimit.c */
+/* Token buckets of `burst' tokens refilled at `rate' per second, one per
+ * client address (the port is ignored), in a table of `max_clients'
+ * entries (rounded up to a power of 2) that never grows.
+ */
+bee_ratelimit_t * bee_ratelimit_new(uint32_t max_clients, double rate, double burst);
+void bee_ratelimit_free(bee_ratelimit_t *rl);
+
+/* Takes a token from the bucket of `addr': 0, or -1 if it is empty. Only
+ * the thread of the loop using `rl' may call it.
+ */
+int bee_ratelimit_take(bee_ratelimit_t *rl, const struct sockaddr *addr);
+
+/* The tokens `addr' has left, or -1 if it is not tracked (a full bucket).
+ * Callable from any thread, it never blocks the loop.
+ */
+double bee_ratelimit_peek(const bee_ratelimit_t *rl, const struct sockaddr *addr);
+
+void bee_ratelimit_stats(const bee_ratelimit_t *rl, uint64_t *allowed, uint64_t *limited, uint64_t *evicted);
+
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __BEE_SEQ_H__
+#define __BEE_SEQ_H__
+#include <stdint.h>
+#include "bee.h"
+
+/* bee_seq_new() defaults */
+#define BEE_SEQ_WINDOW              256         /* datagrams held per source */
+#define BEE_SEQ_SLOT_SIZE           1500        /* longest datagram that can be held */
+#define BEE_SEQ_MAX_SOURCES         64
+
+/* The `seq' of datagrams delivered outside of any sequence */
+#define BEE_SEQ_NONE                UINT64_MAX
+
+enum BEE_SEQ_EVENT {
+    BEE_SEQ_GAP,            /* `count' numbers from `first' were given up on */
+    BEE_SEQ_DUP             /* `first' arrived again, or after it was given up */
+};
+
+struct bee_seq;
+struct bee_seq_stats;
+
+typedef struct bee_seq          bee_seq_t;
+typedef struct bee_seq_stats    bee_seq_stats_t;
+
+/* Returns the sequence number of `msg' in `seq', or -1 to deliver it as it
+ * is, outside of any sequence (e.g. a heartbeat).
+ */
+typedef int (* bee_seq_extract_cb)(const bee_mcast_msg_t *msg, uint64_t *seq, void *arg);
+
+/* In-order delivery; `msg' is only valid during the call. */
+typedef void (* bee_seq_deliver_cb)(const bee_mcast_msg_t *msg, uint64_t seq, void *arg);
+
+typedef void (* bee_seq_event_cb)(const bee_mcast_msg_t *msg, enum BEE_SEQ_EVENT event,
+                                  uint64_t first, uint64_t count, void *arg);
+
+struct bee_seq_stats {
+    uint64_t                    received;
+    uint64_t                    delivered;
+    uint64_t                    reordered;      /* held back, then delivered in order */
+    uint64_t                    duplicates;
+    uint64_t                    gaps;           /* BEE_SEQ_GAP events */
+    uint64_t                    lost;           /* numbers given up on */
+    uint64_t                    unsequenced;    /* passed through as they came */
+    uint64_t                    oversize;       /* out of order and too long to hold */
+};
+
+
+/* bee_seq.c */
+/* A sequencing layer for multicast datagrams: one sequence per source and
+ * group, each with a reorder window of `window' datagrams (a power of 2)
+ * of up to `slot_size' bytes. All memory of a source is allocated when it
+ * is first seen, up to `max_sources'; later sources are unsequenced.
+ */
+bee_seq_t * bee_seq_new(int window, size_t slot_size, int max_sources,
+                        bee_seq_extract_cb extract, bee_seq_deliver_cb deliver,
+                        bee_seq_event_cb on_event, void *arg);
+void bee_seq_free(bee_seq_t *seq);
+
+/* Feeds received datagrams through the layer. bee_seq_mcast_cb() does the
+ * same as a bee_mcast_set_cb() callback, with the bee_seq_t as `arg'.
+ */
+void bee_seq_input(bee_seq_t *seq, const bee_mcast_msg_t *msgs, int count);
+void bee_seq_mcast_cb(bee_server_t *server, const bee_mcast_msg_t *msgs, int count, void *arg);
+
+/* Gives up on every missing number that holds back a datagram, e.g. from
+ * a timer, so that a lost one delays the rest at most until then.
+ */
+void bee_seq_flush(bee_seq_t *seq);
+
+const bee_seq_stats_t * bee_seq_get_stats(const bee_seq_t *seq);
+int bee_seq_source_stats(const bee_seq_t *seq, const struct sockaddr_in *source,
+                         const struct in_addr *group, bee_seq_stats_t *stats);
+
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __BEE_TIMER_H__
+#define __BEE_TIMER_H__
+#include <stdint.h>
+#include <event2/event.h>
+
+/* A resolution of at least this many milliseconds reads the coarse clock
+ * (CLOCK_MONOTONIC_COARSE), which is cheaper but only ticks every few ms.
+ */
+#define BEE_TIMER_COARSE_MS         10
+
+struct bee_timer;
+struct bee_timer_wheel;
+
+typedef struct bee_timer        bee_timer_t;
+typedef struct bee_timer_wheel  bee_timer_wheel_t;
+
+/* Runs on the wheel's loop once the timer expired; it is no longer pending
+ * and may be added again or freed.
+ */
+typedef void (* bee_timer_cb)(bee_timer_t *timer, void *arg);
+
+/* Embedded in the caller's own structures, so that timers cost no
+ * allocation. Set up with bee_timer_init(), the rest is private.
+ */
+struct bee_timer {
+    struct bee_timer          * next;
+    struct bee_timer         ** pprev;      /* NULL unless pending */
+    bee_timer_wheel_t         * wheel;
+    uint64_t                    expire;     /* in ticks */
+    bee_timer_cb                cb;
+    void                      * arg;
+};
+
+
+/* bee_timer.c */
+/* A hierarchical timing wheel of `resolution_ms' ticks on `evbase'. A
+ * single libevent timer drives it, and only while a timer is pending.
+ */
+bee_timer_wheel_t * bee_timer_wheel_new(struct event_base *evbase, unsigned int resolution_ms);
+
+/* Pending timers are dropped without their callbacks. */
+void bee_timer_wheel_free(bee_timer_wheel_t *wheel);
+uint64_t bee_timer_wheel_count(const bee_timer_wheel_t *wheel);
+
+void bee_timer_init(bee_timer_t *timer, bee_timer_cb cb, void *arg);
+
+/* (Re)arms `timer' to expire in `ms', rounded up to whole ticks; delays
+ * beyond 2^32 ticks are cut to that. Adding and cancelling are O(1).
+ */
+void bee_timer_add(bee_timer_wheel_t *wheel, bee_timer_t *timer, uint64_t ms);
+void bee_timer_cancel(bee_timer_t *timer);
+int bee_timer_pending(const bee_timer_t *timer);
+
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __BEE_URING_H__
+#define __BEE_URING_H__
+#include <stdint.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <event2/event.h>
+#include "bee.h"
+
+struct bee_uring;
+struct bee_uring_conn;
+struct bee_uring_send;
+
+typedef struct bee_uring            bee_uring_t;
+typedef struct bee_uring_conn       bee_uring_conn_t;
+
+/* Completion-style hooks: the kernel already received the data into a
+ * ring-provided buffer, so `data' is only valid during the call.
+ * on_recv is called with `len' 0 once the peer closed the connection.
+ * The BEE_HOOK_RESULT values mean the same as for bee_server_hook_t.
+ */
+typedef enum BEE_HOOK_RESULT (* bee_uring_hook_t)(bee_uring_conn_t *conn, const char *data, size_t len);
+
+struct bee_uring_stats {
+    uint64_t                    enters;     /* io_uring_enter() calls */
+    uint64_t                    cqes;
+    uint64_t                    zc_sends;
+    uint64_t                    copied_sends;
+    uint64_t                    nobufs;     /* recvs starved of buffers */
+};
+
+struct bee_uring_conn {
+    bee_uring_t               * ring;
+    int                         sfd;
+    struct sockaddr_storage     saddr;      /* the client come from where */
+    void                      * pdata;      /* user-defined data */
+    void                      * server_pdata;
+    bee_uring_hook_t            on_recv;
+    int                         inflight;   /* sqes that still refer to us */
+    int                         recv_armed;
+    int                         closing;    /* no more hooks or sends */
+    int                         shut;       /* queued sends flushed, socket shut down */
+    int                         starved;    /* waits for a free buffer */
+    struct bee_uring_send     * sendq;
+    struct bee_uring_send     * sendq_tail;
+    struct bee_uring_conn     * next_starved;
+    TAILQ_ENTRY(bee_uring_conn) next;
+};
+
+
+/* bee_uring.c */
+bee_uring_t * bee_uring_new(struct event_base *evbase, unsigned int entries, unsigned int nbufs, unsigned int buf_size);
+void bee_uring_free(bee_uring_t *ring);
+int bee_uring_tcp_listen(bee_uring_t *ring, const char *baddr, uint16_t port, int backlog,
+                         bee_uring_hook_t on_accept, bee_uring_hook_t on_recv, void *pdata);
+int bee_uring_send(bee_uring_conn_t *conn, const void *data, size_t len);
+void bee_uring_close(bee_uring_conn_t *conn);
+void bee_uring_get_stats(bee_uring_t *ring, struct bee_uring_stats *stats);
+
+
+#endif
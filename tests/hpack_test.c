@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <string.h>
+#include "bee_hpack.h"
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);  \
+            return 1;                                                   \
+        }                                                               \
+    } while (0)
+
+struct field {
+    char                        name[32];
+    char                        value[32];
+};
+
+struct fields {
+    int                         count;
+    struct field                f[4];
+};
+
+static int
+collect(void *arg, const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    struct fields *fields = arg;
+    struct field *f;
+
+    if (fields->count == 4 || name_len >= sizeof(f->name) || value_len >= sizeof(f->value))
+        return -1;
+
+    f = &fields->f[fields->count++];
+    memcpy(f->name, name, name_len);
+    f->name[name_len] = '\0';
+    memcpy(f->value, value, value_len);
+    f->value[value_len] = '\0';
+    return 0;
+}
+
+/* A literal whose name is a dynamic entry that adding it evicts. */
+static int
+test_evict_own_name(void)
+{
+    static const uint8_t block[] = {
+        0x3f, 0x21,                                 /* table size update to 64 */
+        0x40, 0x01, 'x', 0x14,                      /* "x", indexed: 53 bytes */
+        'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a',
+        'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a',
+        0x7e, 0x14,                                 /* name of entry 62, indexed */
+        'b', 'b', 'b', 'b', 'b', 'b', 'b', 'b', 'b', 'b',
+        'b', 'b', 'b', 'b', 'b', 'b', 'b', 'b', 'b', 'b',
+    };
+    static const uint8_t again[] = { 0xbe };        /* entry 62 */
+    struct fields fields;
+    bee_hpack_t *hpack = bee_hpack_new(BEE_HPACK_TABLE_SIZE);
+
+    CHECK(hpack != NULL);
+
+    memset(&fields, 0, sizeof(fields));
+    CHECK(bee_hpack_decode(hpack, block, sizeof(block), collect, &fields) == 0);
+    CHECK(fields.count == 2);
+    CHECK(strcmp(fields.f[0].name, "x") == 0);
+    CHECK(strcmp(fields.f[0].value, "aaaaaaaaaaaaaaaaaaaa") == 0);
+    CHECK(strcmp(fields.f[1].name, "x") == 0);
+    CHECK(strcmp(fields.f[1].value, "bbbbbbbbbbbbbbbbbbbb") == 0);
+
+    /* the second field replaced the first in the table */
+    memset(&fields, 0, sizeof(fields));
+    CHECK(bee_hpack_decode(hpack, again, sizeof(again), collect, &fields) == 0);
+    CHECK(fields.count == 1);
+    CHECK(strcmp(fields.f[0].name, "x") == 0);
+    CHECK(strcmp(fields.f[0].value, "bbbbbbbbbbbbbbbbbbbb") == 0);
+
+    bee_hpack_free(hpack);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (test_evict_own_name() != 0)
+        return 1;
+
+    printf("hpack_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "bee.h"
+#include "bee_http.h"
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);  \
+            return 1;                                                   \
+        }                                                               \
+    } while (0)
+
+#define BIG_WRITE       ((16 << 20) + 1)    /* seven hex digits */
+
+struct client {
+    struct event_base         * evbase;
+    char                        head[512];
+    size_t                      len;
+};
+
+static char *big;
+
+static void
+big_cb(int sfd, bh_request_t *request)
+{
+    bh_stream_t *stream = bh_stream_new(sfd, "application/octet-stream", NULL, NULL);
+
+    if (stream == NULL)
+        return;
+    if (bh_stream_write(stream, big, BIG_WRITE) < 0)
+        perror("bh_stream_write");
+    bh_stream_end(stream);
+}
+
+/* Keeps the start of the response, up to the first chunk-size line. */
+static void
+client_read_cb(evutil_socket_t fd, short events, void *arg)
+{
+    struct client *client = arg;
+    const char *body;
+    ssize_t n;
+
+    n = recv(fd, client->head + client->len, sizeof(client->head) - 1 - client->len, 0);
+    if (n > 0) {
+        client->len += n;
+        client->head[client->len] = '\0';
+        body = strstr(client->head, "\r\n\r\n");
+        if (body == NULL || strstr(body + 4, "\r\n") == NULL)
+            if (client->len < sizeof(client->head) - 1)
+                return;
+    }
+    event_base_loopbreak(client->evbase);
+}
+
+/* A write big enough to need seven hex digits is framed whole. */
+static int
+test_big_chunk(void)
+{
+    static const char request[] = "GET /big HTTP/1.1\r\nHost: test\r\n\r\n";
+    struct client client = { 0 };
+    struct sockaddr_in sin;
+    socklen_t slen = sizeof(sin);
+    bee_server_t *server;
+    struct event *ev;
+    const char *body;
+    int fd;
+
+    big = malloc(BIG_WRITE);
+    CHECK(big != NULL);
+    memset(big, 'x', BIG_WRITE);
+
+    client.evbase = event_base_new();
+    CHECK(client.evbase != NULL);
+    server = bh_server_new(client.evbase, "127.0.0.1", 0, -1);
+    CHECK(server != NULL);
+    CHECK(bh_server_set_cb(server, "/big", big_cb) != NULL);
+    CHECK(getsockname(event_get_fd(server->listen_ev), (struct sockaddr *)&sin, &slen) == 0);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(fd >= 0);
+    CHECK(connect(fd, (struct sockaddr *)&sin, slen) == 0);
+    CHECK(send(fd, request, sizeof(request) - 1, 0) == sizeof(request) - 1);
+
+    ev = event_new(client.evbase, fd, EV_READ | EV_PERSIST, client_read_cb, &client);
+    CHECK(ev != NULL);
+    event_add(ev, NULL);
+    event_base_dispatch(client.evbase);
+
+    body = strstr(client.head, "\r\n\r\n");
+    CHECK(strncmp(client.head, "HTTP/1.1 200 OK\r\n", 17) == 0);
+    CHECK(body != NULL);
+    CHECK(strncmp(body + 4, "1000001\r\nxxxx", 13) == 0);
+
+    event_free(ev);
+    close(fd);
+    bh_server_free(server);
+    event_base_free(client.evbase);
+    free(big);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (test_big_chunk() != 0)
+        return 1;
+
+    printf("stream_test: ok\n");
+    return 0;
+}